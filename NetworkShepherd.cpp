@@ -2,6 +2,7 @@
 
 #include <cstdint>		// for fixed-width stuff
 #include <cstring>		// for std::strcmp
+#include <chrono>		// for std::chrono::steady_clock
 
 #include "crossplatform_io.h"
 
@@ -13,6 +14,8 @@
 #include <sys/types.h>		// for Linux system types
 #include <ifaddrs.h>		// for getifaddrs function and supporting struct
 #include <netdb.h>		// for getaddrinfo (I think), because that does DNS requests (hence a sort of "network database")
+#include <netinet/in.h>		// for IP_PKTINFO and IPV6_RECVPKTINFO
+#include <time.h>		// for clock_gettime
 
 using socket_t = int;
 using sockaddr_storage_family_t = sa_family_t;
@@ -37,6 +40,8 @@ using sockaddr_storage_family_t = short;
 
 #include "error_reporting.h"
 
+#include "usdt.h"		// for the "nc" USDT probes
+
 #ifdef PLATFORM_WINDOWS
 #pragma comment(lib, "Ws2_32.lib")	// statically link with winsock2 lib, because Windows is annoying
 #endif
@@ -52,6 +57,21 @@ socket_t NetworkShepherd::communicatorSocket;
 
 sockaddr_storage_family_t NetworkShepherd::UDPSenderAddressFamily;
 
+std::atomic<uint64_t> NetworkShepherd::UDPTruncatedPacketCount;
+std::atomic<uint64_t> NetworkShepherd::UDPDroppedPacketCount;
+
+network_phase_observer_t NetworkShepherd::phaseObserver = nullptr;
+
+uint64_t begin_network_phase() noexcept {
+	if (!NetworkShepherd::phaseObserver) { return 0; }
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void end_network_phase(NetworkPhase phase, uint64_t start) noexcept {
+	if (!NetworkShepherd::phaseObserver) { return; }
+	NetworkShepherd::phaseObserver(phase, start, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
 void NetworkShepherd::init() noexcept {
 #ifdef PLATFORM_WINDOWS
 	if (WSAStartup(MAKEWORD(2, 2), &WSAData) != 0) { REPORT_ERROR_AND_EXIT("WSAStartup failed", EXIT_FAILURE); }
@@ -96,6 +116,8 @@ struct sockaddr_storage construct_sockaddr(const char* node, uint16_t port, IPVe
 // NOTE: This is different on Linux, since one can easily just type "lo" if one requires the loopback interface.
 #ifndef PLATFORM_WINDOWS
 	if (resolve_interfaces_instead_of_hostnames) {
+		uint64_t phaseStart = begin_network_phase();
+
 		struct ifaddrs* interfaceAddresses;
 
 		if (getifaddrs(&interfaceAddresses) != -1) {
@@ -121,6 +143,8 @@ struct sockaddr_storage construct_sockaddr(const char* node, uint16_t port, IPVe
 
 					freeifaddrs(interfaceAddresses);
 
+					end_network_phase(NetworkPhase::INTERFACE_LOOKUP, phaseStart);
+
 					return result_sockaddr;
 				}
 			}
@@ -128,6 +152,8 @@ struct sockaddr_storage construct_sockaddr(const char* node, uint16_t port, IPVe
 			freeifaddrs(interfaceAddresses);
 		}
 
+		end_network_phase(NetworkPhase::INTERFACE_LOOKUP, phaseStart);
+
 		addressRetrievalHint.ai_flags |= AI_NUMERICHOST;
 	}
 #endif
@@ -140,6 +166,7 @@ struct sockaddr_storage construct_sockaddr(const char* node, uint16_t port, IPVe
 
 	struct addrinfo* addressInfo;
 
+	uint64_t phaseStart = begin_network_phase();
 	switch (getaddrinfo(node, nullptr, &addressRetrievalHint, &addressInfo)) {
 		case 0: break;
 		// NOTE: Interestingly, these error codes are the same in Linux and Windows, so no #ifdef's required.
@@ -167,6 +194,7 @@ struct sockaddr_storage construct_sockaddr(const char* node, uint16_t port, IPVe
 
 		default: REPORT_ERROR_AND_EXIT("sockaddr construction failed, unknown reason", EXIT_FAILURE);
 	}
+	end_network_phase(NetworkPhase::RESOLVE, phaseStart);
 
 	for (struct addrinfo* info = addressInfo; ; info = info->ai_next) {
 		struct sockaddr_storage result_sockaddr;
@@ -199,8 +227,10 @@ void NetworkShepherd::createListener(const char* address, uint16_t port, int soc
 	struct sockaddr_storage listenerAddress = construct_sockaddr<CSA_RESOLVE_HOSTNAMES>(address, port, listenerIPVersionConstraint);
 #endif
 
+	uint64_t phaseStart = begin_network_phase();
 	listenerSocket = socket(listenerAddress.ss_family, socketType, 0);
 	if (listenerSocket == INVALID_SOCKET) { REPORT_ERROR_AND_EXIT("failed to create TCP listener socket", EXIT_FAILURE); }
+	end_network_phase(NetworkPhase::SOCKET, phaseStart);
 
 	switch (listenerIPVersionConstraint) {
 	case IPVersionConstraint::NONE:
@@ -219,6 +249,7 @@ void NetworkShepherd::createListener(const char* address, uint16_t port, int soc
 		}
 	}
 
+	phaseStart = begin_network_phase();
 	if (bind(listenerSocket, (const sockaddr*)&listenerAddress, sizeof(listenerAddress)) == SOCKET_ERROR) {
 		int error = GET_LAST_ERROR;
 		switch (error) {
@@ -240,15 +271,20 @@ void NetworkShepherd::createListener(const char* address, uint16_t port, int soc
 		default: REPORT_ERROR_AND_CODE_AND_EXIT("bind TCP listener failed, unknown reason", error, EXIT_FAILURE);
 		}
 	}
+	end_network_phase(NetworkPhase::BIND, phaseStart);
 }
 
 void NetworkShepherd::listen(int backlogLength) noexcept {
+	uint64_t phaseStart = begin_network_phase();
 	if (::listen(listenerSocket, backlogLength) == SOCKET_ERROR) {
 		REPORT_ERROR_AND_EXIT("failed to listen with TCP listener socket", EXIT_FAILURE);
 	}
+	end_network_phase(NetworkPhase::LISTEN, phaseStart);
+	USDT_PROBE2(listen, listenerSocket, backlogLength);
 }
 
 void NetworkShepherd::accept() noexcept {
+	uint64_t phaseStart = begin_network_phase();
 	communicatorSocket = ::accept(listenerSocket, nullptr, nullptr);
 	if (communicatorSocket == INVALID_SOCKET) {
 		int error = GET_LAST_ERROR;
@@ -262,6 +298,8 @@ void NetworkShepherd::accept() noexcept {
 
 		REPORT_ERROR_AND_CODE_AND_EXIT("TCP listener accept connection failed, unknown reason", error, EXIT_FAILURE);
 	}
+	end_network_phase(NetworkPhase::ACCEPT, phaseStart);
+	USDT_PROBE1(accept, communicatorSocket);
 }
 
 void bindCommunicatorToSource(const char* sourceAddress_string, uint16_t sourcePort, IPVersionConstraint sourceAddressIPVersionConstraint) noexcept {
@@ -283,6 +321,7 @@ void bindCommunicatorToSource(const char* sourceAddress_string, uint16_t sourceP
 	}
 #endif
 
+	uint64_t phaseStart = begin_network_phase();
 	if (bind(NetworkShepherd::communicatorSocket, (const sockaddr*)&sourceAddress, sizeof(sourceAddress)) == -1) {
 		int error = GET_LAST_ERROR;
 		switch (error) {
@@ -308,13 +347,16 @@ void bindCommunicatorToSource(const char* sourceAddress_string, uint16_t sourceP
 		default: REPORT_ERROR_AND_CODE_AND_EXIT("bind communicator failed, unknown reason", error, EXIT_FAILURE);
 		}
 	}
+	end_network_phase(NetworkPhase::BIND, phaseStart);
 }
 
 void NetworkShepherd::createCommunicatorAndConnect(const char* destinationAddress, uint16_t destinationPort, const char* sourceAddress, uint16_t sourcePort, IPVersionConstraint connectionIPVersionConstraint) noexcept {
 	struct sockaddr_storage connectionTargetAddress = construct_sockaddr<CSA_RESOLVE_HOSTNAMES>(destinationAddress, destinationPort, connectionIPVersionConstraint);
 	
+	uint64_t phaseStart = begin_network_phase();
 	communicatorSocket = socket(connectionTargetAddress.ss_family, SOCK_STREAM, 0);
 	if (communicatorSocket == INVALID_SOCKET) { REPORT_ERROR_AND_EXIT("failed to construct TCP connection communicator socket", EXIT_FAILURE); }
+	end_network_phase(NetworkPhase::SOCKET, phaseStart);
 
 	if (sourceAddress) {
 		if (connectionIPVersionConstraint == IPVersionConstraint::NONE) {
@@ -326,6 +368,7 @@ void NetworkShepherd::createCommunicatorAndConnect(const char* destinationAddres
 		else { bindCommunicatorToSource(sourceAddress, sourcePort, connectionIPVersionConstraint); }
 	}
 
+	phaseStart = begin_network_phase();
 	if (connect(communicatorSocket, (const sockaddr*)&connectionTargetAddress, sizeof(connectionTargetAddress)) == SOCKET_ERROR) {
 		int error = GET_LAST_ERROR;
 		switch (error) {
@@ -390,6 +433,8 @@ void NetworkShepherd::createCommunicatorAndConnect(const char* destinationAddres
 		default: REPORT_ERROR_AND_CODE_AND_EXIT("failed to connect, unknown reason", error, EXIT_FAILURE);
 		}
 	}
+	end_network_phase(NetworkPhase::CONNECT, phaseStart);
+	USDT_PROBE2(connect, communicatorSocket, destinationPort);
 }
 
 // NOTE: This functions return value will never ever ever be less than
@@ -433,12 +478,15 @@ sioret_t NetworkShepherd::read(void* buffer, iosize_t buffer_size) noexcept {
 		}
 	}
 
+	USDT_PROBE2(read, buffer_size, bytesRead);
 	return bytesRead;
 }
 
 // NOTE: It's a bit strange but this function always writes the whole buffer, it doesn't return prematurely. It's only weird because it's
 // different from the write syscall, but it works nicely for this program. There's no reason not to do it like this.
 void NetworkShepherd::write(const void* buffer, iosize_t buffer_size) noexcept {
+	USDT_PROBE1(write, buffer_size);
+
 	const char* byte_buffer = (const char*)buffer;
 
 	while (true) {
@@ -540,9 +588,120 @@ void NetworkShepherd::write(const void* buffer, iosize_t buffer_size) noexcept {
 	}
 }
 
-sioret_t NetworkShepherd::readUDP(void* buffer, iosize_t buffer_size) noexcept {
-	sioret_t bytesRead = recv(listenerSocket, (char*)buffer, buffer_size, 0);		// NOTE: We use recv instead of read because read doesn't consume zero-length UDP packets and our program would hence get stuck if we used read.
+#ifndef PLATFORM_WINDOWS
+
+// NOTE: The port the packets were sent to is the same for all of them, so it's only looked up once.
+static uint16_t UDPListenerPort;
+
+void NetworkShepherd::enableUDPPacketInfo() noexcept {
+	struct sockaddr_storage listenerAddress;
+	socklen_t listenerAddressLength = sizeof(listenerAddress);
+	if (getsockname(listenerSocket, (sockaddr*)&listenerAddress, &listenerAddressLength) == SOCKET_ERROR) {
+		REPORT_ERROR_AND_EXIT("failed to get address of UDP listener with getsockname", EXIT_FAILURE);
+	}
+
+	int enabler = true;
+	if (listenerAddress.ss_family == AF_INET) {
+		UDPListenerPort = ntohs(((const sockaddr_in*)&listenerAddress)->sin_port);
+		if (setsockopt(listenerSocket, IPPROTO_IP, IP_PKTINFO, &enabler, sizeof(enabler)) == SOCKET_ERROR) {
+			REPORT_ERROR_AND_EXIT("failed to enable IP_PKTINFO on UDP listener with setsockopt", EXIT_FAILURE);
+		}
+	} else {
+		// NOTE: This also covers IPv4 packets on a dual-stack socket, their addresses come as IPv4-mapped IPv6 addresses.
+		UDPListenerPort = ntohs(((const sockaddr_in6*)&listenerAddress)->sin6_port);
+		if (setsockopt(listenerSocket, IPPROTO_IPV6, IPV6_RECVPKTINFO, &enabler, sizeof(enabler)) == SOCKET_ERROR) {
+			REPORT_ERROR_AND_EXIT("failed to enable IPV6_RECVPKTINFO on UDP listener with setsockopt", EXIT_FAILURE);
+		}
+	}
+
+	if (setsockopt(listenerSocket, SOL_SOCKET, SO_TIMESTAMPNS, &enabler, sizeof(enabler)) == SOCKET_ERROR) {
+		REPORT_ERROR_AND_EXIT("failed to enable SO_TIMESTAMPNS on UDP listener with setsockopt", EXIT_FAILURE);
+	}
+}
+
+// NOTE: The drop count is nice to have, not something to fail over (older kernels don't have SO_RXQ_OVFL), so without it
+// UDPDroppedPacketCount just stays at 0.
+void NetworkShepherd::enableUDPDropCount() noexcept {
+	int enabler = true;
+	setsockopt(listenerSocket, SOL_SOCKET, SO_RXQ_OVFL, &enabler, sizeof(enabler));
+}
+
+#else
+
+// NOTE: "--pcap" (the only user) is rejected on Windows while parsing the args.
+void NetworkShepherd::enableUDPPacketInfo() noexcept { }
+
+void NetworkShepherd::enableUDPDropCount() noexcept { }
+
+#endif
+
+sioret_t NetworkShepherd::readUDP(void* buffer, iosize_t buffer_size, udp_packet_info_t* packetInfo) noexcept {
+	// NOTE: We use recvmsg/recv instead of read because read doesn't consume zero-length UDP packets and our program would hence get stuck if we used read.
+#ifndef PLATFORM_WINDOWS
+	struct iovec bufferVector = { buffer, buffer_size };
+	alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	struct msghdr message = { };
+	message.msg_iov = &bufferVector;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	if (packetInfo) {
+		message.msg_name = &packetInfo->source;
+		message.msg_namelen = sizeof(packetInfo->source);
+		packetInfo->destination.ss_family = AF_UNSPEC;
+		packetInfo->timestamp = 0;
+	}
+
+	sioret_t bytesRead = recvmsg(listenerSocket, &message, 0);
 	if (bytesRead == SOCKET_ERROR) { REPORT_ERROR_AND_EXIT("failed to recv from UDP listener socket, unknown reason", EXIT_FAILURE); }
+
+	if (message.msg_flags & MSG_TRUNC) { UDPTruncatedPacketCount.store(UDPTruncatedPacketCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+	for (struct cmsghdr* controlMessage = CMSG_FIRSTHDR(&message); controlMessage; controlMessage = CMSG_NXTHDR(&message, controlMessage)) {
+		if (controlMessage->cmsg_level == SOL_SOCKET && controlMessage->cmsg_type == SO_RXQ_OVFL) {
+			uint32_t droppedPacketCount;
+			std::memcpy(&droppedPacketCount, CMSG_DATA(controlMessage), sizeof(droppedPacketCount));
+			UDPDroppedPacketCount.store(droppedPacketCount, std::memory_order_relaxed);
+			continue;
+		}
+		if (!packetInfo) { continue; }
+
+		if (controlMessage->cmsg_level == SOL_SOCKET && controlMessage->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec timestamp;
+			std::memcpy(&timestamp, CMSG_DATA(controlMessage), sizeof(timestamp));
+			packetInfo->timestamp = (uint64_t)timestamp.tv_sec * 1000000000 + timestamp.tv_nsec;
+		} else if (controlMessage->cmsg_level == IPPROTO_IP && controlMessage->cmsg_type == IP_PKTINFO) {
+			struct in_pktinfo packetAddressInfo;
+			std::memcpy(&packetAddressInfo, CMSG_DATA(controlMessage), sizeof(packetAddressInfo));
+			sockaddr_in& destination = *(sockaddr_in*)&packetInfo->destination;
+			destination.sin_family = AF_INET;
+			destination.sin_port = htons(UDPListenerPort);
+			destination.sin_addr = packetAddressInfo.ipi_addr;
+		} else if (controlMessage->cmsg_level == IPPROTO_IPV6 && controlMessage->cmsg_type == IPV6_PKTINFO) {
+			struct in6_pktinfo packetAddressInfo;
+			std::memcpy(&packetAddressInfo, CMSG_DATA(controlMessage), sizeof(packetAddressInfo));
+			sockaddr_in6& destination = *(sockaddr_in6*)&packetInfo->destination;
+			destination.sin6_family = AF_INET6;
+			destination.sin6_port = htons(UDPListenerPort);
+			destination.sin6_addr = packetAddressInfo.ipi6_addr;
+		}
+	}
+
+	if (packetInfo && packetInfo->timestamp == 0) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		packetInfo->timestamp = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	}
+#else
+	sioret_t bytesRead = recv(listenerSocket, (char*)buffer, buffer_size, 0);
+	if (bytesRead == SOCKET_ERROR) {
+		// NOTE: Windows reports truncated packets as an error, but still fills the buffer with the part that fit.
+		if (GET_LAST_ERROR != WSAEMSGSIZE) { REPORT_ERROR_AND_EXIT("failed to recv from UDP listener socket, unknown reason", EXIT_FAILURE); }
+		UDPTruncatedPacketCount.store(UDPTruncatedPacketCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		bytesRead = buffer_size;
+	}
+#endif
+	USDT_PROBE2(udp_receive, buffer_size, bytesRead);
 	return bytesRead;
 }
 
@@ -550,8 +709,10 @@ void NetworkShepherd::createUDPSender(const char* destinationAddress, uint16_t d
 	struct sockaddr_storage targetAddress = construct_sockaddr<CSA_RESOLVE_HOSTNAMES>(destinationAddress, destinationPort, senderIPVersionConstraint);
 	UDPSenderAddressFamily = targetAddress.ss_family;
 
+	uint64_t phaseStart = begin_network_phase();
 	communicatorSocket = socket(UDPSenderAddressFamily, SOCK_DGRAM, 0);
 	if (communicatorSocket == INVALID_SOCKET) { REPORT_ERROR_AND_EXIT("failed to create UDP sender socket", EXIT_FAILURE); }
+	end_network_phase(NetworkPhase::SOCKET, phaseStart);
 
 	if (allowBroadcast) {
 		int enabler = true;
@@ -570,6 +731,7 @@ void NetworkShepherd::createUDPSender(const char* destinationAddress, uint16_t d
 		else { bindCommunicatorToSource(sourceAddress, sourcePort, senderIPVersionConstraint); }
 	}
 
+	phaseStart = begin_network_phase();
 	if (connect(communicatorSocket, (const sockaddr*)&targetAddress, sizeof(targetAddress)) == SOCKET_ERROR) {
 		int error = GET_LAST_ERROR;
 		switch (error) {
@@ -594,10 +756,13 @@ void NetworkShepherd::createUDPSender(const char* destinationAddress, uint16_t d
 		default: REPORT_ERROR_AND_CODE_AND_EXIT("failed to connect, unknown reason", error, EXIT_FAILURE);
 		}
 	}
+	end_network_phase(NetworkPhase::CONNECT, phaseStart);
+	USDT_PROBE2(connect, communicatorSocket, destinationPort);
 }
 
 void NetworkShepherd::writeUDP(const void* buffer, uint16_t buffer_size) noexcept {
 	while (true) {
+		USDT_PROBE1(udp_send, buffer_size);
 #ifndef PLATFORM_WINDOWS
 		sioret_t bytesSent = ::write(communicatorSocket, buffer, buffer_size);
 #else
@@ -664,6 +829,7 @@ uint16_t NetworkShepherd::writeUDPAndFindMSS(const void* buffer, uint16_t buffer
 	const char* buffer_end = *(const char**)&buffer + buffer_size;
 	uint16_t result = 0;
 	while (true) {
+		USDT_PROBE1(udp_send, buffer_chunk_size);
 #ifndef PLATFORM_WINDOWS
 		sioret_t bytesSent = ::write(communicatorSocket, buffer, buffer_chunk_size);
 #else
@@ -678,8 +844,9 @@ uint16_t NetworkShepherd::writeUDPAndFindMSS(const void* buffer, uint16_t buffer
 #else
 			case WSAEMSGSIZE:
 #endif
-				buffer_chunk_size = getMSSApproximation();
-				result = buffer_chunk_size;
+				result = getMSSApproximation();
+				USDT_PROBE2(mss_change, buffer_chunk_size, result);
+				buffer_chunk_size = result;
 				continue;
 
 			default: REPORT_ERROR_AND_CODE_AND_EXIT("failed to write to UDP sender socket", error, EXIT_FAILURE);
@@ -697,28 +864,37 @@ void NetworkShepherd::shutdownCommunicatorWrite() noexcept {
 #pragma push_macro("SHUT_WR")
 #define SHUT_WR SD_SEND
 #endif
+	uint64_t phaseStart = begin_network_phase();
 	if (shutdown(communicatorSocket, SHUT_WR) == SOCKET_ERROR) { REPORT_ERROR_AND_EXIT("failed to shutdown communicator socket write", EXIT_FAILURE); }
+	end_network_phase(NetworkPhase::SHUTDOWN, phaseStart);
+	USDT_PROBE1(shutdown, communicatorSocket);
 #ifdef PLATFORM_WINDOWS
 #pragma pop_macro("SHUT_WR")
 #endif
 }
 
 void NetworkShepherd::closeCommunicator() noexcept {
+	uint64_t phaseStart = begin_network_phase();
 #ifndef PLATFORM_WINDOWS
 	int result = close(communicatorSocket);
 #else
 	int result = closesocket(communicatorSocket);
 #endif
 	if (result == SOCKET_ERROR) { REPORT_ERROR_AND_EXIT("failed to close communicator socket", EXIT_FAILURE); }
+	end_network_phase(NetworkPhase::CLOSE, phaseStart);
+	USDT_PROBE1(close, communicatorSocket);
 }
 
 void NetworkShepherd::closeListener() noexcept {
+	uint64_t phaseStart = begin_network_phase();
 #ifndef PLATFORM_WINDOWS
 	int result = close(listenerSocket);
 #else
 	int result = closesocket(listenerSocket);
 #endif
 	if (result == SOCKET_ERROR) { REPORT_ERROR_AND_EXIT("failed to close listener socket", EXIT_FAILURE); }
+	end_network_phase(NetworkPhase::CLOSE, phaseStart);
+	USDT_PROBE1(close, listenerSocket);
 }
 
 void NetworkShepherd::release() noexcept {
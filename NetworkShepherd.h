@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>		// for fixed-width stuff
+#include <atomic>		// for the UDP drop counters, which get read from other threads
 
 #include "crossplatform_io.h"
 
@@ -32,6 +33,31 @@ enum class IPVersionConstraint : uint8_t {
 	SIX
 };
 
+// NOTE: The steps of setting up and tearing down connections, for whoever wants to watch them (see phaseObserver).
+enum class NetworkPhase : uint8_t {
+	INTERFACE_LOOKUP,
+	RESOLVE,
+	SOCKET,
+	BIND,
+	LISTEN,
+	CONNECT,
+	ACCEPT,
+	SHUTDOWN,
+	CLOSE
+};
+
+constexpr const char* network_phase_names[] = { "interface lookup", "resolve", "socket", "bind", "listen", "connect", "accept", "shutdown", "close" };
+
+// NOTE: What readUDP can tell about a packet besides its contents, for whoever wants to reconstruct it (see "--pcap").
+struct udp_packet_info_t {
+	sockaddr_storage source;
+	sockaddr_storage destination;		// NOTE: ss_family is AF_UNSPEC if the kernel didn't say which address the packet was sent to.
+	uint64_t timestamp;			// NOTE: Nanoseconds since the Unix epoch, from the kernel when it provides one.
+};
+
+// NOTE: start and end are steady_clock nanoseconds, the same clock the rest of the program uses for timing.
+using network_phase_observer_t = void (*)(NetworkPhase phase, uint64_t start, uint64_t end) noexcept;
+
 class NetworkShepherd {
 #ifdef PLATFORM_WINDOWS
 	static WSADATA WSAData;
@@ -43,6 +69,14 @@ public:
 
 	static sockaddr_storage_family_t UDPSenderAddressFamily;
 
+	// NOTE: Only written by readUDP, but other threads (metrics) may read them at any time.
+	static std::atomic<uint64_t> UDPTruncatedPacketCount;
+	static std::atomic<uint64_t> UDPDroppedPacketCount;	// NOTE: Packets the kernel dropped because the receive queue was full (Linux only).
+
+	// NOTE: Gets told about every phase that completes successfully. nullptr (the default) means nobody is watching,
+	// in which case not even the clock is read.
+	static network_phase_observer_t phaseObserver;
+
 	static void init() noexcept;
 
 	static void createListener(const char* address, uint16_t port, int socketType, IPVersionConstraint listenerIPVersionConstraint) noexcept;
@@ -55,7 +89,15 @@ public:
 	static sioret_t read(void* buffer, iosize_t buffer_size) noexcept;
 	static void write(const void* buffer, iosize_t buffer_size) noexcept;
 
-	static sioret_t readUDP(void* buffer, iosize_t buffer_size) noexcept;
+	// NOTE: Makes the kernel report source, destination and receive time of every packet, so that readUDP can fill in
+	// packetInfo. Has to be called after createListener (Linux only).
+	static void enableUDPPacketInfo() noexcept;
+
+	// NOTE: Makes the kernel attach its running count of dropped packets to every packet, so that readUDP can keep
+	// UDPDroppedPacketCount up to date. Has to be called after createListener (Linux only).
+	static void enableUDPDropCount() noexcept;
+
+	static sioret_t readUDP(void* buffer, iosize_t buffer_size, udp_packet_info_t* packetInfo = nullptr) noexcept;
 
 	static void createUDPSender(const char* destinationAddress, uint16_t destinationPort, bool allowBroadcast, const char* sourceAddress, uint16_t sourcePort, IPVersionConstraint senderIPVersionConstraint) noexcept;
 
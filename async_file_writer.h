@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::memcpy
+#include <cstdlib>		// for std::malloc
+#include <chrono>		// for std::chrono::nanoseconds
+#include <thread>		// for std::thread
+#include <mutex>		// for std::mutex
+#include <condition_variable>	// for std::condition_variable
+#include <utility>		// for std::swap
+
+/*
+NOTE: The file writer behind "--record" and "--output":
+	- the transfer threads only copy their data into a buffer, a separate writer thread swaps that for a second buffer
+		and hands the full one to the feature's write function, so the transfer threads never wait for the disk unless it
+		falls a whole buffer behind.
+	- the write function runs on the writer thread, without the lock, so it can take as long as it likes (fsync,
+		rename, ...).
+	- a failed write stops the writer thread, and the next append returns false, so that the feature can report it.
+		Exiting from the writer thread itself would leave the at-exit cleanup waiting for that very thread.
+	- stopping writes out whatever is still buffered, appends that come in after that are dropped.
+*/
+
+constexpr size_t async_file_writer_buffer_size = 1024 * 1024;
+
+struct async_file_writer_t {
+	// NOTE: size is 0 when the writer thread was only woken up by the timeout.
+	bool (*write)(const unsigned char* data, size_t size) noexcept;
+	// NOTE: How long the writer thread waits for data before it calls write anyway, in nanoseconds. nullptr means it
+	// waits for as long as it takes.
+	uint64_t (*timeout)() noexcept;
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable dataCondition;
+	std::condition_variable spaceCondition;
+	bool shouldStop = false;
+	bool writeFailed = false;
+
+	// NOTE: The transfer threads fill buffers[0], the writer thread writes out buffers[1].
+	unsigned char* buffers[2];
+	size_t filledSize = 0;
+};
+
+inline void async_file_writer_thread(async_file_writer_t* writer) noexcept {
+	std::unique_lock<std::mutex> lock(writer->mutex);
+	while (true) {
+		auto has_work = [writer]() noexcept { return writer->filledSize != 0 || writer->shouldStop; };
+		if (!writer->timeout) {
+			writer->dataCondition.wait(lock, has_work);
+		} else {
+			writer->dataCondition.wait_for(lock, std::chrono::nanoseconds(writer->timeout()), has_work);
+		}
+
+		size_t size = writer->filledSize;
+		if (size == 0 && writer->shouldStop) { return; }
+
+		std::swap(writer->buffers[0], writer->buffers[1]);
+		writer->filledSize = 0;
+		writer->spaceCondition.notify_all();
+
+		lock.unlock();
+		bool success = writer->write(writer->buffers[1], size);
+		lock.lock();
+
+		if (!success) {
+			writer->writeFailed = true;
+			writer->spaceCondition.notify_all();
+			return;
+		}
+	}
+}
+
+// NOTE: Returns false if the buffers couldn't be allocated.
+inline bool async_file_writer_start(async_file_writer_t& writer, bool (*write)(const unsigned char* data, size_t size) noexcept, uint64_t (*timeout)() noexcept) noexcept {
+	writer.write = write;
+	writer.timeout = timeout;
+	writer.buffers[0] = (unsigned char*)std::malloc(async_file_writer_buffer_size);
+	writer.buffers[1] = (unsigned char*)std::malloc(async_file_writer_buffer_size);
+	if (!writer.buffers[0] || !writer.buffers[1]) { return false; }
+
+	// NOTE: Cast is necessary because (for whatever reason) thread only accepts non-noexcept function ptr types.
+	writer.thread = std::thread((void (*)(async_file_writer_t*))async_file_writer_thread, &writer);
+	return true;
+}
+
+// NOTE: Filters can emit chunks of any size, so a chunk is split into whatever fits into the buffer. Returns false if a
+// write failed.
+inline bool async_file_writer_append(async_file_writer_t& writer, const void* data, size_t size) noexcept {
+	const unsigned char* input = (const unsigned char*)data;
+	std::unique_lock<std::mutex> lock(writer.mutex);
+	while (size != 0) {
+		writer.spaceCondition.wait(lock, [&writer]() noexcept {
+			return writer.filledSize != async_file_writer_buffer_size || writer.shouldStop || writer.writeFailed;
+		});
+		if (writer.writeFailed) { return false; }
+		if (writer.shouldStop) { return true; }
+
+		size_t chunk_size = async_file_writer_buffer_size - writer.filledSize;
+		if (chunk_size > size) { chunk_size = size; }
+		std::memcpy(writer.buffers[0] + writer.filledSize, input, chunk_size);
+		bool was_empty = writer.filledSize == 0;
+		writer.filledSize += chunk_size;
+		if (was_empty) { writer.dataCondition.notify_one(); }
+		input += chunk_size;
+		size -= chunk_size;
+	}
+	return true;
+}
+
+inline void async_file_writer_stop(async_file_writer_t& writer) noexcept {
+	if (!writer.thread.joinable()) { return; }
+
+	{
+		std::lock_guard<std::mutex> lock(writer.mutex);
+		writer.shouldStop = true;
+	}
+	writer.dataCondition.notify_one();
+	writer.spaceCondition.notify_all();
+	writer.thread.join();
+}
@@ -0,0 +1,153 @@
+#!/usr/bin/env bash
+
+# Compares two commits in the benchmark history that bench/run.sh keeps. Run it through "make bench_compare", or directly:
+#
+#	bench/compare.sh <baseline-commit> [<candidate-commit>]
+#
+# The candidate defaults to the commit of the newest result. Commits are the short hashes as they appear in the results
+# (a build with uncommitted changes shows up as "<hash>-dirty").
+#
+# Only results measured with the same compiler and on the same CPU as the newest result of the candidate are compared,
+# numbers from different machines don't say anything about the change. Every recorded run of a case counts, so running
+# the suite more than once on a commit tightens the confidence intervals.
+#
+# For every case, the output has both means, the difference in percent and its 95% confidence interval (Welch's t-test,
+# which doesn't assume both sides are equally noisy). A case is flagged as a regression if it got worse by more than
+# BENCH_THRESHOLD percent and the confidence interval doesn't include 0, i.e. it's both big and not just noise.
+# The exit code is 1 if anything regressed, so this can gate CI.
+#
+# Knobs (environment variables):
+#	BENCH_OUTPUT		the results file (default: bin/bench_results.jsonl)
+#	BENCH_THRESHOLD		regression threshold in percent (default: 5)
+
+set -u
+
+if [ $# -lt 1 ] || [ $# -gt 2 ]; then echo "usage: bench/compare.sh <baseline-commit> [<candidate-commit>]" >&2; exit 2; fi
+
+BENCH_OUTPUT=${BENCH_OUTPUT:-bin/bench_results.jsonl}
+BENCH_THRESHOLD=${BENCH_THRESHOLD:-5}
+
+if [ ! -s "$BENCH_OUTPUT" ]; then echo "bench: no results in \"$BENCH_OUTPUT\", run \"make bench\" first" >&2; exit 2; fi
+
+# NOTE: The file is read twice, the first pass only figures out which candidate and which compiler/CPU to compare.
+awk -v baseline="$1" -v candidate="${2:-}" -v threshold="$BENCH_THRESHOLD" '
+function string_field(name,   value) {
+	if (!match($0, "\"" name "\":\"[^\"]*\"")) { return "" }
+	value = substr($0, RSTART + length(name) + 4, RLENGTH - length(name) - 5)
+	return value
+}
+
+function runs_field(   value) {
+	if (!match($0, /"runs":\[[^\]]*\]/)) { return "" }
+	return substr($0, RSTART + 8, RLENGTH - 9)
+}
+
+# NOTE: Two-sided 95% critical values of the t distribution. Degrees of freedom in between round down, which makes the
+# interval a bit wider than it has to be, never narrower.
+function t_critical(degrees_of_freedom,   i) {
+	split("1 2 3 4 5 6 7 8 9 10 12 15 20 30 60", table_df, " ")
+	split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 2.179 2.131 2.086 2.042 2.000", table_t, " ")
+	if (degrees_of_freedom < 1) { return table_t[1] }
+	for (i = 15; i >= 1; i--) { if (degrees_of_freedom >= table_df[i]) { return degrees_of_freedom >= 120 ? 1.960 : table_t[i] } }
+	return table_t[1]
+}
+
+function human(value,   suffix) {
+	suffix = ""
+	if (value >= 1e9) { value /= 1e9; suffix = "G" } else if (value >= 1e6) { value /= 1e6; suffix = "M" } else if (value >= 1e3) { value /= 1e3; suffix = "K" }
+	return sprintf("%.2f%s", value, suffix)
+}
+
+FNR == NR {
+	last_commit = string_field("commit")
+	if (candidate == "" || last_commit == candidate) {
+		environment_compiler[last_commit] = string_field("compiler")
+		environment_cpu[last_commit] = string_field("cpu")
+	}
+	next
+}
+
+FNR == 1 {
+	if (candidate == "") { candidate = last_commit }
+	if (!(candidate in environment_cpu)) { print "bench: no results for candidate \"" candidate "\"" > "/dev/stderr"; exit_code_set = 1; exit 2 }
+	if (candidate == baseline) { print "bench: baseline and candidate are the same commit (\"" candidate "\")" > "/dev/stderr"; exit_code_set = 1; exit 2 }
+	compiler = environment_compiler[candidate]
+	cpu = environment_cpu[candidate]
+	printf "baseline %s vs candidate %s\ncompiler: %s\ncpu: %s\nthreshold: %s%%\n\n", baseline, candidate, compiler, cpu, threshold
+}
+
+{
+	if (string_field("compiler") != compiler || string_field("cpu") != cpu) { next }
+	commit = string_field("commit")
+	if (commit != baseline && commit != candidate) { next }
+
+	key = string_field("suite") " " string_field("case")
+	if (!(key in better)) {
+		keys[++key_count] = key
+		better[key] = string_field("better")
+	}
+	side = commit == baseline ? "b" : "c"
+	run_count = split(runs_field(), values, ",")
+	for (i = 1; i <= run_count; i++) {
+		n[side, key]++
+		sum[side, key] += values[i]
+		sum_of_squares[side, key] += values[i] * values[i]
+	}
+}
+
+END {
+	if (exit_code_set) { exit 2 }
+	printf "%-34s %12s %12s %9s %21s  %s\n", "case", "baseline", "candidate", "delta", "95% confidence", "verdict"
+	compared = 0
+	regressions = 0
+	for (k = 1; k <= key_count; k++) {
+		key = keys[k]
+		if (n["b", key] == 0 || n["c", key] == 0) { continue }
+		compared++
+
+		for (s = 1; s <= 2; s++) {
+			side = s == 1 ? "b" : "c"
+			mean[side] = sum[side, key] / n[side, key]
+			variance[side] = n[side, key] > 1 ? (sum_of_squares[side, key] - n[side, key] * mean[side] * mean[side]) / (n[side, key] - 1) : 0
+			if (variance[side] < 0) { variance[side] = 0 }
+		}
+
+		delta = (mean["c"] - mean["b"]) / mean["b"] * 100
+		# NOTE: "worse" is positive when the candidate is worse, whichever way is better for the metric.
+		worse = better[key] == "lower" ? delta : -delta
+
+		if (n["b", key] < 2 || n["c", key] < 2) {
+			printf "%-34s %12s %12s %+8.1f%% %21s  %s\n", key, human(mean["b"]), human(mean["c"]), delta, "n/a", "need 2+ runs per side"
+			continue
+		}
+
+		standard_error_b = variance["b"] / n["b", key]
+		standard_error_c = variance["c"] / n["c", key]
+		standard_error = sqrt(standard_error_b + standard_error_c)
+		if (standard_error == 0) {
+			degrees_of_freedom = n["b", key] + n["c", key] - 2
+		} else {
+			degrees_of_freedom = (standard_error_b + standard_error_c) ^ 2 / (standard_error_b ^ 2 / (n["b", key] - 1) + standard_error_c ^ 2 / (n["c", key] - 1))
+		}
+		margin = t_critical(degrees_of_freedom) * standard_error / mean["b"] * 100
+		low = delta - margin
+		high = delta + margin
+		significant = low > 0 || high < 0
+
+		verdict = "no significant change"
+		if (significant && worse > threshold) {
+			verdict = "REGRESSION"
+			regressions++
+		} else if (significant && -worse > threshold) {
+			verdict = "improved"
+		} else if (significant) {
+			verdict = "changed (within threshold)"
+		}
+		printf "%-34s %12s %12s %+8.1f%% [%+7.1f%%, %+7.1f%%]  %s\n", key, human(mean["b"]), human(mean["c"]), delta, low, high, verdict
+	}
+
+	if (compared == 0) { print "bench: nothing to compare, no case has results for both commits with this compiler and CPU" > "/dev/stderr"; exit 2 }
+	printf "\n%d regression(s) in %d case(s)\n", regressions, compared
+	exit regressions > 0 ? 1 : 0
+}
+' "$BENCH_OUTPUT" "$BENCH_OUTPUT"
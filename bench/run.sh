@@ -0,0 +1,239 @@
+#!/usr/bin/env bash
+
+# Loopback benchmark suite for nc. Run it through "make bench", or directly with the binary to benchmark as the first arg.
+#
+# Every case does BENCH_WARMUP unrecorded runs and then BENCH_RUNS recorded ones, and prints one JSON object per line
+# (on stdout and appended to BENCH_OUTPUT) with every run, the median, the minimum and the maximum. The file is only ever
+# appended to, every line carries the commit, compiler and CPU it was measured with, so it doubles as the history that
+# bench/compare.sh compares against.
+#
+# NOTE: The listening side and the connecting side are pinned to fixed CPUs (BENCH_SERVER_CPU and BENCH_CLIENT_CPU) so that
+# results don't depend on where the scheduler happens to put them. On a single-CPU machine both end up on CPU 0.
+#
+# Knobs (environment variables):
+#	BENCH_RUNS		recorded runs per case (default: 5)
+#	BENCH_WARMUP		unrecorded runs per case before that (default: 1)
+#	BENCH_BYTES		bytes per bulk transfer (default: 268435456)
+#	BENCH_ROUND_TRIPS	round trips per ping-pong run (default: 2000)
+#	BENCH_DATAGRAMS		datagrams per UDP run (default: 20000)
+#	BENCH_CONNECTIONS	connections per connection rate run (default: 200)
+#	BENCH_CLIENTS		concurrent clients in the fan-in case (default: 16)
+#	BENCH_PORT		first port to use, every run gets its own port after that (default: random, between 20000 and 28999)
+#	BENCH_SERVER_CPU	CPU for the listening side (default: 0)
+#	BENCH_CLIENT_CPU	CPU for the connecting side (default: 1, or 0 if there's only one)
+#	BENCH_OUTPUT		file the results get appended to (default: bin/bench_results.jsonl)
+#	BENCH_FILTER		only run cases whose suite name matches this regex (default: everything)
+#	BENCH_COMPILER		compiler nc was built with, for the record (default: c++, "make bench" passes the real one)
+
+set -u
+
+NC=$(realpath "${1:-bin/nc}")
+if [ ! -x "$NC" ]; then echo "bench: \"$NC\" isn't an executable, build nc first" >&2; exit 1; fi
+
+BENCH_RUNS=${BENCH_RUNS:-5}
+BENCH_WARMUP=${BENCH_WARMUP:-1}
+BENCH_BYTES=${BENCH_BYTES:-268435456}
+BENCH_ROUND_TRIPS=${BENCH_ROUND_TRIPS:-2000}
+BENCH_DATAGRAMS=${BENCH_DATAGRAMS:-20000}
+BENCH_CONNECTIONS=${BENCH_CONNECTIONS:-200}
+BENCH_CLIENTS=${BENCH_CLIENTS:-16}
+# NOTE: Random by default so that back-to-back invocations don't land on ports that still have connections in TIME_WAIT.
+# It's below the usual ephemeral port range (32768 and up), so it can't collide with the clients either.
+BENCH_PORT=${BENCH_PORT:-$((20000 + RANDOM % 9000))}
+BENCH_SERVER_CPU=${BENCH_SERVER_CPU:-0}
+if [ "$(nproc)" -gt 1 ]; then BENCH_CLIENT_CPU=${BENCH_CLIENT_CPU:-1}; else BENCH_CLIENT_CPU=${BENCH_CLIENT_CPU:-0}; fi
+BENCH_OUTPUT=${BENCH_OUTPUT:-bin/bench_results.jsonl}
+BENCH_FILTER=${BENCH_FILTER:-.}
+
+# NOTE: How long to give a listener to get to accept/recv before the other side starts. Everything runs on loopback,
+# so this is plenty.
+LISTENER_STARTUP_SECONDS=0.2
+
+SCRATCH=$(mktemp -d)
+trap 'kill $(jobs -p) 2> /dev/null; rm -rf "$SCRATCH"' EXIT
+
+COMMIT=$(git rev-parse --short HEAD 2> /dev/null || echo unknown)
+if [ -n "$(git status --porcelain --untracked-files=no 2> /dev/null)" ]; then COMMIT="$COMMIT-dirty"; fi
+TIMESTAMP=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+HOST=$(uname -n)
+KERNEL=$(uname -r)
+COMPILER=$("${BENCH_COMPILER:-c++}" --version 2> /dev/null | head -n 1 | tr -d '"\\')
+if [ -z "$COMPILER" ]; then COMPILER=${BENCH_COMPILER:-unknown}; fi
+CPU=$(sed -n 's/^model name[[:space:]]*: //p' /proc/cpuinfo 2> /dev/null | head -n 1 | tr -d '"\\')
+if [ -z "$CPU" ]; then CPU=$(uname -m); fi
+
+mkdir -p "$(dirname "$BENCH_OUTPUT")"
+
+# NOTE: These are prefixes instead of functions, so that "$!" is the pid of nc itself (taskset execs it) and not of a subshell.
+if command -v taskset > /dev/null; then
+	SERVER_CPU=(taskset -c "$BENCH_SERVER_CPU")
+	CLIENT_CPU=(taskset -c "$BENCH_CLIENT_CPU")
+else
+	echo "bench: taskset not found, running without CPU pinning" >&2
+	SERVER_CPU=()
+	CLIENT_CPU=()
+fi
+
+# NOTE: Binaries from before "--datagram-size" existed are still benchmarked, with the producer they used to get (see
+# udp_packets_per_second).
+if "$NC" --help 2>&1 | grep -q -- "--datagram-size"; then HAS_DATAGRAM_SIZE=1; else HAS_DATAGRAM_SIZE=0; fi
+
+now_ns() { date +%s%N; }
+
+# NOTE: Pulls a number out of nc's "--stats-json" output, e.g. json_field received network_calls.
+json_field() { sed -n "s/.*\"$1\":{[^}]*\"$2\":\([0-9.]*\).*/\1/p" "$3"; }
+
+# NOTE: Runs one case: "run_case <suite> <case> <metric> <unit> <higher|lower> <function> [args...]". The function prints
+# the value of one run on stdout (or nothing if the run failed, which is reported and left out). higher or lower says which
+# way is better, for the comparisons.
+run_case() {
+	local suite=$1 case_name=$2 metric=$3 unit=$4 better=$5
+	shift 5
+	if ! [[ $suite =~ $BENCH_FILTER ]]; then return; fi
+
+	# NOTE: Every run gets a fresh port, so it can't trip over connections of the last one that are still in TIME_WAIT.
+	# The port has to be picked out here, the runs themselves happen in subshells.
+	local i value values=()
+	for ((i = 0; i < BENCH_WARMUP; i++)); do
+		PORT=$((BENCH_PORT++))
+		"$@" > /dev/null
+	done
+	for ((i = 0; i < BENCH_RUNS; i++)); do
+		PORT=$((BENCH_PORT++))
+		value=$("$@")
+		if [ -z "$value" ]; then echo "bench: $suite $case_name run $i failed" >&2; continue; fi
+		values+=("$value")
+	done
+	if [ ${#values[@]} -eq 0 ]; then return; fi
+
+	local sorted
+	sorted=($(printf '%s\n' "${values[@]}" | sort -n))
+	local count=${#sorted[@]}
+	local median=${sorted[$((count / 2))]}
+	if [ $((count % 2)) -eq 0 ]; then median=$(( (sorted[count / 2 - 1] + sorted[count / 2]) / 2 )); fi
+
+	local runs
+	runs=$(IFS=,; echo "${values[*]}")
+	local line="{\"suite\":\"$suite\",\"case\":\"$case_name\",\"metric\":\"$metric\",\"unit\":\"$unit\",\"better\":\"$better\",\"median\":$median,\"min\":${sorted[0]},\"max\":${sorted[$((count - 1))]},\"runs\":[$runs],\"warmup_runs\":$BENCH_WARMUP,\"commit\":\"$COMMIT\",\"compiler\":\"$COMPILER\",\"cpu\":\"$CPU\",\"timestamp\":\"$TIMESTAMP\",\"host\":\"$HOST\",\"kernel\":\"$KERNEL\",\"server_cpu\":$BENCH_SERVER_CPU,\"client_cpu\":$BENCH_CLIENT_CPU}"
+	echo "$line"
+	echo "$line" >> "$BENCH_OUTPUT"
+}
+
+# NOTE: Bytes per second of one bulk transfer, with the producer writing <write-size> byte chunks.
+tcp_bulk() {
+	local write_size=$1
+	"${SERVER_CPU[@]}" "$NC" -l 127.0.0.1 "$PORT" > /dev/null &
+	local server=$!
+	sleep $LISTENER_STARTUP_SECONDS
+	local start end
+	start=$(now_ns)
+	head -c "$BENCH_BYTES" /dev/zero | dd bs="$write_size" iflag=fullblock status=none | "${CLIENT_CPU[@]}" "$NC" 127.0.0.1 "$PORT" || return
+	wait $server || return
+	end=$(now_ns)
+	echo $((BENCH_BYTES * 1000000000 / (end - start)))
+}
+
+# NOTE: Nanoseconds per 1 byte round trip through an echo server (an nc listener with its stdout fed back into its stdin).
+# This includes the bash loop on the client side, which is the same for every build, so it's fine for comparisons.
+tcp_ping_pong() {
+	local fifo=$SCRATCH/echo_$PORT
+	mkfifo "$fifo"
+	# NOTE: Opening the FIFO read-write for stdin doesn't block waiting for a writer, so stdout can be opened after it.
+	"${SERVER_CPU[@]}" "$NC" -l 127.0.0.1 "$PORT" 0<> "$fifo" 1> "$fifo" &
+	local server=$!
+	sleep $LISTENER_STARTUP_SECONDS
+
+	coproc PING { exec "${CLIENT_CPU[@]}" "$NC" 127.0.0.1 "$PORT"; }
+	local client=$PING_PID reply i start end
+	printf x >&"${PING[1]}"
+	read -r -N 1 -t 5 -u "${PING[0]}" reply || { kill $client $server 2> /dev/null; return; }
+	start=$(now_ns)
+	for ((i = 0; i < BENCH_ROUND_TRIPS; i++)); do
+		printf x >&"${PING[1]}"
+		read -r -N 1 -t 5 -u "${PING[0]}" reply || { kill $client $server 2> /dev/null; return; }
+	done
+	end=$(now_ns)
+
+	# NOTE: The echo server never sees EOF on its own stdin (it's holding the FIFO open itself), so neither side ends by itself.
+	kill $client $server 2> /dev/null
+	wait $client $server 2> /dev/null
+	rm -f "$fifo"
+	echo $(((end - start) / BENCH_ROUND_TRIPS))
+}
+
+# NOTE: Datagrams per second that made it to the receiver. A single stdin read picks up however many of the producer's
+# writes are queued in the pipe, so the datagram size is set with "--datagram-size". Older binaries fall back to dd's
+# write size, which only gives that size when nc keeps up with dd, so compare their results with care.
+udp_packets_per_second() {
+	local datagram_size=$1
+	local receiver_stats=$SCRATCH/udp_receiver_$PORT
+	"${SERVER_CPU[@]}" "$NC" -lu 127.0.0.1 "$PORT" -v --stats-json > /dev/null 2> "$receiver_stats" &
+	local server=$!
+	sleep $LISTENER_STARTUP_SECONDS
+	local start end
+	start=$(now_ns)
+	if [ "$HAS_DATAGRAM_SIZE" = 1 ]; then
+		head -c $((BENCH_DATAGRAMS * datagram_size)) /dev/zero | "${CLIENT_CPU[@]}" "$NC" -u 127.0.0.1 "$PORT" --datagram-size "$datagram_size" || return
+	else
+		head -c $((BENCH_DATAGRAMS * datagram_size)) /dev/zero | dd bs="$datagram_size" iflag=fullblock status=none | "${CLIENT_CPU[@]}" "$NC" -u 127.0.0.1 "$PORT" || return
+	fi
+	end=$(now_ns)
+	sleep 0.1
+	# NOTE: "-lu" only ever ends through a signal, it prints its statistics on the way out. Not SIGINT, background jobs
+	# of a script start out ignoring that one, and nc leaves ignored signals alone.
+	kill -TERM $server
+	wait $server 2> /dev/null
+	local received
+	received=$(json_field received network_calls "$receiver_stats")
+	if [ -z "$received" ]; then return; fi
+	echo $((received * 1000000000 / (end - start)))
+}
+
+# NOTE: Complete connections (connect, send nothing, shut down, close) per second, including starting the nc process,
+# since that's what a connection costs someone who uses nc from a script.
+tcp_connection_rate() {
+	"${SERVER_CPU[@]}" "$NC" -lk 127.0.0.1 "$PORT" > /dev/null < /dev/null &
+	local server=$!
+	sleep $LISTENER_STARTUP_SECONDS
+	local start end i
+	start=$(now_ns)
+	for ((i = 0; i < BENCH_CONNECTIONS; i++)); do
+		"${CLIENT_CPU[@]}" "$NC" 127.0.0.1 "$PORT" < /dev/null > /dev/null || { kill $server; return; }
+	done
+	end=$(now_ns)
+	kill $server
+	wait $server 2> /dev/null
+	echo $((BENCH_CONNECTIONS * 1000000000 / (end - start)))
+}
+
+# NOTE: Bytes per second into one "-lk" listener from many clients at once. "-k" serves connections one after the other,
+# so the rest wait in the backlog (which is made big enough for all of them, the default is tiny), which is exactly the
+# behaviour this is supposed to keep an eye on.
+tcp_fan_in() {
+	"${SERVER_CPU[@]}" "$NC" -lk 127.0.0.1 "$PORT" --backlog "$BENCH_CLIENTS" > /dev/null < /dev/null &
+	local server=$!
+	sleep $LISTENER_STARTUP_SECONDS
+	local bytes_per_client=$((BENCH_BYTES / BENCH_CLIENTS))
+	local start end i clients=() failed=0
+	start=$(now_ns)
+	for ((i = 0; i < BENCH_CLIENTS; i++)); do
+		head -c $bytes_per_client /dev/zero | "${CLIENT_CPU[@]}" "$NC" 127.0.0.1 "$PORT" &
+		clients+=($!)
+	done
+	for i in "${clients[@]}"; do wait "$i" || failed=1; done
+	end=$(now_ns)
+	kill $server
+	wait $server 2> /dev/null
+	if [ $failed -ne 0 ]; then return; fi
+	echo $((bytes_per_client * BENCH_CLIENTS * 1000000000 / (end - start)))
+}
+
+for write_size in 512 4096 65536 1048576; do
+	run_case tcp_bulk "write_size=$write_size" throughput bytes_per_second higher tcp_bulk $write_size
+done
+run_case tcp_ping_pong "message_size=1" round_trip_time nanoseconds lower tcp_ping_pong
+for datagram_size in 64 512 1400 8192; do
+	run_case udp_pps "datagram_size=$datagram_size" received_datagrams_per_second datagrams_per_second higher udp_packets_per_second $datagram_size
+done
+run_case tcp_connection_rate "connections=$BENCH_CONNECTIONS" connection_rate connections_per_second higher tcp_connection_rate
+run_case tcp_fan_in "clients=$BENCH_CLIENTS" throughput bytes_per_second higher tcp_fan_in
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+
+#include "crossplatform_io.h"
+
+#include "transfer_stats.h"	// NOTE: The analysis works entirely off of the transfer statistics timings.
+
+#include "progress_report.h"	// for progress_report_append_size
+
+/*
+NOTE: How "--why-slow" attributes the time:
+	- every blocking call in the transfer loops is already timed for the transfer statistics (steady_clock, which is a vDSO
+		clock_gettime(CLOCK_MONOTONIC) on Linux, so no syscalls).
+	- each direction has three places its time can go while it's active (from the start of its first call to the end of its
+		last one):
+		sending:   blocked reading stdin (producer), blocked sending (network), or neither (nc itself)
+		receiving: blocked receiving (network), blocked writing stdout (consumer), or neither (nc itself)
+	- "nc itself" is everything between the calls: rate limiting, encryption, line ending translation, hex dumping, checksums.
+	- whichever of the three got the biggest share is what limited the throughput of that direction.
+	- blocking on the socket doesn't say whether it's the network itself or the program on the other end, the remote side
+		can only be told apart by running "--why-slow" over there too.
+*/
+
+// NOTE: Percentages with one decimal place, from a per-mille value.
+inline void bottleneck_report_append_percentage(signal_safe_text_t& text, uint64_t part, uint64_t whole) noexcept {
+	uint64_t per_mille = whole == 0 ? 0 : part * 1000 / whole;
+	text.append_unsigned(per_mille / 10);
+	text.append(".");
+	text.append_unsigned(per_mille % 10);
+	text.append("%");
+}
+
+template <size_t direction_name_length, size_t local_name_length, size_t local_verdict_length, size_t network_verdict_length>
+inline void bottleneck_report_print_direction(const transfer_direction_stats_t& stats, const char (&direction_name)[direction_name_length],
+					      const char (&local_name)[local_name_length], const char (&local_verdict)[local_verdict_length],
+					      const char (&network_verdict)[network_verdict_length]) noexcept {
+	// NOTE: A direction that never carried anything (only the EOF read, for example) has nothing to explain.
+	uint64_t bytes = stats.bytes.load(std::memory_order_relaxed);
+	if (bytes == 0) { return; }
+
+	uint64_t first_call_start = stats.firstCallStart.load(std::memory_order_relaxed);
+
+	uint64_t active_time = stats.lastCallEnd.load(std::memory_order_relaxed) - first_call_start;
+	uint64_t local_time = stats.localNanoseconds.load(std::memory_order_relaxed);
+	uint64_t network_time = stats.networkNanoseconds.load(std::memory_order_relaxed);
+	uint64_t blocked_time = local_time + network_time;
+	uint64_t own_time = active_time > blocked_time ? active_time - blocked_time : 0;
+
+	signal_safe_text_t text;
+	text.append("why-slow: ");
+	text.append(direction_name);
+	text.append(" ");
+	progress_report_append_size(text, bytes);
+	text.append(" in ");
+	text.append_seconds(active_time);
+	text.append(" s (");
+	progress_report_append_size(text, transfer_stats_per_second(bytes, active_time));
+	text.append("/s): ");
+	text.append(local_name);
+	text.append(" ");
+	bottleneck_report_append_percentage(text, local_time, active_time);
+	text.append(", network ");
+	bottleneck_report_append_percentage(text, network_time, active_time);
+	text.append(", nc itself ");
+	bottleneck_report_append_percentage(text, own_time, active_time);
+	text.append("\nwhy-slow:   --> ");
+	if (local_time >= network_time && local_time >= own_time) {
+		text.append(local_verdict);
+	} else if (network_time >= own_time) {
+		text.append(network_verdict);
+	} else {
+		text.append("limited by nc itself (rate limits, encryption, translation, hex dump or checksum)");
+	}
+	text.append("\n");
+
+	crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+}
+
+inline void bottleneck_report_print() noexcept {
+	bottleneck_report_print_direction(transfer_stats::sent, "sent    ", "stdin (producer)",
+					  "limited by the producer (whatever feeds stdin)",
+					  "limited by the network (or the remote side not reading fast enough)");
+	bottleneck_report_print_direction(transfer_stats::received, "received", "stdout (consumer)",
+					  "limited by the consumer (whatever reads stdout)",
+					  "limited by the network (or the remote side not sending fast enough)");
+}
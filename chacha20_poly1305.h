@@ -0,0 +1,313 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::memcpy and std::memset
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define CHACHA20_SSE2
+#include <emmintrin.h>		// for SSE2 intrinsics
+#endif
+
+// NOTE: This is ChaCha20-Poly1305 as described in RFC 8439, plus HChaCha20 (from the XChaCha20 draft) for key derivation.
+// NOTE: Everything here assumes a little-endian machine, but only where it's marked. The byte-wise loads and stores
+// are endian-independent.
+
+constexpr size_t chacha20_key_size = 32;
+constexpr size_t chacha20_nonce_size = 12;
+constexpr size_t chacha20_block_size = 64;
+constexpr size_t hchacha20_input_size = 16;
+constexpr size_t poly1305_tag_size = 16;
+
+inline uint32_t chacha20_load32(const unsigned char* bytes) noexcept {
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+inline void chacha20_store32(unsigned char* bytes, uint32_t value) noexcept {
+	bytes[0] = (unsigned char)value;
+	bytes[1] = (unsigned char)(value >> 8);
+	bytes[2] = (unsigned char)(value >> 16);
+	bytes[3] = (unsigned char)(value >> 24);
+}
+
+inline uint32_t chacha20_rotate_left(uint32_t value, int amount) noexcept { return (value << amount) | (value >> (32 - amount)); }
+
+inline void chacha20_quarter_round(uint32_t (&x)[16], int a, int b, int c, int d) noexcept {
+	x[a] += x[b]; x[d] = chacha20_rotate_left(x[d] ^ x[a], 16);
+	x[c] += x[d]; x[b] = chacha20_rotate_left(x[b] ^ x[c], 12);
+	x[a] += x[b]; x[d] = chacha20_rotate_left(x[d] ^ x[a], 8);
+	x[c] += x[d]; x[b] = chacha20_rotate_left(x[b] ^ x[c], 7);
+}
+
+inline void chacha20_rounds(uint32_t (&x)[16]) noexcept {
+	for (int i = 0; i < 10; i++) {
+		chacha20_quarter_round(x, 0, 4, 8, 12);
+		chacha20_quarter_round(x, 1, 5, 9, 13);
+		chacha20_quarter_round(x, 2, 6, 10, 14);
+		chacha20_quarter_round(x, 3, 7, 11, 15);
+		chacha20_quarter_round(x, 0, 5, 10, 15);
+		chacha20_quarter_round(x, 1, 6, 11, 12);
+		chacha20_quarter_round(x, 2, 7, 8, 13);
+		chacha20_quarter_round(x, 3, 4, 9, 14);
+	}
+}
+
+// NOTE: The nonce may be nullptr when the caller fills in words 12-15 itself (HChaCha20 does).
+inline void chacha20_setup_state(uint32_t (&state)[16], const unsigned char* key, uint32_t counter, const unsigned char* nonce) noexcept {
+	state[0] = 0x61707865;
+	state[1] = 0x3320646e;
+	state[2] = 0x79622d32;
+	state[3] = 0x6b206574;
+	for (int i = 0; i < 8; i++) { state[4 + i] = chacha20_load32(key + i * 4); }
+	state[12] = counter;
+	if (nonce) {
+		for (int i = 0; i < 3; i++) { state[13 + i] = chacha20_load32(nonce + i * 4); }
+	}
+}
+
+inline void chacha20_block(const uint32_t (&state)[16], unsigned char* output) noexcept {
+	uint32_t x[16];
+	std::memcpy(x, state, sizeof(x));
+	chacha20_rounds(x);
+	for (int i = 0; i < 16; i++) { chacha20_store32(output + i * 4, x[i] + state[i]); }
+}
+
+inline void hchacha20(const unsigned char* key, const unsigned char* input, unsigned char* output) noexcept {
+	uint32_t x[16];
+	chacha20_setup_state(x, key, chacha20_load32(input), nullptr);
+	for (int i = 0; i < 3; i++) { x[13 + i] = chacha20_load32(input + 4 + i * 4); }
+	chacha20_rounds(x);
+	for (int i = 0; i < 4; i++) { chacha20_store32(output + i * 4, x[i]); }
+	for (int i = 0; i < 4; i++) { chacha20_store32(output + 16 + i * 4, x[12 + i]); }
+}
+
+#ifdef CHACHA20_SSE2
+
+template <int amount>
+inline __m128i chacha20_rotate_left_sse2(__m128i value) noexcept {
+	return _mm_or_si128(_mm_slli_epi32(value, amount), _mm_srli_epi32(value, 32 - amount));
+}
+
+inline void chacha20_quarter_round_sse2(__m128i& a, __m128i& b, __m128i& c, __m128i& d) noexcept {
+	a = _mm_add_epi32(a, b); d = chacha20_rotate_left_sse2<16>(_mm_xor_si128(d, a));
+	c = _mm_add_epi32(c, d); b = chacha20_rotate_left_sse2<12>(_mm_xor_si128(b, c));
+	a = _mm_add_epi32(a, b); d = chacha20_rotate_left_sse2<8>(_mm_xor_si128(d, a));
+	c = _mm_add_epi32(c, d); b = chacha20_rotate_left_sse2<7>(_mm_xor_si128(b, c));
+}
+
+// NOTE: Computes 4 consecutive blocks at once. Every register holds the same state word for all 4 blocks
+// (lane n belongs to block n), so the rounds are exactly the scalar rounds, just 4 wide.
+// The 4x4 transposes at the end turn the lanes back into contiguous blocks (this is where little-endian is assumed).
+inline void chacha20_xor_4_blocks_sse2(const uint32_t (&state)[16], const unsigned char* input, unsigned char* output) noexcept {
+	__m128i original[16];
+	for (int i = 0; i < 16; i++) { original[i] = _mm_set1_epi32((int)state[i]); }
+	original[12] = _mm_add_epi32(original[12], _mm_set_epi32(3, 2, 1, 0));
+
+	__m128i x[16];
+	for (int i = 0; i < 16; i++) { x[i] = original[i]; }
+
+	for (int i = 0; i < 10; i++) {
+		chacha20_quarter_round_sse2(x[0], x[4], x[8], x[12]);
+		chacha20_quarter_round_sse2(x[1], x[5], x[9], x[13]);
+		chacha20_quarter_round_sse2(x[2], x[6], x[10], x[14]);
+		chacha20_quarter_round_sse2(x[3], x[7], x[11], x[15]);
+		chacha20_quarter_round_sse2(x[0], x[5], x[10], x[15]);
+		chacha20_quarter_round_sse2(x[1], x[6], x[11], x[12]);
+		chacha20_quarter_round_sse2(x[2], x[7], x[8], x[13]);
+		chacha20_quarter_round_sse2(x[3], x[4], x[9], x[14]);
+	}
+
+	for (int i = 0; i < 16; i++) { x[i] = _mm_add_epi32(x[i], original[i]); }
+
+	for (int group = 0; group < 4; group++) {
+		__m128i ab_low = _mm_unpacklo_epi32(x[group * 4], x[group * 4 + 1]);
+		__m128i cd_low = _mm_unpacklo_epi32(x[group * 4 + 2], x[group * 4 + 3]);
+		__m128i ab_high = _mm_unpackhi_epi32(x[group * 4], x[group * 4 + 1]);
+		__m128i cd_high = _mm_unpackhi_epi32(x[group * 4 + 2], x[group * 4 + 3]);
+
+		__m128i keystream[4] = {
+			_mm_unpacklo_epi64(ab_low, cd_low),
+			_mm_unpackhi_epi64(ab_low, cd_low),
+			_mm_unpacklo_epi64(ab_high, cd_high),
+			_mm_unpackhi_epi64(ab_high, cd_high)
+		};
+
+		for (int block = 0; block < 4; block++) {
+			size_t offset = block * chacha20_block_size + group * 16;
+			__m128i data = _mm_loadu_si128((const __m128i*)(input + offset));
+			_mm_storeu_si128((__m128i*)(output + offset), _mm_xor_si128(data, keystream[block]));
+		}
+	}
+}
+
+#endif
+
+// NOTE: Input and output may be the same buffer.
+inline void chacha20_xor(const unsigned char* key, const unsigned char* nonce, uint32_t counter, const unsigned char* input, unsigned char* output, size_t size) noexcept {
+	uint32_t state[16];
+	chacha20_setup_state(state, key, counter, nonce);
+
+#ifdef CHACHA20_SSE2
+	while (size >= chacha20_block_size * 4) {
+		chacha20_xor_4_blocks_sse2(state, input, output);
+		state[12] += 4;
+		input += chacha20_block_size * 4;
+		output += chacha20_block_size * 4;
+		size -= chacha20_block_size * 4;
+	}
+#endif
+
+	unsigned char keystream[chacha20_block_size];
+	while (size != 0) {
+		chacha20_block(state, keystream);
+		state[12]++;
+		size_t block_size = size < chacha20_block_size ? size : chacha20_block_size;
+		for (size_t i = 0; i < block_size; i++) { output[i] = input[i] ^ keystream[i]; }
+		input += block_size;
+		output += block_size;
+		size -= block_size;
+	}
+}
+
+// NOTE: Poly1305 with 26-bit limbs (the well-known "donna" layout), so that all the products fit into 64 bits
+// on every compiler we build with.
+struct poly1305_state_t {
+	uint32_t r[5];
+	uint32_t h[5];
+	uint32_t pad[4];
+};
+
+inline void poly1305_init(poly1305_state_t& state, const unsigned char* key) noexcept {
+	state.r[0] = chacha20_load32(key + 0) & 0x3ffffff;
+	state.r[1] = (chacha20_load32(key + 3) >> 2) & 0x3ffff03;
+	state.r[2] = (chacha20_load32(key + 6) >> 4) & 0x3ffc0ff;
+	state.r[3] = (chacha20_load32(key + 9) >> 6) & 0x3f03fff;
+	state.r[4] = (chacha20_load32(key + 12) >> 8) & 0x00fffff;
+	for (int i = 0; i < 5; i++) { state.h[i] = 0; }
+	for (int i = 0; i < 4; i++) { state.pad[i] = chacha20_load32(key + 16 + i * 4); }
+}
+
+inline void poly1305_block(poly1305_state_t& state, const unsigned char* block) noexcept {
+	const uint32_t r0 = state.r[0], r1 = state.r[1], r2 = state.r[2], r3 = state.r[3], r4 = state.r[4];
+	const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+
+	uint32_t h0 = state.h[0] + (chacha20_load32(block + 0) & 0x3ffffff);
+	uint32_t h1 = state.h[1] + ((chacha20_load32(block + 3) >> 2) & 0x3ffffff);
+	uint32_t h2 = state.h[2] + ((chacha20_load32(block + 6) >> 4) & 0x3ffffff);
+	uint32_t h3 = state.h[3] + ((chacha20_load32(block + 9) >> 6) & 0x3ffffff);
+	uint32_t h4 = state.h[4] + ((chacha20_load32(block + 12) >> 8) | (1 << 24));
+
+	uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+	uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+	uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+	uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+	uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+	uint32_t carry;
+	carry = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+	d1 += carry; carry = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+	d2 += carry; carry = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+	d3 += carry; carry = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+	d4 += carry; carry = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+	h0 += carry * 5; carry = h0 >> 26; h0 &= 0x3ffffff;
+	h1 += carry;
+
+	state.h[0] = h0; state.h[1] = h1; state.h[2] = h2; state.h[3] = h3; state.h[4] = h4;
+}
+
+// NOTE: Feeds the data in as if it were zero-padded to a multiple of 16, which is exactly what the AEAD construction
+// asks for. That's why there's no need for the partial final block handling that plain Poly1305 has.
+inline void poly1305_update_padded(poly1305_state_t& state, const unsigned char* data, size_t size) noexcept {
+	while (size >= 16) {
+		poly1305_block(state, data);
+		data += 16;
+		size -= 16;
+	}
+	if (size != 0) {
+		unsigned char block[16] = { };
+		std::memcpy(block, data, size);
+		poly1305_block(state, block);
+	}
+}
+
+inline void poly1305_finish(poly1305_state_t& state, unsigned char* tag) noexcept {
+	uint32_t h0 = state.h[0], h1 = state.h[1], h2 = state.h[2], h3 = state.h[3], h4 = state.h[4];
+
+	uint32_t carry;
+	carry = h1 >> 26; h1 &= 0x3ffffff;
+	h2 += carry; carry = h2 >> 26; h2 &= 0x3ffffff;
+	h3 += carry; carry = h3 >> 26; h3 &= 0x3ffffff;
+	h4 += carry; carry = h4 >> 26; h4 &= 0x3ffffff;
+	h0 += carry * 5; carry = h0 >> 26; h0 &= 0x3ffffff;
+	h1 += carry;
+
+	// NOTE: Compute h - p and pick it (without branching) if it didn't underflow.
+	uint32_t g0 = h0 + 5; carry = g0 >> 26; g0 &= 0x3ffffff;
+	uint32_t g1 = h1 + carry; carry = g1 >> 26; g1 &= 0x3ffffff;
+	uint32_t g2 = h2 + carry; carry = g2 >> 26; g2 &= 0x3ffffff;
+	uint32_t g3 = h3 + carry; carry = g3 >> 26; g3 &= 0x3ffffff;
+	uint32_t g4 = h4 + carry - (1 << 26);
+
+	uint32_t mask = (g4 >> 31) - 1;
+	h0 = (h0 & ~mask) | (g0 & mask);
+	h1 = (h1 & ~mask) | (g1 & mask);
+	h2 = (h2 & ~mask) | (g2 & mask);
+	h3 = (h3 & ~mask) | (g3 & mask);
+	h4 = (h4 & ~mask) | (g4 & mask);
+
+	uint32_t words[4] = {
+		h0 | (h1 << 26),
+		(h1 >> 6) | (h2 << 20),
+		(h2 >> 12) | (h3 << 14),
+		(h3 >> 18) | (h4 << 8)
+	};
+
+	uint64_t sum = 0;
+	for (int i = 0; i < 4; i++) {
+		sum = (uint64_t)words[i] + state.pad[i] + (sum >> 32);
+		chacha20_store32(tag + i * 4, (uint32_t)sum);
+	}
+}
+
+inline void chacha20_poly1305_compute_tag(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, size_t aad_size,
+					  const unsigned char* ciphertext, size_t ciphertext_size, unsigned char* tag) noexcept {
+	uint32_t state[16];
+	chacha20_setup_state(state, key, 0, nonce);
+	unsigned char one_time_key[chacha20_block_size];
+	chacha20_block(state, one_time_key);
+
+	poly1305_state_t poly;
+	poly1305_init(poly, one_time_key);
+	poly1305_update_padded(poly, aad, aad_size);
+	poly1305_update_padded(poly, ciphertext, ciphertext_size);
+
+	unsigned char lengths[16];
+	for (int i = 0; i < 8; i++) {
+		lengths[i] = (unsigned char)((uint64_t)aad_size >> (i * 8));
+		lengths[8 + i] = (unsigned char)((uint64_t)ciphertext_size >> (i * 8));
+	}
+	poly1305_block(poly, lengths);
+
+	poly1305_finish(poly, tag);
+}
+
+inline void chacha20_poly1305_encrypt(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, size_t aad_size,
+				      const unsigned char* plaintext, size_t size, unsigned char* ciphertext, unsigned char* tag) noexcept {
+	chacha20_xor(key, nonce, 1, plaintext, ciphertext, size);
+	chacha20_poly1305_compute_tag(key, nonce, aad, aad_size, ciphertext, size, tag);
+}
+
+// NOTE: The tag is checked before anything gets decrypted, so on failure the output buffer is left untouched.
+inline bool chacha20_poly1305_decrypt(const unsigned char* key, const unsigned char* nonce, const unsigned char* aad, size_t aad_size,
+				      const unsigned char* ciphertext, size_t size, const unsigned char* tag, unsigned char* plaintext) noexcept {
+	unsigned char expected_tag[poly1305_tag_size];
+	chacha20_poly1305_compute_tag(key, nonce, aad, aad_size, ciphertext, size, expected_tag);
+
+	// NOTE: Constant-time comparison, so that the time this takes doesn't tell an attacker how much of the tag was right.
+	unsigned char difference = 0;
+	for (size_t i = 0; i < poly1305_tag_size; i++) { difference |= expected_tag[i] ^ tag[i]; }
+	if (difference != 0) { return false; }
+
+	chacha20_xor(key, nonce, 1, ciphertext, plaintext, size);
+	return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <atomic>		// for std::atomic
+
+#include "NetworkShepherd.h"	// for the connection phases
+
+#include "crossplatform_io.h"
+
+#include "transfer_stats.h"	// for the clock, the first byte times and the text formatting
+
+/*
+NOTE: How "--timing" works:
+	- NetworkShepherd reports every connection phase it goes through (with start and end times on the monotonic clock),
+		and the transfer statistics already know when the first byte went out and when the first byte came in.
+	- only the first time each phase happens is kept, so with "-k" the report is about the first connection (plus the setup
+		of the listener).
+	- on exit, every phase that happened is printed in the order in which it finished, like curl's "-w" timings: the time
+		since nc started (cumulative, so the slow step is where the numbers jump) and how long the step itself took.
+*/
+
+constexpr size_t connection_timing_phase_count = (size_t)NetworkPhase::CLOSE + 1;
+
+namespace connection_timing {
+	inline uint64_t startTime = 0;
+
+	inline std::atomic<uint64_t> phaseStarts[connection_timing_phase_count] { };
+	inline std::atomic<uint64_t> phaseEnds[connection_timing_phase_count] { };
+}
+
+inline void connection_timing_record_phase(NetworkPhase phase, uint64_t start, uint64_t end) noexcept {
+	if (connection_timing::phaseEnds[(size_t)phase].load(std::memory_order_relaxed) != 0) { return; }
+	connection_timing::phaseStarts[(size_t)phase].store(start, std::memory_order_relaxed);
+	connection_timing::phaseEnds[(size_t)phase].store(end, std::memory_order_relaxed);
+}
+
+// NOTE: Seconds with microsecond precision, which is what curl prints as well.
+inline void connection_timing_append_seconds(signal_safe_text_t& text, uint64_t nanoseconds) noexcept {
+	uint64_t microseconds = nanoseconds / 1000;
+	text.append_unsigned(microseconds / 1000000);
+	text.append(".");
+	for (uint64_t divisor = 100000; divisor != 0; divisor /= 10) { text.append_unsigned(microseconds / divisor % 10); }
+}
+
+struct connection_timing_row_t {
+	const char* name;
+	uint64_t start;
+	uint64_t end;
+};
+
+inline void connection_timing_print_row(const connection_timing_row_t& row) noexcept {
+	signal_safe_text_t text;
+	text.append("timing: ");
+	size_t name_length = 0;
+	for (; row.name[name_length] != '\0'; name_length++) { text.data[text.size++] = row.name[name_length]; }
+	for (; name_length < 20; name_length++) { text.append(" "); }
+	connection_timing_append_seconds(text, row.end - connection_timing::startTime);
+	text.append("s");
+	if (row.start != row.end) {
+		text.append(" (took ");
+		connection_timing_append_seconds(text, row.end - row.start);
+		text.append("s)");
+	}
+	text.append("\n");
+	crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+}
+
+inline void connection_timing_print() noexcept {
+	connection_timing_row_t rows[connection_timing_phase_count + 2];
+	size_t row_count = 0;
+
+	for (size_t i = 0; i < connection_timing_phase_count; i++) {
+		uint64_t end = connection_timing::phaseEnds[i].load(std::memory_order_relaxed);
+		if (end == 0) { continue; }
+		rows[row_count++] = { network_phase_names[i], connection_timing::phaseStarts[i].load(std::memory_order_relaxed), end };
+	}
+
+	// NOTE: The first bytes are points in time, not steps, so they don't get a duration.
+	uint64_t first_byte_sent = transfer_stats::sent.firstByteTime.load(std::memory_order_relaxed);
+	if (first_byte_sent != 0) { rows[row_count++] = { "first byte sent", first_byte_sent, first_byte_sent }; }
+	uint64_t first_byte_received = transfer_stats::received.firstByteTime.load(std::memory_order_relaxed);
+	if (first_byte_received != 0) { rows[row_count++] = { "first byte received", first_byte_received, first_byte_received }; }
+
+	// NOTE: Insertion sort by end time, there are a dozen rows at most.
+	for (size_t i = 1; i < row_count; i++) {
+		connection_timing_row_t row = rows[i];
+		size_t j = i;
+		for (; j != 0 && rows[j - 1].end > row.end; j--) { rows[j] = rows[j - 1]; }
+		rows[j] = row;
+	}
+
+	for (size_t i = 0; i < row_count; i++) { connection_timing_print_row(rows[i]); }
+
+	uint64_t now = transfer_stats_now();
+	connection_timing_print_row({ "total", now, now });
+}
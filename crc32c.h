@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::memcpy
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_HARDWARE_AVAILABLE
+#include <nmmintrin.h>		// for SSE4.2 crc32 intrinsics
+#define CRC32C_HARDWARE_TARGET __attribute__((target("sse4.2")))
+#elif defined(_M_X64)
+#define CRC32C_HARDWARE_AVAILABLE
+#include <intrin.h>		// for __cpuid and crc32 intrinsics (MSVC doesn't need any target flags for these)
+#define CRC32C_HARDWARE_TARGET
+#endif
+
+// NOTE: CRC32C (Castagnoli) in its reflected form, same as the SSE4.2 crc32 instruction and iSCSI/ext4/etc.
+// NOTE: The functions in here follow the zlib convention: You start with 0 and feed the previous result back in to continue
+// the checksum over a stream. The initial and final inversions are handled internally.
+
+constexpr uint32_t crc32c_polynomial = 0x82F63B78;
+
+// NOTE: The hardware path runs three independent crc32 chains over three adjacent lanes, because the crc32 instruction
+// has a latency of 3 cycles but a throughput of 1 per cycle. One chain alone would leave the unit idle 2/3 of the time.
+// The lane results get stitched together with the shift tables below.
+constexpr size_t crc32c_lane_length = 256;
+
+struct crc32c_tables_t {
+	uint32_t slice[8][256];		// slice-by-8 tables for the software path
+	uint32_t shift_one_lane[4][256];	// advance a CRC state over crc32c_lane_length zero bytes
+	uint32_t shift_two_lanes[4][256];	// advance a CRC state over 2 * crc32c_lane_length zero bytes
+};
+
+consteval uint32_t crc32c_advance_over_zero_bytes(uint32_t state, size_t zero_byte_count) {
+	for (size_t i = 0; i < zero_byte_count * 8; i++) { state = (state >> 1) ^ (crc32c_polynomial & (0 - (state & 1))); }
+	return state;
+}
+
+// NOTE: Advancing a CRC state over zero bytes is linear over GF(2), so it's enough to advance each of the 32 basis
+// vectors once and XOR them together for every table entry. That keeps the compile-time work tiny.
+consteval void crc32c_construct_shift_tables(uint32_t (&tables)[4][256], size_t zero_byte_count) {
+	uint32_t basis[32];
+	for (uint8_t bit = 0; bit < 32; bit++) { basis[bit] = crc32c_advance_over_zero_bytes((uint32_t)1 << bit, zero_byte_count); }
+
+	for (uint8_t table = 0; table < 4; table++) {
+		for (uint16_t byte = 0; byte < 256; byte++) {
+			uint32_t entry = 0;
+			for (uint8_t bit = 0; bit < 8; bit++) {
+				if (byte & (1 << bit)) { entry ^= basis[table * 8 + bit]; }
+			}
+			tables[table][byte] = entry;
+		}
+	}
+}
+
+consteval crc32c_tables_t crc32c_construct_tables() {
+	crc32c_tables_t result { };
+
+	for (uint16_t byte = 0; byte < 256; byte++) { result.slice[0][byte] = crc32c_advance_over_zero_bytes(byte, 1); }
+	for (uint8_t slice = 1; slice < 8; slice++) {
+		for (uint16_t byte = 0; byte < 256; byte++) {
+			uint32_t previous = result.slice[slice - 1][byte];
+			result.slice[slice][byte] = (previous >> 8) ^ result.slice[0][previous & 0xff];
+		}
+	}
+
+	crc32c_construct_shift_tables(result.shift_one_lane, crc32c_lane_length);
+	crc32c_construct_shift_tables(result.shift_two_lanes, crc32c_lane_length * 2);
+
+	return result;
+}
+
+inline constexpr crc32c_tables_t crc32c_tables = crc32c_construct_tables();
+
+inline uint32_t crc32c_shift(const uint32_t (&tables)[4][256], uint32_t state) noexcept {
+	return tables[0][state & 0xff] ^ tables[1][(state >> 8) & 0xff] ^ tables[2][(state >> 16) & 0xff] ^ tables[3][state >> 24];
+}
+
+// NOTE: Operates on the raw (non-inverted) CRC state.
+inline uint32_t crc32c_software_raw(uint32_t state, const unsigned char* data, size_t size) noexcept {
+	while (size >= 8) {
+		uint32_t low;
+		uint32_t high;
+		std::memcpy(&low, data, sizeof(low));
+		std::memcpy(&high, data + 4, sizeof(high));
+		// NOTE: The byte extraction below assumes little-endian, which every platform we build for is.
+		low ^= state;
+		state = crc32c_tables.slice[7][low & 0xff] ^ crc32c_tables.slice[6][(low >> 8) & 0xff] ^
+			crc32c_tables.slice[5][(low >> 16) & 0xff] ^ crc32c_tables.slice[4][low >> 24] ^
+			crc32c_tables.slice[3][high & 0xff] ^ crc32c_tables.slice[2][(high >> 8) & 0xff] ^
+			crc32c_tables.slice[1][(high >> 16) & 0xff] ^ crc32c_tables.slice[0][high >> 24];
+		data += 8;
+		size -= 8;
+	}
+	for (size_t i = 0; i < size; i++) { state = (state >> 8) ^ crc32c_tables.slice[0][(state ^ data[i]) & 0xff]; }
+	return state;
+}
+
+#ifdef CRC32C_HARDWARE_AVAILABLE
+
+inline bool crc32c_hardware_supported() noexcept {
+#ifndef _MSC_VER
+	static const bool result = __builtin_cpu_supports("sse4.2");
+#else
+	static const bool result = [] {
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 20)) != 0;
+	}();
+#endif
+	return result;
+}
+
+CRC32C_HARDWARE_TARGET inline uint64_t crc32c_hardware_lane(uint64_t state, const unsigned char* data, size_t size) noexcept {
+	for (size_t i = 0; i < size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + i, sizeof(word));
+		state = _mm_crc32_u64(state, word);
+	}
+	return state;
+}
+
+CRC32C_HARDWARE_TARGET inline uint32_t crc32c_hardware_raw(uint32_t state, const unsigned char* data, size_t size) noexcept {
+	while (size >= crc32c_lane_length * 3) {
+		uint64_t lane_a = state;
+		uint64_t lane_b = 0;
+		uint64_t lane_c = 0;
+		// NOTE: The three chains are interleaved by hand so that they overlap in the pipeline.
+		for (size_t i = 0; i < crc32c_lane_length; i += 8) {
+			uint64_t word_a;
+			uint64_t word_b;
+			uint64_t word_c;
+			std::memcpy(&word_a, data + i, sizeof(word_a));
+			std::memcpy(&word_b, data + crc32c_lane_length + i, sizeof(word_b));
+			std::memcpy(&word_c, data + crc32c_lane_length * 2 + i, sizeof(word_c));
+			lane_a = _mm_crc32_u64(lane_a, word_a);
+			lane_b = _mm_crc32_u64(lane_b, word_b);
+			lane_c = _mm_crc32_u64(lane_c, word_c);
+		}
+
+		state = crc32c_shift(crc32c_tables.shift_two_lanes, (uint32_t)lane_a) ^
+			crc32c_shift(crc32c_tables.shift_one_lane, (uint32_t)lane_b) ^ (uint32_t)lane_c;
+
+		data += crc32c_lane_length * 3;
+		size -= crc32c_lane_length * 3;
+	}
+
+	size_t word_aligned_size = size & ~(size_t)7;
+	state = (uint32_t)crc32c_hardware_lane(state, data, word_aligned_size);
+	for (size_t i = word_aligned_size; i < size; i++) { state = _mm_crc32_u8(state, data[i]); }
+	return state;
+}
+
+#endif
+
+inline uint32_t crc32c_update(uint32_t crc, const void* data, size_t size) noexcept {
+	const unsigned char* bytes = (const unsigned char*)data;
+#ifdef CRC32C_HARDWARE_AVAILABLE
+	if (crc32c_hardware_supported()) { return ~crc32c_hardware_raw(~crc, bytes, size); }
+#endif
+	return ~crc32c_software_raw(~crc, bytes, size);
+}
@@ -3,6 +3,8 @@
 #ifndef PLATFORM_WINDOWS
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 using iosize_t = size_t;
 using sioret_t = ssize_t;
@@ -10,11 +12,24 @@ using sioret_t = ssize_t;
 inline sioret_t crossplatform_read(int fd, void* buf, iosize_t count) noexcept { return ::read(fd, buf, count); }
 inline sioret_t crossplatform_write(int fd, const void* buf, iosize_t count) noexcept { return ::write(fd, buf, count); }
 
+inline int crossplatform_create_file(const char* path) noexcept { return ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644); }
+inline int crossplatform_open_file(const char* path) noexcept { return ::open(path, O_RDONLY); }
+inline int crossplatform_close(int fd) noexcept { return ::close(fd); }
+
+// NOTE: Returns -1 if fd isn't a regular file (pipes, sockets and ttys don't have a size that means anything).
+inline long long crossplatform_get_file_size(int fd) noexcept {
+	struct stat status;
+	if (::fstat(fd, &status) == -1 || !S_ISREG(status.st_mode)) { return -1; }
+	return status.st_size;
+}
+
 #else
 
 #include <type_traits>
 
 #include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #define STDIN_FILENO 0
 #define STDOUT_FILENO 1
@@ -26,6 +41,16 @@ using sioret_t = int;
 inline sioret_t crossplatform_read(int fd, void* buf, iosize_t count) noexcept { return ::_read(fd, buf, count); }
 inline sioret_t crossplatform_write(int fd, const void* buf, iosize_t count) noexcept { return ::_write(fd, buf, count); }
 
+inline int crossplatform_create_file(const char* path) noexcept { return ::_open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE); }
+inline int crossplatform_open_file(const char* path) noexcept { return ::_open(path, _O_RDONLY | _O_BINARY); }
+inline int crossplatform_close(int fd) noexcept { return ::_close(fd); }
+
+inline long long crossplatform_get_file_size(int fd) noexcept {
+	struct _stat64 status;
+	if (::_fstat64(fd, &status) == -1 || !(status.st_mode & _S_IFREG)) { return -1; }
+	return status.st_size;
+}
+
 #endif
 
 inline sioret_t crossplatform_read_entire_buffer(int fd, void* buffer, iosize_t size) noexcept {
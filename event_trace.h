@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::strlen
+#include <cstdlib>		// for std::malloc
+#include <atomic>		// for std::atomic
+#include <mutex>		// for std::mutex
+#include <new>			// for placement new
+
+#include "crossplatform_io.h"
+
+/*
+NOTE: How "--trace" works:
+	- every thread that records events gets its own ring of events, allocated the first time it records one. Only that
+		thread ever writes to its ring, so recording is a plain store of the event plus a release store of the head,
+		no locks and no read-modify-writes on the hot path.
+	- rings are registered in a fixed table under a mutex, which only happens once per thread.
+	- when a ring is full it wraps and overwrites its oldest events (like a flight recorder), so a long transfer keeps the
+		end of its timeline instead of the start. How many events were lost is written into the trace.
+	- nothing is written until the program exits. Then every ring is turned into Chrome trace-event JSON ("X" complete
+		events, timestamps in microseconds since the trace started), which chrome://tracing and Perfetto can both open.
+	- events are only ever recorded for whole calls (start and end are already known), so there's never a half-written
+		"begin" without an "end" in the output.
+*/
+
+constexpr size_t event_trace_ring_capacity = (size_t)1 << 16;	// NOTE: Per thread, a power of two so wrapping is a mask.
+constexpr size_t event_trace_max_threads = 64;			// NOTE: Threads beyond this just don't get traced.
+
+struct event_trace_event_t {
+	const char* name;	// NOTE: Always a string literal, so storing the pointer is enough.
+	uint64_t start;		// NOTE: Same clock as transfer_stats_now().
+	uint64_t end;
+	uint64_t bytes;
+};
+
+struct event_trace_ring_t {
+	event_trace_event_t events[event_trace_ring_capacity];
+	std::atomic<uint64_t> head { 0 };	// NOTE: Total events ever recorded, the slot is head masked by the capacity.
+	const char* threadName = nullptr;
+};
+
+namespace event_trace {
+	inline bool isEnabled = false;
+	inline uint64_t startTime = 0;
+
+	inline std::mutex registryMutex;
+	inline event_trace_ring_t* rings[event_trace_max_threads] { };
+	inline std::atomic<size_t> ringCount { 0 };
+
+	inline thread_local event_trace_ring_t* threadRing = nullptr;
+	inline thread_local bool threadIsUntraced = false;
+}
+
+inline event_trace_ring_t* event_trace_get_thread_ring() noexcept {
+	if (event_trace::threadRing != nullptr || event_trace::threadIsUntraced) { return event_trace::threadRing; }
+
+	std::lock_guard<std::mutex> lock(event_trace::registryMutex);
+	size_t index = event_trace::ringCount.load(std::memory_order_relaxed);
+	// NOTE: malloc instead of new because the ring is a couple MiB and new would value-initialize all of it.
+	event_trace_ring_t* ring = index < event_trace_max_threads ? (event_trace_ring_t*)std::malloc(sizeof(event_trace_ring_t)) : nullptr;
+	if (ring == nullptr) {
+		event_trace::threadIsUntraced = true;
+		return nullptr;
+	}
+	new (&ring->head) std::atomic<uint64_t>(0);
+	ring->threadName = nullptr;
+	event_trace::rings[index] = ring;
+	event_trace::ringCount.store(index + 1, std::memory_order_release);
+	event_trace::threadRing = ring;
+	return ring;
+}
+
+// NOTE: Shows up as the thread's name in the trace viewer. name has to be a string literal.
+inline void event_trace_name_thread(const char* name) noexcept {
+	if (!event_trace::isEnabled) { return; }
+	event_trace_ring_t* ring = event_trace_get_thread_ring();
+	if (ring != nullptr) { ring->threadName = name; }
+}
+
+inline void event_trace_record(const char* name, uint64_t start, uint64_t end, uint64_t bytes) noexcept {
+	event_trace_ring_t* ring = event_trace_get_thread_ring();
+	if (ring == nullptr) { return; }
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	ring->events[head & (event_trace_ring_capacity - 1)] = { name, start, end, bytes };
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+// NOTE: The JSON is assembled in a fixed chunk and written out whenever the chunk fills up.
+struct event_trace_writer_t {
+	int fd;
+	char data[64 * 1024];
+	size_t size = 0;
+
+	void flush() noexcept {
+		if (size == 0) { return; }
+		crossplatform_write_entire_buffer(fd, data, size);
+		size = 0;
+	}
+
+	void append_bytes(const char* bytes, size_t length) noexcept {
+		for (size_t i = 0; i < length; i++) {
+			if (size == sizeof(data)) { flush(); }
+			data[size++] = bytes[i];
+		}
+	}
+
+	template <size_t literal_length>
+	void append(const char (&literal)[literal_length]) noexcept { append_bytes(literal, literal_length - 1); }
+
+	// NOTE: Names are all literals from this program, none of them need escaping.
+	void append_c_string(const char* string) noexcept { append_bytes(string, std::strlen(string)); }
+
+	void append_unsigned(uint64_t value) noexcept {
+		char digits[20];
+		uint8_t digit_count = 0;
+		do {
+			digits[digit_count++] = value % 10 + '0';
+			value /= 10;
+		} while (value != 0);
+		while (digit_count != 0) { append_bytes(&digits[--digit_count], 1); }
+	}
+
+	// NOTE: The trace format wants microseconds, the fraction keeps the nanosecond resolution.
+	void append_microseconds(uint64_t nanoseconds) noexcept {
+		append_unsigned(nanoseconds / 1000);
+		char fraction[4] = { '.', (char)(nanoseconds / 100 % 10 + '0'), (char)(nanoseconds / 10 % 10 + '0'), (char)(nanoseconds % 10 + '0') };
+		append_bytes(fraction, sizeof(fraction));
+	}
+};
+
+inline void event_trace_write_thread_metadata(event_trace_writer_t& writer, size_t thread_id, const event_trace_ring_t& ring, uint64_t lost_events) noexcept {
+	writer.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+	writer.append_unsigned(thread_id);
+	writer.append(",\"args\":{\"name\":\"");
+	if (ring.threadName != nullptr) {
+		writer.append_c_string(ring.threadName);
+	} else {
+		writer.append("thread ");
+		writer.append_unsigned(thread_id);
+	}
+	writer.append("\",\"lost_events\":");
+	writer.append_unsigned(lost_events);
+	writer.append("}}");
+}
+
+inline void event_trace_write_event(event_trace_writer_t& writer, size_t thread_id, const event_trace_event_t& event) noexcept {
+	writer.append(",\n{\"name\":\"");
+	writer.append_c_string(event.name);
+	writer.append("\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+	writer.append_unsigned(thread_id);
+	writer.append(",\"ts\":");
+	writer.append_microseconds(event.start > event_trace::startTime ? event.start - event_trace::startTime : 0);
+	writer.append(",\"dur\":");
+	writer.append_microseconds(event.end - event.start);
+	writer.append(",\"args\":{\"bytes\":");
+	writer.append_unsigned(event.bytes);
+	writer.append("}}");
+}
+
+// NOTE: Runs at exit. Other threads might still be recording (error exits don't wait for them), so the slot right at
+// a full ring's head is skipped, it might be in the middle of being overwritten.
+inline void event_trace_write(int fd) noexcept {
+	static event_trace_writer_t writer;
+	writer.fd = fd;
+
+	writer.append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	writer.append("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"nc\"}}");
+
+	size_t ring_count = event_trace::ringCount.load(std::memory_order_acquire);
+	for (size_t i = 0; i < ring_count; i++) {
+		const event_trace_ring_t& ring = *event_trace::rings[i];
+		size_t thread_id = i + 1;
+		uint64_t head = ring.head.load(std::memory_order_acquire);
+		uint64_t first = head > event_trace_ring_capacity - 1 ? head - (event_trace_ring_capacity - 1) : 0;
+
+		writer.append(",\n");
+		event_trace_write_thread_metadata(writer, thread_id, ring, first);
+		for (uint64_t j = first; j < head; j++) { event_trace_write_event(writer, thread_id, ring.events[j & (event_trace_ring_capacity - 1)]); }
+	}
+
+	writer.append("\n]}\n");
+	writer.flush();
+}
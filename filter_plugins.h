@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::strchr, std::strlen and std::memcpy
+#include <cstdlib>		// for std::malloc and std::realloc
+
+#include "crossplatform_io.h"
+
+#include "error_reporting.h"
+
+#include "nc_filter.h"
+
+#ifndef PLATFORM_WINDOWS
+#include <dlfcn.h>		// for dlopen, dlsym and dlerror
+#endif
+
+/*
+NOTE: How "--filter" works (the module side is described in nc_filter.h):
+	- the modules are loaded and their filters created at startup, so a bad module is reported before any connection
+		is made.
+	- the filters run right where the data is in nc's buffers, between the stdin read and everything that happens on
+		the way to the socket ("-C", "--checksum", ...), and between everything that happens on the way in and
+		stdout. A filter that works in place costs one function call per chunk, no copies.
+	- the pool buffers that filters emit into are only handed back when the next chunk starts, because the filters
+		further down the chain and then nc itself still read from them until then. Nothing is ever freed, a pool
+		slot just grows when a bigger buffer is asked for, so after the first few chunks there are no allocations.
+*/
+
+constexpr uint8_t filter_plugins_max_filters = 8;
+constexpr uint8_t filter_pool_slot_count = 16;
+constexpr size_t filter_pool_min_buffer_size = 64 * 1024;
+
+struct filter_plugin_t {
+	const nc_filter_t* filter;
+	void* state;
+};
+
+struct filter_pool_slot_t {
+	unsigned char* data = nullptr;
+	size_t capacity = 0;
+	bool isInUse = false;
+};
+
+namespace filter_plugins {
+	inline filter_plugin_t filters[filter_plugins_max_filters];
+	inline uint8_t filterCount = 0;
+
+	// NOTE: One pool per direction, indexed by nc_filter_direction_t, so that the two transfer threads never share one.
+	inline filter_pool_slot_t pools[2][filter_pool_slot_count];
+}
+
+// NOTE: Only ever called from inside a filter, on the thread of the direction it's asking for.
+inline unsigned char* filter_plugins_acquire_buffer(nc_filter_direction_t direction, size_t size) noexcept {
+	if (direction != NC_FILTER_OUTGOING && direction != NC_FILTER_INCOMING) { return nullptr; }
+	filter_pool_slot_t* freeSlot = nullptr;
+	for (filter_pool_slot_t& slot : filter_plugins::pools[direction]) {
+		if (slot.isInUse) { continue; }
+		if (slot.capacity >= size) {
+			slot.isInUse = true;
+			return slot.data;
+		}
+		if (!freeSlot) { freeSlot = &slot; }
+	}
+	if (!freeSlot) { return nullptr; }
+
+	size_t capacity = size < filter_pool_min_buffer_size ? filter_pool_min_buffer_size : size;
+	unsigned char* data = (unsigned char*)std::realloc(freeSlot->data, capacity);
+	if (!data) { return nullptr; }
+	freeSlot->data = data;
+	freeSlot->capacity = capacity;
+	freeSlot->isInUse = true;
+	return data;
+}
+
+inline void filter_plugins_release_buffers(nc_filter_direction_t direction) noexcept {
+	for (filter_pool_slot_t& slot : filter_plugins::pools[direction]) { slot.isInUse = false; }
+}
+
+inline const nc_filter_host_t filter_plugins_host = { NC_FILTER_ABI_VERSION, filter_plugins_acquire_buffer };
+
+#ifndef PLATFORM_WINDOWS
+
+[[noreturn]] inline void filter_plugins_report_load_error(const char* reason) noexcept {
+	crossplatform_write_entire_literal(STDERR_FILENO, "ERROR: failed to load filter module: ");
+	crossplatform_write_entire_buffer(STDERR_FILENO, reason, std::strlen(reason));
+	crossplatform_write_entire_literal(STDERR_FILENO, "\n");
+	halt_program(EXIT_FAILURE);
+}
+
+// NOTE: spec is "<module>" or "<module>=<argument>".
+inline void filter_plugins_load(const char* spec) noexcept {
+	const char* argument = "";
+	const char* path = spec;
+	const char* separator = std::strchr(spec, '=');
+	if (separator) {
+		size_t pathLength = separator - spec;
+		char* pathCopy = (char*)std::malloc(pathLength + 1);
+		if (!pathCopy) { REPORT_ERROR_AND_EXIT("failed to allocate filter module path", EXIT_FAILURE); }
+		std::memcpy(pathCopy, spec, pathLength);
+		pathCopy[pathLength] = '\0';
+		path = pathCopy;
+		argument = separator + 1;
+	}
+
+	// NOTE: The modules are never unloaded, the filters are in use until the very end.
+	void* module = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!module) { filter_plugins_report_load_error(dlerror()); }
+	nc_filter_entry_t entry = (nc_filter_entry_t)dlsym(module, NC_FILTER_ENTRY_SYMBOL);
+	if (!entry) { filter_plugins_report_load_error("module doesn't export " NC_FILTER_ENTRY_SYMBOL); }
+	const nc_filter_t* filter = entry();
+	if (!filter || filter->abi_version != NC_FILTER_ABI_VERSION) { filter_plugins_report_load_error("module was built for a different filter ABI version"); }
+	if (!filter->create || !filter->process || !filter->finish || !filter->destroy) { filter_plugins_report_load_error("module's filter is missing functions"); }
+
+	void* state = filter->create(&filter_plugins_host, argument);
+	if (!state) { filter_plugins_report_load_error("module's filter couldn't be created"); }
+	filter_plugins::filters[filter_plugins::filterCount++] = { filter, state };
+}
+
+#else
+
+// NOTE: "--filter" is rejected on Windows while parsing the args.
+inline void filter_plugins_load(const char* spec) noexcept { }
+
+#endif
+
+// NOTE: Runs the view through the filters from first_filter on, until one of them drops it.
+inline void filter_plugins_run(nc_filter_direction_t direction, uint8_t first_filter, nc_filter_view_t& view) noexcept {
+	for (uint8_t i = first_filter; i < filter_plugins::filterCount && view.size != 0; i++) {
+		const filter_plugin_t& plugin = filter_plugins::filters[i];
+		if (plugin.filter->process(plugin.state, direction, &view) != 0) { REPORT_ERROR_AND_EXIT("filter failed to process data", EXIT_FAILURE); }
+	}
+}
+
+// NOTE: The returned view stays valid until the next call for the same direction.
+inline nc_filter_view_t filter_plugins_process(nc_filter_direction_t direction, void* data, size_t size, size_t capacity) noexcept {
+	filter_plugins_release_buffers(direction);
+	nc_filter_view_t view = { (unsigned char*)data, size, capacity };
+	filter_plugins_run(direction, 0, view);
+	return view;
+}
+
+// NOTE: Lets the filters emit what they've held back at the end of a stream. Every call finishes filters (starting at
+// next_filter) until one of them emits something that makes it through the rest of the chain, then returns that in
+// view. Returns false once all of them are finished, so it's meant to be called in a loop, starting with 0.
+inline bool filter_plugins_flush(nc_filter_direction_t direction, uint8_t& next_filter, nc_filter_view_t& view) noexcept {
+	while (next_filter < filter_plugins::filterCount) {
+		filter_plugins_release_buffers(direction);
+		view = { nullptr, 0, 0 };
+		const filter_plugin_t& plugin = filter_plugins::filters[next_filter++];
+		if (plugin.filter->finish(plugin.state, direction, &view) != 0) { REPORT_ERROR_AND_EXIT("filter failed to finish", EXIT_FAILURE); }
+		filter_plugins_run(direction, next_filter, view);
+		if (view.size != 0) { return true; }
+	}
+	return false;
+}
+
+inline void filter_plugins_destroy() noexcept {
+	for (uint8_t i = 0; i < filter_plugins::filterCount; i++) {
+		filter_plugins::filters[i].filter->destroy(filter_plugins::filters[i].state);
+	}
+	filter_plugins::filterCount = 0;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::memcpy and std::memset
+#include <mutex>		// for std::mutex, so the two transfer threads don't tear each others lines apart
+
+#include "crossplatform_io.h"
+
+#include "error_reporting.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define HEX_DUMP_SSE2
+#include <emmintrin.h>		// for SSE2 intrinsics
+#endif
+
+/*
+NOTE: Format of the dump (one line per 16 bytes, similar to xxd):
+	> 0000000000000000: 4865 6c6c 6f20 776f 726c 640a            Hello world.
+	- the first character is the direction: '>' for data sent to the remote, '<' for data received from the remote.
+	- the offset counts bytes per direction, so the two directions each have their own running offset.
+	- it's 16 hex digits long so that it doesn't wrap around in the middle of big captures.
+*/
+
+constexpr size_t hex_dump_bytes_per_line = 16;
+constexpr size_t hex_dump_hex_column_offset = 2 + 16 + 2;
+constexpr size_t hex_dump_ascii_column_offset = hex_dump_hex_column_offset + (hex_dump_bytes_per_line / 2) * 5 + 1;
+constexpr size_t hex_dump_max_line_length = hex_dump_ascii_column_offset + hex_dump_bytes_per_line + 1;
+
+// NOTE: Lines are collected into a batch before they're written out, so that there's one write syscall (and one lock)
+// per batch instead of per line.
+constexpr size_t hex_dump_lines_per_batch = 128;
+
+enum class HexDumpDirection : char {
+	SENT = '>',
+	RECEIVED = '<'
+};
+
+namespace hex_dump {
+	inline int fd = -1;
+	inline std::mutex fdMutex;
+
+	inline uint64_t sentOffset = 0;
+	inline uint64_t receivedOffset = 0;
+}
+
+// NOTE: Writes 32 hex digits for the 16 input bytes, as well as their printable representation (non-printables become '.').
+inline void hex_dump_encode_block(const unsigned char* input, char* hex_output, char* ascii_output) noexcept {
+#ifdef HEX_DUMP_SSE2
+	const __m128i bytes = _mm_loadu_si128((const __m128i*)input);
+
+	const __m128i low_nibble_mask = _mm_set1_epi8(0x0f);
+	const __m128i low_nibbles = _mm_and_si128(bytes, low_nibble_mask);
+	const __m128i high_nibbles = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble_mask);
+
+	// NOTE: nibble + '0', plus another ('a' - '0' - 10) for nibbles above 9. No branches, no table.
+	const __m128i digit_base = _mm_set1_epi8('0');
+	const __m128i letter_adjustment = _mm_set1_epi8('a' - '0' - 10);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i low_digits = _mm_add_epi8(_mm_add_epi8(low_nibbles, digit_base), _mm_and_si128(_mm_cmpgt_epi8(low_nibbles, nine), letter_adjustment));
+	const __m128i high_digits = _mm_add_epi8(_mm_add_epi8(high_nibbles, digit_base), _mm_and_si128(_mm_cmpgt_epi8(high_nibbles, nine), letter_adjustment));
+
+	_mm_storeu_si128((__m128i*)hex_output, _mm_unpacklo_epi8(high_digits, low_digits));
+	_mm_storeu_si128((__m128i*)(hex_output + 16), _mm_unpackhi_epi8(high_digits, low_digits));
+
+	// NOTE: Comparisons are signed, so bytes >= 0x80 are negative and automatically fail the "> 0x1f" test.
+	const __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1f)), _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7f)));
+	const __m128i ascii = _mm_or_si128(_mm_and_si128(printable, bytes), _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+	_mm_storeu_si128((__m128i*)ascii_output, ascii);
+#else
+	constexpr char digits[] = "0123456789abcdef";
+	for (size_t i = 0; i < hex_dump_bytes_per_line; i++) {
+		hex_output[i * 2] = digits[input[i] >> 4];
+		hex_output[i * 2 + 1] = digits[input[i] & 0x0f];
+		ascii_output[i] = (input[i] > 0x1f && input[i] < 0x7f) ? input[i] : '.';
+	}
+#endif
+}
+
+// NOTE: Returns the length of the line. line_size has to be between 1 and hex_dump_bytes_per_line.
+inline size_t hex_dump_construct_line(char* line, char direction_marker, uint64_t offset, const unsigned char* data, size_t line_size) noexcept {
+	unsigned char block[hex_dump_bytes_per_line];
+	const unsigned char* input = data;
+	if (line_size != hex_dump_bytes_per_line) {
+		std::memset(block, 0, sizeof(block));
+		std::memcpy(block, data, line_size);
+		input = block;
+	}
+
+	char hex[hex_dump_bytes_per_line * 2];
+	char ascii[hex_dump_bytes_per_line];
+	hex_dump_encode_block(input, hex, ascii);
+
+	// NOTE: The offset goes through the same encoder, it just needs to be big-endian first.
+	unsigned char offset_bytes[hex_dump_bytes_per_line] = { };
+	for (size_t i = 0; i < sizeof(offset); i++) { offset_bytes[i] = (unsigned char)(offset >> (56 - i * 8)); }
+	char offset_hex[hex_dump_bytes_per_line * 2];
+	char offset_ascii[hex_dump_bytes_per_line];
+	hex_dump_encode_block(offset_bytes, offset_hex, offset_ascii);
+
+	line[0] = direction_marker;
+	line[1] = ' ';
+	std::memcpy(line + 2, offset_hex, 16);
+	line[18] = ':';
+	std::memset(line + 19, ' ', hex_dump_ascii_column_offset - 19);
+
+	for (size_t group = 0; group < hex_dump_bytes_per_line / 2; group++) {
+		std::memcpy(line + hex_dump_hex_column_offset + group * 5, hex + group * 4, 4);
+	}
+	if (line_size != hex_dump_bytes_per_line) {
+		// NOTE: Blank out the digits that belong to the zero padding.
+		for (size_t i = line_size; i < hex_dump_bytes_per_line; i++) {
+			std::memset(line + hex_dump_hex_column_offset + (i / 2) * 5 + (i % 2) * 2, ' ', 2);
+		}
+	}
+
+	std::memcpy(line + hex_dump_ascii_column_offset, ascii, line_size);
+	line[hex_dump_ascii_column_offset + line_size] = '\n';
+
+	return hex_dump_ascii_column_offset + line_size + 1;
+}
+
+inline void hex_dump_write_batch(const char* batch, size_t batch_size) noexcept {
+	std::lock_guard<std::mutex> lock(hex_dump::fdMutex);
+	if (!crossplatform_write_entire_buffer(hex_dump::fd, batch, batch_size)) { REPORT_ERROR_AND_EXIT("failed to write hex dump", EXIT_FAILURE); }
+}
+
+inline void write_hex_dump(HexDumpDirection direction, const void* data, size_t size) noexcept {
+	uint64_t& offset = direction == HexDumpDirection::SENT ? hex_dump::sentOffset : hex_dump::receivedOffset;
+	const unsigned char* bytes = (const unsigned char*)data;
+
+	char batch[hex_dump_lines_per_batch * hex_dump_max_line_length];
+	size_t batch_size = 0;
+	size_t lines_in_batch = 0;
+
+	while (size != 0) {
+		size_t line_size = size < hex_dump_bytes_per_line ? size : hex_dump_bytes_per_line;
+		batch_size += hex_dump_construct_line(batch + batch_size, (char)direction, offset, bytes, line_size);
+		offset += line_size;
+		bytes += line_size;
+		size -= line_size;
+
+		if (++lines_in_batch == hex_dump_lines_per_batch) {
+			hex_dump_write_batch(batch, batch_size);
+			batch_size = 0;
+			lines_in_batch = 0;
+		}
+	}
+
+	if (batch_size != 0) { hex_dump_write_batch(batch, batch_size); }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <atomic>		// for std::atomic
+
+#ifdef _MSC_VER
+#include <intrin.h>		// for _BitScanReverse64
+#endif
+
+/*
+NOTE: How the latency histograms work (log-linear, like HdrHistogram):
+	- values below latency_histogram_sub_bucket_count get a bucket each.
+	- above that, every power of two is split into latency_histogram_sub_bucket_count equally wide buckets, so every
+		bucket is at most 1/16 (~6%) as wide as the values in it. That's enough to tell a 2ms stall from a 3ms one while
+		still covering nanoseconds to minutes in a few hundred buckets.
+	- finding the bucket is a count-leading-zeros and two shifts, no loops, no floating point.
+	- like the transfer statistics, every histogram has exactly one writer at any time, so counting is a relaxed load and
+		store. Each transfer thread effectively has its own histograms, they're just indexed by operation instead of by thread.
+*/
+
+constexpr uint8_t latency_histogram_sub_bucket_bits = 4;
+constexpr uint64_t latency_histogram_sub_bucket_count = (uint64_t)1 << latency_histogram_sub_bucket_bits;
+constexpr uint8_t latency_histogram_max_exponent = 42;		// NOTE: 2^42 ns is over an hour, everything above lands in the last bucket.
+constexpr size_t latency_histogram_bucket_count = (latency_histogram_max_exponent - latency_histogram_sub_bucket_bits + 2) * latency_histogram_sub_bucket_count;
+
+struct alignas(64) latency_histogram_t {
+	std::atomic<uint64_t> buckets[latency_histogram_bucket_count] { };
+	std::atomic<uint64_t> minimum { (uint64_t)-1 };
+	std::atomic<uint64_t> maximum { 0 };
+};
+
+// NOTE: value can't be 0.
+inline uint8_t latency_histogram_highest_bit(uint64_t value) noexcept {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+inline size_t latency_histogram_bucket_index(uint64_t value) noexcept {
+	if (value < latency_histogram_sub_bucket_count) { return value; }
+	if (value >= (uint64_t)1 << (latency_histogram_max_exponent + 1)) { return latency_histogram_bucket_count - 1; }
+	uint8_t exponent = latency_histogram_highest_bit(value);
+	uint64_t sub_bucket = (value >> (exponent - latency_histogram_sub_bucket_bits)) & (latency_histogram_sub_bucket_count - 1);
+	return (exponent - latency_histogram_sub_bucket_bits + 1) * latency_histogram_sub_bucket_count + sub_bucket;
+}
+
+// NOTE: The biggest value that still lands in the bucket, which is what gets reported for percentiles (so they never understate).
+inline uint64_t latency_histogram_bucket_upper_bound(size_t index) noexcept {
+	if (index < latency_histogram_sub_bucket_count) { return index; }
+	uint8_t exponent = index / latency_histogram_sub_bucket_count + latency_histogram_sub_bucket_bits - 1;
+	uint64_t sub_bucket = index % latency_histogram_sub_bucket_count;
+	uint64_t width = (uint64_t)1 << (exponent - latency_histogram_sub_bucket_bits);
+	return ((uint64_t)1 << exponent) + (sub_bucket + 1) * width - 1;
+}
+
+inline void latency_histogram_record(latency_histogram_t& histogram, uint64_t value) noexcept {
+	std::atomic<uint64_t>& bucket = histogram.buckets[latency_histogram_bucket_index(value)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	if (value < histogram.minimum.load(std::memory_order_relaxed)) { histogram.minimum.store(value, std::memory_order_relaxed); }
+	if (value > histogram.maximum.load(std::memory_order_relaxed)) { histogram.maximum.store(value, std::memory_order_relaxed); }
+}
+
+inline uint64_t latency_histogram_count(const latency_histogram_t& histogram) noexcept {
+	uint64_t count = 0;
+	for (size_t i = 0; i < latency_histogram_bucket_count; i++) { count += histogram.buckets[i].load(std::memory_order_relaxed); }
+	return count;
+}
+
+// NOTE: per_million is the percentile times 10000, so that p99.9 can be asked for without floating point.
+inline uint64_t latency_histogram_percentile(const latency_histogram_t& histogram, uint64_t count, uint64_t per_million) noexcept {
+	uint64_t threshold = (count * per_million + 999999) / 1000000;
+	if (threshold == 0) { threshold = 1; }
+	uint64_t seen = 0;
+	for (size_t i = 0; i < latency_histogram_bucket_count; i++) {
+		seen += histogram.buckets[i].load(std::memory_order_relaxed);
+		if (seen >= threshold) {
+			uint64_t upper_bound = latency_histogram_bucket_upper_bound(i);
+			uint64_t maximum = histogram.maximum.load(std::memory_order_relaxed);
+			return upper_bound < maximum ? upper_bound : maximum;
+		}
+	}
+	return histogram.maximum.load(std::memory_order_relaxed);
+}
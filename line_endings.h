@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>		// for size_t
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define LINE_ENDINGS_SSE2
+#include <emmintrin.h>		// for SSE2 intrinsics
+#endif
+
+/*
+NOTE: How these translations avoid per-byte branching:
+	- 16 bytes at a time are compared against the interesting character. If none of them match (which is the case for
+		almost every block of normal text), the whole block is copied over with one store.
+	- blocks that do contain a match are handled by the scalar loop, which doesn't branch either: It always stores
+		and then only advances the output pointer conditionally.
+*/
+
+constexpr size_t line_endings_block_size = 16;
+
+// NOTE: The output buffer has to be at least twice the size of the input, since every byte could be a LF.
+inline size_t translate_lf_to_crlf(const char* input, size_t size, char* output) noexcept {
+	char* output_ptr = output;
+	size_t i = 0;
+
+#ifdef LINE_ENDINGS_SSE2
+	const __m128i line_feed = _mm_set1_epi8('\n');
+	for (; i + line_endings_block_size <= size; i += line_endings_block_size) {
+		__m128i block = _mm_loadu_si128((const __m128i*)(input + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, line_feed)) == 0) {
+			_mm_storeu_si128((__m128i*)output_ptr, block);
+			output_ptr += line_endings_block_size;
+			continue;
+		}
+		for (size_t j = i; j < i + line_endings_block_size; j++) {
+			*output_ptr = '\r';
+			output_ptr += input[j] == '\n';
+			*(output_ptr++) = input[j];
+		}
+	}
+#endif
+
+	for (; i < size; i++) {
+		*output_ptr = '\r';
+		output_ptr += input[i] == '\n';
+		*(output_ptr++) = input[i];
+	}
+
+	return output_ptr - output;
+}
+
+// NOTE: A CR at the very end of a chunk can't be judged until the first byte of the next chunk is known, so it's held back
+// in here in the meantime.
+struct crlf_to_lf_state_t {
+	bool pendingCR = false;
+};
+
+// NOTE: The output buffer has to be at least one byte bigger than the input, because of the held-back CR.
+inline size_t translate_crlf_to_lf(crlf_to_lf_state_t& state, const char* input, size_t size, char* output) noexcept {
+	if (size == 0) { return 0; }
+
+	char* output_ptr = output;
+
+	// NOTE: A held-back CR is dropped if this chunk starts with the LF that completes the CRLF.
+	*output_ptr = '\r';
+	output_ptr += state.pendingCR && input[0] != '\n';
+
+	size_t i = 0;
+	const size_t last = size - 1;
+
+#ifdef LINE_ENDINGS_SSE2
+	const __m128i carriage_return = _mm_set1_epi8('\r');
+	for (; i + line_endings_block_size <= last; i += line_endings_block_size) {
+		__m128i block = _mm_loadu_si128((const __m128i*)(input + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, carriage_return)) == 0) {
+			_mm_storeu_si128((__m128i*)output_ptr, block);
+			output_ptr += line_endings_block_size;
+			continue;
+		}
+		for (size_t j = i; j < i + line_endings_block_size; j++) {
+			*output_ptr = input[j];
+			output_ptr += !(input[j] == '\r' && input[j + 1] == '\n');
+		}
+	}
+#endif
+
+	for (; i < last; i++) {
+		*output_ptr = input[i];
+		output_ptr += !(input[i] == '\r' && input[i + 1] == '\n');
+	}
+
+	*output_ptr = input[last];
+	state.pendingCR = input[last] == '\r';
+	output_ptr += !state.pendingCR;
+
+	return output_ptr - output;
+}
+
+// NOTE: Call at the end of the stream, so that a lone CR at the very end isn't lost.
+inline size_t finish_crlf_to_lf(crlf_to_lf_state_t& state, char* output) noexcept {
+	if (!state.pendingCR) { return 0; }
+	state.pendingCR = false;
+	output[0] = '\r';
+	return 1;
+}
@@ -5,7 +5,7 @@ constexpr int default_connection_backlog_length = 0;
 
 #include <cstdlib>		// for std::exit(), EXIT_SUCCESS and EXIT_FAILURE, as well as most other syscalls
 #include <cstdint>		// for fixed-width integer types
-#include <cstring>		// for std::strcmp
+#include <cstring>		// for std::strcmp and std::memmove
 #include <thread>		// for multi-threading
 
 #include "NetworkShepherd.h"	// for NetworkShepherd class, which serves as our interface with the network
@@ -16,6 +16,48 @@ constexpr int default_connection_backlog_length = 0;
 
 #include "halt_program.h"
 
+#include "crc32c.h"		// for CRC32C, which the integrity trailer uses
+
+#include "hex_dump.h"		// for the "-x" traffic dump
+
+#include "line_endings.h"	// for the "-C" and "--strip-crlf" line ending translations
+
+#include "secure_channel.h"	// for the "--psk" encryption
+
+#include "token_bucket.h"	// for the "--limit-*" rate limits
+
+#include "transfer_stats.h"	// for "-v" and the SIGUSR1 statistics dumps
+
+#include "progress_report.h"	// for the "--progress" line
+
+#include "metrics_endpoint.h"	// for the "--metrics" endpoint
+
+#include "tcp_info_sampler.h"	// for the "--tcp-info" telemetry
+
+#include "bottleneck_report.h"	// for "--why-slow"
+
+#include "event_trace.h"	// for the "--trace" timeline
+
+#include "connection_timing.h"	// for "--timing"
+
+#include "perf_counters.h"	// for "--perf"
+
+#include "payload_generator.h"	// for "--generate" and "--verify"
+
+#include "session_recording.h"	// for "--record" and "--replay"
+
+#include "pcap_ring.h"		// for "--pcap"
+
+#include "rotating_output.h"	// for "--output" and its rotation
+
+#include "spill_buffer.h"	// for "--spill"
+
+#include "tee_output.h"		// for "--tee"
+
+#include "filter_plugins.h"	// for "--filter"
+
+#include "pattern_search.h"	// for "--until"
+
 #include <limits>		// numeric limits, like the biggest possible int for example
 
 /*
@@ -26,7 +68,7 @@ Exit code is EXIT_FAILURE on every other error.
 // NOTE: I don't think there is a good way to #ifdef inside of multi-line strings in C/C++, which is why we opted to just change
 // the help text here (I'm referring to the IMPORTANT: thing).
 
-constexpr char helpText_half_0[] = "usage: nc [-46lkub] [--source <source> || --port <source-port>] <address> <port>\n" \
+constexpr char helpText_half_0[] = "usage: nc [-46lkubxCv] [--source <source> || --port <source-port>] <address> <port>\n" \
 			"       nc --help\n" \
 			"\n" \
 			"function: nc (netcat) sends and receives data over a network (no flags: initiate TCP connection to <address> on <port>)\n" \
@@ -40,17 +82,64 @@ constexpr char helpText_half_0[] = "usage: nc [-46lkub] [--source <source> || --
 				"\t[-k]                         --> (only valid with -l) keep listening after connection terminates\n" \
 				"\t[-u]                         --> use UDP (default: TCP)\n" \
 				"\t[-b]                         --> (only valid with -u) allow broadcast addresses\n" \
+				"\t[-x]                         --> hex-dump traffic in both directions to stderr (stdout stays untouched)\n" \
+				"\t[-C]                         --> (only valid without -u) translate LF to CRLF in sent data\n" \
+				"\t[-v]                         --> print transfer statistics to stderr on exit\n" \
 				"\t[--source <source>]          --> (only valid without -l) send from <source> (can be IP/interface)\n" \
 				"\t[--port <source-port>]       --> (only valid without -l and with --source*) send from <source-port>\n" \
 				"\t[--backlog <backlog-length>] --> (only valid with -k) set backlog length to <backlog-length> (default: ";
 
 constexpr char helpText_half_1[] = ")\n" \
+				"\t[--checksum]                 --> (only valid without -u) append CRC32C of sent data to stream, verify received CRC32C\n" \
+				"\t[--hexdump-file <file>]      --> (only valid with -x) write hex dump to <file> instead of stderr\n" \
+				"\t[--strip-crlf]               --> (only valid without -u) translate CRLF to LF in received data\n" \
+				"\t[--psk <key-file>]           --> (only valid without -u) encrypt connection with ChaCha20-Poly1305 using 32-byte key in <key-file>\n" \
+				"\t[--limit-rate <rate>]        --> limit both sending and receiving to <rate> bytes per second (suffixes: K, M, G)\n" \
+				"\t[--limit-send <rate>]        --> limit sending to <rate> bytes per second\n" \
+				"\t[--limit-receive <rate>]     --> limit receiving to <rate> bytes per second\n" \
+				"\t[--stats-json]               --> print transfer statistics as JSON instead of text\n" \
+				"\t[--progress]                 --> show bytes transferred, rate and (if stdin is a file) ETA on stderr\n" \
+				"\t[--metrics <port|path>]      --> (only valid with -l) serve Prometheus metrics on 127.0.0.1:<port> or Unix socket <path>\n" \
+				"\t[--tcp-info <interval-ms>]   --> (only valid without -u) print TCP_INFO and socket queue depths every <interval-ms> to stderr\n" \
+				"\t[--why-slow]                 --> on exit, print which side (producer, network, consumer) limited each direction\n" \
+				"\t[--histograms <file|->]      --> record latency histograms of every read/write/send/recv, print them to <file> (or stderr) on exit\n" \
+				"\t[--trace <file>]             --> record a timeline of every I/O call and connection phase, write it to <file> as Chrome trace JSON on exit\n" \
+				"\t[--timing]                   --> on exit, print when each connection phase (resolve, connect, first byte, ...) finished\n" \
+				"\t[--perf]                     --> count CPU cycles, instructions, cache misses and context switches, print them per byte on exit\n" \
+				"\t[--generate <seed>]          --> send a pseudo-random payload generated from <seed> instead of stdin (endless unless --generate-size)\n" \
+				"\t[--generate-size <size>]     --> (only valid with --generate) stop after <size> bytes (suffixes: K, M, G, T)\n" \
+				"\t[--verify <seed>]            --> (only valid without -u) check received data against the payload of <seed> instead of writing it to stdout\n" \
+				"\t[--record <file>]            --> (only valid without -u and -k) record every chunk in both directions with timestamps to <file>\n" \
+				"\t[--replay <file>]            --> (only valid without -l and -u) send the client side of a recording instead of stdin, compare response latencies\n" \
+				"\t[--replay-speed <N|max>]     --> (only valid with --replay) replay N times as fast, or without waiting at all (default: 1)\n" \
+				"\t[--pcap <prefix>]            --> (only valid with -lu) also capture received packets to <prefix>.<n>.pcap, a ring of files\n" \
+				"\t[--pcap-file-size <size>]    --> (only valid with --pcap) start the next file in the ring after <size> bytes (default: 64M)\n" \
+				"\t[--pcap-files <count>]       --> (only valid with --pcap) keep <count> files, then overwrite the oldest (default: 8)\n" \
+				"\t[--output <path>]            --> write received data to <path> instead of stdout, from a background thread\n" \
+				"\t[--rotate-size <size>]       --> (only valid with --output) rotate <path> every <size> bytes (suffixes: K, M, G, T)\n" \
+				"\t[--rotate-interval <secs>]   --> (only valid with --output) rotate <path> once it has been open for <secs> seconds\n" \
+				"\t[--spill <memory-limit>]     --> queue received data in memory up to <memory-limit>, then in a temp file, so a slow consumer doesn't slow the network\n" \
+				"\t[--spill-dir <dir>]          --> (only valid with --spill) put the temp file in <dir> (default: $TMPDIR or /tmp)\n" \
+				"\t[--tee <file>]               --> write received data to <file> as well (can be specified up to 16 times)\n" \
+				"\t[--until <pattern>]          --> stop once <pattern> has been received (\\r, \\n, \\t, \\\\ and \\xHH are understood), everything up to and including it goes to stdout\n" \
+				"\t[--count <size>]             --> stop once <size> bytes have been received, only those go to stdout\n" \
+				"\t[--datagram-size <size>]     --> (only valid with -u, without -l) fill every datagram with exactly <size> bytes of stdin (the last one can be shorter)\n" \
+				"\t[--filter <module>[=<arg>]]  --> load a filter module (see nc_filter.h) and run both directions through it, <arg> is passed to it (can be specified up to 8 times, filters run in order)\n" \
 				"\t<address>                    --> send to <address> or (with -l) listen on <address> (can be IP/hostname/interface)\n" \
 				"\t<port>                       --> send to <port> or (with -l) listen on <port>\n" \
 			"\n" \
 			"notes:\n" \
 				"\t* The exception to the rule is \"--port 0\". This is treated as a no-op and can also appear any amount of times\n" \
-				"\tas long as \"--port\" hasn't been specified to the left of it with a non-zero value.\n";
+				"\tas long as \"--port\" hasn't been specified to the left of it with a non-zero value.\n" \
+				"\t* \"--checksum\" has to be specified on both ends. A mismatch (or a missing checksum) makes nc exit with a failure code.\n" \
+				"\t* \"--psk\" has to be specified on both ends with the same key. Authentication failures make nc exit with a failure code\n" \
+				"\tbefore any unauthenticated data is written to stdout. A key can be generated with \"head -c 32 /dev/urandom > key\".\n" \
+				"\t* \"--verify\" has to be given the seed that the sender used with \"--generate\". The first byte that doesn't match makes\n" \
+				"\tnc exit with a failure code and its offset is printed. With \"-k\", every connection starts the payload over.\n" \
+				"\t* \"--replay\" works with recordings from either side of a connection, it always sends what the connecting side sent.\n" \
+				"\t* Rotated \"--output\" files are synced and atomically renamed to <path>.<UTC start time>.<n>.\n" \
+				"\t* Rate limits apply to the whole process. With \"-k\", connections are handled one at a time and share the limits.\n" \
+				"\t* Transfer statistics can be printed at any time (even without \"-v\") by sending SIGUSR1 to nc (not on Windows).\n";
 
 template <size_t length>
 struct meta_string {
@@ -122,6 +211,75 @@ namespace flags {
 	bool shouldUseUDP = false;
 
 	bool allowBroadcast = false;
+
+	bool shouldChecksum = false;
+
+	bool shouldHexDump = false;
+	const char* hexDumpFile = nullptr;
+
+	bool shouldTranslateLFToCRLF = false;
+	bool shouldStripCRLF = false;
+
+	const char* preSharedKeyFile = nullptr;
+
+	uint64_t sendRateLimit = 0;
+	uint64_t receiveRateLimit = 0;
+
+	bool shouldPrintStats = false;
+	bool shouldPrintStatsAsJSON = false;
+
+	bool shouldReportProgress = false;
+
+	const char* metricsAddress = nullptr;
+	uint16_t metricsPort = 0;
+
+	uint32_t tcpInfoInterval = 0;
+
+	bool shouldExplainSlowness = false;
+
+	const char* latencyHistogramFile = nullptr;
+
+	const char* traceFile = nullptr;
+
+	bool shouldReportTiming = false;
+
+	bool shouldCountPerfEvents = false;
+
+	bool shouldGeneratePayload = false;
+	uint64_t generateSeed = 0;
+	uint64_t generateSize = 0;		// NOTE: 0 means endless.
+
+	bool shouldVerifyPayload = false;
+	uint64_t verifySeed = 0;
+
+	const char* recordFile = nullptr;
+
+	const char* replayFile = nullptr;
+	bool isReplaySpeedSet = false;
+	uint64_t replaySpeed = 1;		// NOTE: 0 means as fast as possible.
+
+	const char* pcapPrefix = nullptr;
+	uint64_t pcapFileSize = 0;		// NOTE: 0 means the default.
+	uint32_t pcapFileCount = 0;		// NOTE: 0 means the default.
+
+	const char* outputPath = nullptr;
+	uint64_t rotateSize = 0;
+	uint32_t rotateInterval = 0;
+
+	uint64_t spillMemoryLimit = 0;
+	const char* spillDirectory = nullptr;
+
+	const char* teePaths[tee_output_max_files];
+	uint8_t teeFileCount = 0;
+
+	const char* filterSpecs[filter_plugins_max_filters];
+	uint8_t filterCount = 0;
+
+	unsigned char untilPattern[pattern_search_max_length];
+	size_t untilPatternLength = 0;
+	uint64_t receiveCount = 0;
+
+	uint16_t datagramSize = 0;
 }
 
 uint16_t parsePort(const char* portString_raw) noexcept {
@@ -173,6 +331,246 @@ int parseBacklog(const char* backlogString_raw) noexcept {
 	return result;
 }
 
+// NOTE: Rates are capped so that the token bucket math can't overflow. Nobody is going to want to limit to more than a TiB/s anyway.
+constexpr uint64_t max_rate_limit = (uint64_t)1 << 40;
+
+uint64_t parseRate(const char* rateString_raw) noexcept {
+	if (rateString_raw[0] == '\0') { REPORT_ERROR_AND_EXIT("rate input string cannot be empty", EXIT_SUCCESS); }
+
+	// NOTE: WE AVOID SIGNED OVERFLOW SINCE THAT'S UNDEFINED BEHAVIOR
+	const unsigned char* rateString = (const unsigned char*)rateString_raw;
+
+	uint64_t result = rateString[0] - '0';
+	if (result > 9) { REPORT_ERROR_AND_EXIT("rate input string is invalid", EXIT_SUCCESS); }
+
+	size_t i = 1;
+	for (; rateString[i] != '\0'; i++) {
+		unsigned char digit = rateString[i] - '0';
+		if (digit > 9) { break; }
+
+		result = result * 10 + digit;
+		if (result > max_rate_limit) { REPORT_ERROR_AND_EXIT("rate input value too large", EXIT_SUCCESS); }
+	}
+
+	uint8_t shift = 0;
+	switch (rateString[i]) {
+	case '\0': break;
+	case 'k': case 'K': shift = 10; break;
+	case 'm': case 'M': shift = 20; break;
+	case 'g': case 'G': shift = 30; break;
+	default: REPORT_ERROR_AND_EXIT("rate input string is invalid", EXIT_SUCCESS);
+	}
+	if (shift != 0 && rateString[i + 1] != '\0') { REPORT_ERROR_AND_EXIT("rate input string is invalid", EXIT_SUCCESS); }
+
+	if (result > (max_rate_limit >> shift)) { REPORT_ERROR_AND_EXIT("rate input value too large", EXIT_SUCCESS); }
+	result <<= shift;
+
+	if (result == 0) { REPORT_ERROR_AND_EXIT("rate input value cannot be 0", EXIT_SUCCESS); }
+
+	return result;
+}
+
+// NOTE: An hour is already a ridiculous sampling interval, anything above that is almost certainly a typo.
+constexpr uint32_t max_interval = 60 * 60 * 1000;
+
+uint32_t parseInterval(const char* intervalString_raw) noexcept {
+	if (intervalString_raw[0] == '\0') { REPORT_ERROR_AND_EXIT("interval input string cannot be empty", EXIT_SUCCESS); }
+
+	// NOTE: WE AVOID SIGNED OVERFLOW SINCE THAT'S UNDEFINED BEHAVIOR
+	const unsigned char* intervalString = (const unsigned char*)intervalString_raw;
+
+	uint32_t result = intervalString[0] - '0';
+	if (result > 9) { REPORT_ERROR_AND_EXIT("interval input string is invalid", EXIT_SUCCESS); }
+
+	for (size_t i = 1; intervalString[i] != '\0'; i++) {
+		unsigned char digit = intervalString[i] - '0';
+		if (digit > 9) { REPORT_ERROR_AND_EXIT("interval input string is invalid", EXIT_SUCCESS); }
+
+		result = result * 10 + digit;
+		if (result > max_interval) { REPORT_ERROR_AND_EXIT("interval input value too large", EXIT_SUCCESS); }
+	}
+
+	if (result == 0) { REPORT_ERROR_AND_EXIT("interval input value cannot be 0", EXIT_SUCCESS); }
+
+	return result;
+}
+
+uint64_t parseSeed(const char* seedString_raw) noexcept {
+	if (seedString_raw[0] == '\0') { REPORT_ERROR_AND_EXIT("seed input string cannot be empty", EXIT_SUCCESS); }
+
+	// NOTE: WE AVOID SIGNED OVERFLOW SINCE THAT'S UNDEFINED BEHAVIOR
+	const unsigned char* seedString = (const unsigned char*)seedString_raw;
+
+	uint64_t result = seedString[0] - '0';
+	if (result > 9) { REPORT_ERROR_AND_EXIT("seed input string is invalid", EXIT_SUCCESS); }
+
+	for (size_t i = 1; seedString[i] != '\0'; i++) {
+		unsigned char digit = seedString[i] - '0';
+		if (digit > 9) { REPORT_ERROR_AND_EXIT("seed input string is invalid", EXIT_SUCCESS); }
+
+		if (result > (std::numeric_limits<uint64_t>::max() - digit) / 10) { REPORT_ERROR_AND_EXIT("seed input value too large", EXIT_SUCCESS); }
+		result = result * 10 + digit;
+	}
+
+	return result;
+}
+
+// NOTE: An exbibyte takes years even at 100Gbit/s, anything above that is almost certainly a typo.
+constexpr uint64_t max_payload_size = (uint64_t)1 << 60;
+
+uint64_t parseSize(const char* sizeString_raw) noexcept {
+	if (sizeString_raw[0] == '\0') { REPORT_ERROR_AND_EXIT("size input string cannot be empty", EXIT_SUCCESS); }
+
+	// NOTE: WE AVOID SIGNED OVERFLOW SINCE THAT'S UNDEFINED BEHAVIOR
+	const unsigned char* sizeString = (const unsigned char*)sizeString_raw;
+
+	uint64_t result = sizeString[0] - '0';
+	if (result > 9) { REPORT_ERROR_AND_EXIT("size input string is invalid", EXIT_SUCCESS); }
+
+	size_t i = 1;
+	for (; sizeString[i] != '\0'; i++) {
+		unsigned char digit = sizeString[i] - '0';
+		if (digit > 9) { break; }
+
+		result = result * 10 + digit;
+		if (result > max_payload_size) { REPORT_ERROR_AND_EXIT("size input value too large", EXIT_SUCCESS); }
+	}
+
+	uint8_t shift = 0;
+	switch (sizeString[i]) {
+	case '\0': break;
+	case 'k': case 'K': shift = 10; break;
+	case 'm': case 'M': shift = 20; break;
+	case 'g': case 'G': shift = 30; break;
+	case 't': case 'T': shift = 40; break;
+	default: REPORT_ERROR_AND_EXIT("size input string is invalid", EXIT_SUCCESS);
+	}
+	if (shift != 0 && sizeString[i + 1] != '\0') { REPORT_ERROR_AND_EXIT("size input string is invalid", EXIT_SUCCESS); }
+
+	if (result > (max_payload_size >> shift)) { REPORT_ERROR_AND_EXIT("size input value too large", EXIT_SUCCESS); }
+	result <<= shift;
+
+	if (result == 0) { REPORT_ERROR_AND_EXIT("size input value cannot be 0", EXIT_SUCCESS); }
+
+	return result;
+}
+
+// NOTE: A million times faster turns hours into milliseconds, which is as good as "max" anyway.
+constexpr uint64_t max_replay_speed = 1000000;
+
+uint64_t parseReplaySpeed(const char* speedString_raw) noexcept {
+	if (std::strcmp(speedString_raw, "max") == 0) { return 0; }
+
+	if (speedString_raw[0] == '\0') { REPORT_ERROR_AND_EXIT("replay speed input string cannot be empty", EXIT_SUCCESS); }
+
+	// NOTE: WE AVOID SIGNED OVERFLOW SINCE THAT'S UNDEFINED BEHAVIOR
+	const unsigned char* speedString = (const unsigned char*)speedString_raw;
+
+	uint64_t result = speedString[0] - '0';
+	if (result > 9) { REPORT_ERROR_AND_EXIT("replay speed input string is invalid", EXIT_SUCCESS); }
+
+	for (size_t i = 1; speedString[i] != '\0'; i++) {
+		unsigned char digit = speedString[i] - '0';
+		if (digit > 9) { REPORT_ERROR_AND_EXIT("replay speed input string is invalid", EXIT_SUCCESS); }
+
+		result = result * 10 + digit;
+		if (result > max_replay_speed) { REPORT_ERROR_AND_EXIT("replay speed input value too large", EXIT_SUCCESS); }
+	}
+
+	if (result == 0) { REPORT_ERROR_AND_EXIT("replay speed input value cannot be 0", EXIT_SUCCESS); }
+
+	return result;
+}
+
+constexpr uint64_t default_pcap_file_size = 64 * 1024 * 1024;
+constexpr uint32_t default_pcap_file_count = 8;
+constexpr uint32_t max_pcap_file_count = 100000;
+
+uint32_t parseFileCount(const char* countString_raw) noexcept {
+	if (countString_raw[0] == '\0') { REPORT_ERROR_AND_EXIT("file count input string cannot be empty", EXIT_SUCCESS); }
+
+	// NOTE: WE AVOID SIGNED OVERFLOW SINCE THAT'S UNDEFINED BEHAVIOR
+	const unsigned char* countString = (const unsigned char*)countString_raw;
+
+	uint32_t result = countString[0] - '0';
+	if (result > 9) { REPORT_ERROR_AND_EXIT("file count input string is invalid", EXIT_SUCCESS); }
+
+	for (size_t i = 1; countString[i] != '\0'; i++) {
+		unsigned char digit = countString[i] - '0';
+		if (digit > 9) { REPORT_ERROR_AND_EXIT("file count input string is invalid", EXIT_SUCCESS); }
+
+		result = result * 10 + digit;
+		if (result > max_pcap_file_count) { REPORT_ERROR_AND_EXIT("file count input value too large", EXIT_SUCCESS); }
+	}
+
+	if (result == 0) { REPORT_ERROR_AND_EXIT("file count input value cannot be 0", EXIT_SUCCESS); }
+
+	return result;
+}
+
+uint8_t parseHexDigit(unsigned char character) noexcept {
+	if (character >= '0' && character <= '9') { return character - '0'; }
+	character |= 0x20;	// NOTE: Makes letters lowercase.
+	if (character < 'a' || character > 'f') { REPORT_ERROR_AND_EXIT("pattern input string has an invalid \"\\x\" escape", EXIT_SUCCESS); }
+	return character - 'a' + 10;
+}
+
+// NOTE: Terminators are mostly line endings, which are a pain to pass in through a shell, hence the escapes.
+void parseUntilPattern(const char* patternString_raw) noexcept {
+	if (patternString_raw[0] == '\0') { REPORT_ERROR_AND_EXIT("pattern input string cannot be empty", EXIT_SUCCESS); }
+
+	const unsigned char* patternString = (const unsigned char*)patternString_raw;
+	for (size_t i = 0; patternString[i] != '\0'; i++) {
+		if (flags::untilPatternLength == pattern_search_max_length) { REPORT_ERROR_AND_EXIT("pattern input value too long (max is 256 bytes)", EXIT_SUCCESS); }
+
+		unsigned char character = patternString[i];
+		if (character == '\\') {
+			switch (patternString[++i]) {
+			case 'r': character = '\r'; break;
+			case 'n': character = '\n'; break;
+			case 't': character = '\t'; break;
+			case '\\': character = '\\'; break;
+			case 'x':
+				// NOTE: If the first digit is the terminator, the second one is never looked at.
+				character = parseHexDigit(patternString[i + 1]) << 4;
+				character |= parseHexDigit(patternString[i + 2]);
+				i += 2;
+				break;
+			default: REPORT_ERROR_AND_EXIT("pattern input string has an invalid escape", EXIT_SUCCESS);
+			}
+		}
+		flags::untilPattern[flags::untilPatternLength++] = character;
+	}
+}
+
+// NOTE: The most an IPv4 UDP datagram can carry (65535 minus the IP and UDP headers).
+constexpr uint64_t max_udp_datagram_size = 65507;
+
+// NOTE: A month is already a long time for a single file, anything above that is almost certainly a typo.
+constexpr uint32_t max_rotate_interval = 31 * 24 * 60 * 60;
+
+uint32_t parseRotateInterval(const char* intervalString_raw) noexcept {
+	if (intervalString_raw[0] == '\0') { REPORT_ERROR_AND_EXIT("rotate interval input string cannot be empty", EXIT_SUCCESS); }
+
+	// NOTE: WE AVOID SIGNED OVERFLOW SINCE THAT'S UNDEFINED BEHAVIOR
+	const unsigned char* intervalString = (const unsigned char*)intervalString_raw;
+
+	uint32_t result = intervalString[0] - '0';
+	if (result > 9) { REPORT_ERROR_AND_EXIT("rotate interval input string is invalid", EXIT_SUCCESS); }
+
+	for (size_t i = 1; intervalString[i] != '\0'; i++) {
+		unsigned char digit = intervalString[i] - '0';
+		if (digit > 9) { REPORT_ERROR_AND_EXIT("rotate interval input string is invalid", EXIT_SUCCESS); }
+
+		result = result * 10 + digit;
+		if (result > max_rotate_interval) { REPORT_ERROR_AND_EXIT("rotate interval input value too large", EXIT_SUCCESS); }
+	}
+
+	if (result == 0) { REPORT_ERROR_AND_EXIT("rotate interval input value cannot be 0", EXIT_SUCCESS); }
+
+	return result;
+}
+
 void parseLetterFlags(const char* flagContent) noexcept {
 	for (size_t i = 0; flagContent[i] != '\0'; i++) {
 		switch (flagContent[i]) {
@@ -212,6 +610,24 @@ void parseLetterFlags(const char* flagContent) noexcept {
 				}
 				flags::allowBroadcast = true;
 				continue;
+			case 'x':
+				if (flags::shouldHexDump) {
+					REPORT_ERROR_AND_EXIT("\"-x\" flag specified more than once", EXIT_SUCCESS);
+				}
+				flags::shouldHexDump = true;
+				continue;
+			case 'C':
+				if (flags::shouldTranslateLFToCRLF) {
+					REPORT_ERROR_AND_EXIT("\"-C\" flag specified more than once", EXIT_SUCCESS);
+				}
+				flags::shouldTranslateLFToCRLF = true;
+				continue;
+			case 'v':
+				if (flags::shouldPrintStats) {
+					REPORT_ERROR_AND_EXIT("\"-v\" flag specified more than once", EXIT_SUCCESS);
+				}
+				flags::shouldPrintStats = true;
+				continue;
 			default: REPORT_ERROR_AND_EXIT("one or more invalid flags specified", EXIT_SUCCESS);
 		}
 	}
@@ -223,6 +639,11 @@ void validateFlagRelationships() noexcept {
 
 		if (flags::shouldKeepListening) {
 			if (flags::shouldUseUDP) { REPORT_ERROR_AND_EXIT("\"-k\" cannot be specified with \"-u\"", EXIT_SUCCESS); }
+			// NOTE: A recording is one session, there's no way to tell the connections apart in it.
+			if (flags::recordFile) { REPORT_ERROR_AND_EXIT("\"--record\" cannot be specified with \"-k\"", EXIT_SUCCESS); }
+			// NOTE: Both of them end nc, not just the connection.
+			if (flags::untilPatternLength != 0) { REPORT_ERROR_AND_EXIT("\"--until\" cannot be specified with \"-k\"", EXIT_SUCCESS); }
+			if (flags::receiveCount != 0) { REPORT_ERROR_AND_EXIT("\"--count\" cannot be specified with \"-k\"", EXIT_SUCCESS); }
 		} else {
 			if (flags::backlog != -1) { REPORT_ERROR_AND_EXIT("\"--backlog\" cannot be specified without \"-k\"", EXIT_SUCCESS); }
 		}
@@ -230,14 +651,96 @@ void validateFlagRelationships() noexcept {
 		if (flags::sourceIP) { REPORT_ERROR_AND_EXIT("\"--source\" may not be used when listening", EXIT_SUCCESS); }
 
 		if (flags::sourcePort != 0) { REPORT_ERROR_AND_EXIT("\"--port\" may not be used when listening unless the specified source port is 0", EXIT_SUCCESS); }
+
+		if (flags::replayFile) { REPORT_ERROR_AND_EXIT("\"--replay\" may not be used when listening", EXIT_SUCCESS); }
 	} else {
 		if (flags::shouldKeepListening) { REPORT_ERROR_AND_EXIT("\"-k\" cannot be specified without \"-l\"", EXIT_SUCCESS); }
+		if (flags::metricsAddress) { REPORT_ERROR_AND_EXIT("\"--metrics\" cannot be specified without \"-l\"", EXIT_SUCCESS); }
+		// NOTE: A UDP sender doesn't receive anything.
+		if (flags::shouldUseUDP && flags::untilPatternLength != 0) { REPORT_ERROR_AND_EXIT("\"--until\" cannot be specified with \"-u\" unless listening", EXIT_SUCCESS); }
+		if (flags::shouldUseUDP && flags::receiveCount != 0) { REPORT_ERROR_AND_EXIT("\"--count\" cannot be specified with \"-u\" unless listening", EXIT_SUCCESS); }
+	}
+
+	if (!flags::shouldUseUDP || flags::shouldListen) {
+		if (flags::datagramSize != 0) { REPORT_ERROR_AND_EXIT("\"--datagram-size\" is only allowed when sending UDP packets", EXIT_SUCCESS); }
 	}
 
 	if (!flags::shouldUseUDP) {
 		if (flags::allowBroadcast) { REPORT_ERROR_AND_EXIT("broadcast is only allowed when sending UDP packets", EXIT_SUCCESS); }
 	}
 
+	if (flags::shouldUseUDP) {
+		if (flags::shouldChecksum) { REPORT_ERROR_AND_EXIT("\"--checksum\" cannot be specified with \"-u\"", EXIT_SUCCESS); }
+		if (flags::shouldTranslateLFToCRLF) { REPORT_ERROR_AND_EXIT("\"-C\" cannot be specified with \"-u\"", EXIT_SUCCESS); }
+		if (flags::shouldStripCRLF) { REPORT_ERROR_AND_EXIT("\"--strip-crlf\" cannot be specified with \"-u\"", EXIT_SUCCESS); }
+		if (flags::preSharedKeyFile) { REPORT_ERROR_AND_EXIT("\"--psk\" cannot be specified with \"-u\"", EXIT_SUCCESS); }
+		if (flags::tcpInfoInterval != 0) { REPORT_ERROR_AND_EXIT("\"--tcp-info\" cannot be specified with \"-u\"", EXIT_SUCCESS); }
+		// NOTE: Datagrams can get lost or reordered, so a UDP receiver can't expect the payload to line up.
+		if (flags::shouldVerifyPayload) { REPORT_ERROR_AND_EXIT("\"--verify\" cannot be specified with \"-u\"", EXIT_SUCCESS); }
+		if (flags::recordFile) { REPORT_ERROR_AND_EXIT("\"--record\" cannot be specified with \"-u\"", EXIT_SUCCESS); }
+		if (flags::replayFile) { REPORT_ERROR_AND_EXIT("\"--replay\" cannot be specified with \"-u\"", EXIT_SUCCESS); }
+		// NOTE: A filter could change the size of a datagram, which doesn't go well with the MSS discovery.
+		if (flags::filterCount != 0) { REPORT_ERROR_AND_EXIT("\"--filter\" cannot be specified with \"-u\"", EXIT_SUCCESS); }
+	}
+
+	if (flags::replayFile) {
+		if (flags::shouldGeneratePayload) { REPORT_ERROR_AND_EXIT("\"--replay\" cannot be specified with \"--generate\"", EXIT_SUCCESS); }
+		// NOTE: The recording has the data as it went over the connection, so it's already translated.
+		if (flags::shouldTranslateLFToCRLF) { REPORT_ERROR_AND_EXIT("\"--replay\" cannot be specified with \"-C\"", EXIT_SUCCESS); }
+	} else {
+		if (flags::isReplaySpeedSet) { REPORT_ERROR_AND_EXIT("\"--replay-speed\" cannot be specified without \"--replay\"", EXIT_SUCCESS); }
+	}
+
+#ifdef PLATFORM_WINDOWS
+	if (flags::tcpInfoInterval != 0) { REPORT_ERROR_AND_EXIT("\"--tcp-info\" isn't supported on Windows", EXIT_SUCCESS); }
+	if (flags::shouldCountPerfEvents) { REPORT_ERROR_AND_EXIT("\"--perf\" isn't supported on Windows", EXIT_SUCCESS); }
+	if (flags::pcapPrefix) { REPORT_ERROR_AND_EXIT("\"--pcap\" isn't supported on Windows", EXIT_SUCCESS); }
+	if (flags::outputPath) { REPORT_ERROR_AND_EXIT("\"--output\" isn't supported on Windows", EXIT_SUCCESS); }
+	if (flags::spillMemoryLimit != 0) { REPORT_ERROR_AND_EXIT("\"--spill\" isn't supported on Windows", EXIT_SUCCESS); }
+	if (flags::filterCount != 0) { REPORT_ERROR_AND_EXIT("\"--filter\" isn't supported on Windows", EXIT_SUCCESS); }
+#endif
+
+	if (flags::pcapPrefix) {
+		if (!flags::shouldListen || !flags::shouldUseUDP) { REPORT_ERROR_AND_EXIT("\"--pcap\" is only valid with \"-lu\"", EXIT_SUCCESS); }
+		if (flags::pcapFileSize == 0) { flags::pcapFileSize = default_pcap_file_size; }
+		if (flags::pcapFileSize < pcap_min_file_size) { REPORT_ERROR_AND_EXIT("\"--pcap-file-size\" is too small to hold a maximum-size packet", EXIT_SUCCESS); }
+		if (flags::pcapFileCount == 0) { flags::pcapFileCount = default_pcap_file_count; }
+	} else {
+		if (flags::pcapFileSize != 0) { REPORT_ERROR_AND_EXIT("\"--pcap-file-size\" cannot be specified without \"--pcap\"", EXIT_SUCCESS); }
+		if (flags::pcapFileCount != 0) { REPORT_ERROR_AND_EXIT("\"--pcap-files\" cannot be specified without \"--pcap\"", EXIT_SUCCESS); }
+	}
+
+	if (flags::outputPath) {
+		if (flags::shouldVerifyPayload) { REPORT_ERROR_AND_EXIT("\"--output\" cannot be specified with \"--verify\"", EXIT_SUCCESS); }
+	} else {
+		if (flags::rotateSize != 0) { REPORT_ERROR_AND_EXIT("\"--rotate-size\" cannot be specified without \"--output\"", EXIT_SUCCESS); }
+		if (flags::rotateInterval != 0) { REPORT_ERROR_AND_EXIT("\"--rotate-interval\" cannot be specified without \"--output\"", EXIT_SUCCESS); }
+	}
+
+	// NOTE: Stopping early would mean stopping before the checksum, which would make it pointless.
+	if (flags::shouldChecksum) {
+		if (flags::untilPatternLength != 0) { REPORT_ERROR_AND_EXIT("\"--until\" cannot be specified with \"--checksum\"", EXIT_SUCCESS); }
+		if (flags::receiveCount != 0) { REPORT_ERROR_AND_EXIT("\"--count\" cannot be specified with \"--checksum\"", EXIT_SUCCESS); }
+	}
+
+	if (flags::teeFileCount != 0) {
+		if (flags::shouldVerifyPayload) { REPORT_ERROR_AND_EXIT("\"--tee\" cannot be specified with \"--verify\"", EXIT_SUCCESS); }
+	}
+
+	if (flags::spillMemoryLimit != 0) {
+		if (flags::spillMemoryLimit < spill_min_memory_limit) { REPORT_ERROR_AND_EXIT("\"--spill\" needs a memory limit of at least 2M", EXIT_SUCCESS); }
+	} else {
+		if (flags::spillDirectory) { REPORT_ERROR_AND_EXIT("\"--spill-dir\" cannot be specified without \"--spill\"", EXIT_SUCCESS); }
+	}
+
+	if (!flags::shouldGeneratePayload) {
+		if (flags::generateSize != 0) { REPORT_ERROR_AND_EXIT("\"--generate-size\" cannot be specified without \"--generate\"", EXIT_SUCCESS); }
+	}
+
+	if (!flags::shouldHexDump) {
+		if (flags::hexDumpFile) { REPORT_ERROR_AND_EXIT("\"--hexdump-file\" cannot be specified without \"-x\"", EXIT_SUCCESS); }
+	}
+
 	if (!flags::sourceIP) {
 		if (flags::sourcePort != 0) { REPORT_ERROR_AND_EXIT("\"--port\" cannot be specified without \"--source\" unless the specified source port is 0", EXIT_SUCCESS); }
 	}
@@ -273,6 +776,246 @@ void manageArgs(int argc, const char* const * argv) noexcept {
 						flags::backlog = parseBacklog(argv[i]);
 						continue;
 					}
+					if (std::strcmp(flagContent, "checksum") == 0) {
+						if (flags::shouldChecksum) { REPORT_ERROR_AND_EXIT("\"--checksum\" cannot be specified more than once", EXIT_SUCCESS); }
+						flags::shouldChecksum = true;
+						continue;
+					}
+					if (std::strcmp(flagContent, "hexdump-file") == 0) {
+						if (flags::hexDumpFile != nullptr) { REPORT_ERROR_AND_EXIT("\"--hexdump-file\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--hexdump-file\" requires an input value", EXIT_SUCCESS); }
+						flags::hexDumpFile = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "strip-crlf") == 0) {
+						if (flags::shouldStripCRLF) { REPORT_ERROR_AND_EXIT("\"--strip-crlf\" cannot be specified more than once", EXIT_SUCCESS); }
+						flags::shouldStripCRLF = true;
+						continue;
+					}
+					if (std::strcmp(flagContent, "psk") == 0) {
+						if (flags::preSharedKeyFile != nullptr) { REPORT_ERROR_AND_EXIT("\"--psk\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--psk\" requires an input value", EXIT_SUCCESS); }
+						flags::preSharedKeyFile = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "limit-rate") == 0) {
+						if (flags::sendRateLimit != 0 || flags::receiveRateLimit != 0) {
+							REPORT_ERROR_AND_EXIT("\"--limit-rate\" cannot be specified more than once or together with \"--limit-send\" or \"--limit-receive\"", EXIT_SUCCESS);
+						}
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--limit-rate\" requires an input value", EXIT_SUCCESS); }
+						flags::sendRateLimit = parseRate(argv[i]);
+						flags::receiveRateLimit = flags::sendRateLimit;
+						continue;
+					}
+					if (std::strcmp(flagContent, "limit-send") == 0) {
+						if (flags::sendRateLimit != 0) { REPORT_ERROR_AND_EXIT("\"--limit-send\" cannot be specified more than once or together with \"--limit-rate\"", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--limit-send\" requires an input value", EXIT_SUCCESS); }
+						flags::sendRateLimit = parseRate(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "limit-receive") == 0) {
+						if (flags::receiveRateLimit != 0) { REPORT_ERROR_AND_EXIT("\"--limit-receive\" cannot be specified more than once or together with \"--limit-rate\"", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--limit-receive\" requires an input value", EXIT_SUCCESS); }
+						flags::receiveRateLimit = parseRate(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "stats-json") == 0) {
+						if (flags::shouldPrintStatsAsJSON) { REPORT_ERROR_AND_EXIT("\"--stats-json\" cannot be specified more than once", EXIT_SUCCESS); }
+						flags::shouldPrintStatsAsJSON = true;
+						continue;
+					}
+					if (std::strcmp(flagContent, "progress") == 0) {
+						if (flags::shouldReportProgress) { REPORT_ERROR_AND_EXIT("\"--progress\" cannot be specified more than once", EXIT_SUCCESS); }
+						flags::shouldReportProgress = true;
+						continue;
+					}
+					if (std::strcmp(flagContent, "metrics") == 0) {
+						if (flags::metricsAddress != nullptr) { REPORT_ERROR_AND_EXIT("\"--metrics\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--metrics\" requires an input value", EXIT_SUCCESS); }
+						flags::metricsAddress = argv[i];
+						if (metrics_address_is_port(flags::metricsAddress)) { flags::metricsPort = parsePort(flags::metricsAddress); }
+						continue;
+					}
+					if (std::strcmp(flagContent, "tcp-info") == 0) {
+						if (flags::tcpInfoInterval != 0) { REPORT_ERROR_AND_EXIT("\"--tcp-info\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--tcp-info\" requires an input value", EXIT_SUCCESS); }
+						flags::tcpInfoInterval = parseInterval(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "why-slow") == 0) {
+						if (flags::shouldExplainSlowness) { REPORT_ERROR_AND_EXIT("\"--why-slow\" cannot be specified more than once", EXIT_SUCCESS); }
+						flags::shouldExplainSlowness = true;
+						continue;
+					}
+					if (std::strcmp(flagContent, "histograms") == 0) {
+						if (flags::latencyHistogramFile != nullptr) { REPORT_ERROR_AND_EXIT("\"--histograms\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--histograms\" requires an input value", EXIT_SUCCESS); }
+						flags::latencyHistogramFile = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "trace") == 0) {
+						if (flags::traceFile != nullptr) { REPORT_ERROR_AND_EXIT("\"--trace\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--trace\" requires an input value", EXIT_SUCCESS); }
+						flags::traceFile = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "timing") == 0) {
+						if (flags::shouldReportTiming) { REPORT_ERROR_AND_EXIT("\"--timing\" cannot be specified more than once", EXIT_SUCCESS); }
+						flags::shouldReportTiming = true;
+						continue;
+					}
+					if (std::strcmp(flagContent, "perf") == 0) {
+						if (flags::shouldCountPerfEvents) { REPORT_ERROR_AND_EXIT("\"--perf\" cannot be specified more than once", EXIT_SUCCESS); }
+						flags::shouldCountPerfEvents = true;
+						continue;
+					}
+					if (std::strcmp(flagContent, "generate") == 0) {
+						if (flags::shouldGeneratePayload) { REPORT_ERROR_AND_EXIT("\"--generate\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--generate\" requires an input value", EXIT_SUCCESS); }
+						flags::shouldGeneratePayload = true;
+						flags::generateSeed = parseSeed(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "generate-size") == 0) {
+						if (flags::generateSize != 0) { REPORT_ERROR_AND_EXIT("\"--generate-size\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--generate-size\" requires an input value", EXIT_SUCCESS); }
+						flags::generateSize = parseSize(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "verify") == 0) {
+						if (flags::shouldVerifyPayload) { REPORT_ERROR_AND_EXIT("\"--verify\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--verify\" requires an input value", EXIT_SUCCESS); }
+						flags::shouldVerifyPayload = true;
+						flags::verifySeed = parseSeed(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "record") == 0) {
+						if (flags::recordFile != nullptr) { REPORT_ERROR_AND_EXIT("\"--record\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--record\" requires an input value", EXIT_SUCCESS); }
+						flags::recordFile = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "replay") == 0) {
+						if (flags::replayFile != nullptr) { REPORT_ERROR_AND_EXIT("\"--replay\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--replay\" requires an input value", EXIT_SUCCESS); }
+						flags::replayFile = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "replay-speed") == 0) {
+						if (flags::isReplaySpeedSet) { REPORT_ERROR_AND_EXIT("\"--replay-speed\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--replay-speed\" requires an input value", EXIT_SUCCESS); }
+						flags::isReplaySpeedSet = true;
+						flags::replaySpeed = parseReplaySpeed(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "pcap") == 0) {
+						if (flags::pcapPrefix != nullptr) { REPORT_ERROR_AND_EXIT("\"--pcap\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--pcap\" requires an input value", EXIT_SUCCESS); }
+						flags::pcapPrefix = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "pcap-file-size") == 0) {
+						if (flags::pcapFileSize != 0) { REPORT_ERROR_AND_EXIT("\"--pcap-file-size\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--pcap-file-size\" requires an input value", EXIT_SUCCESS); }
+						flags::pcapFileSize = parseSize(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "pcap-files") == 0) {
+						if (flags::pcapFileCount != 0) { REPORT_ERROR_AND_EXIT("\"--pcap-files\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--pcap-files\" requires an input value", EXIT_SUCCESS); }
+						flags::pcapFileCount = parseFileCount(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "output") == 0) {
+						if (flags::outputPath != nullptr) { REPORT_ERROR_AND_EXIT("\"--output\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--output\" requires an input value", EXIT_SUCCESS); }
+						flags::outputPath = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "rotate-size") == 0) {
+						if (flags::rotateSize != 0) { REPORT_ERROR_AND_EXIT("\"--rotate-size\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--rotate-size\" requires an input value", EXIT_SUCCESS); }
+						flags::rotateSize = parseSize(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "rotate-interval") == 0) {
+						if (flags::rotateInterval != 0) { REPORT_ERROR_AND_EXIT("\"--rotate-interval\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--rotate-interval\" requires an input value", EXIT_SUCCESS); }
+						flags::rotateInterval = parseRotateInterval(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "spill") == 0) {
+						if (flags::spillMemoryLimit != 0) { REPORT_ERROR_AND_EXIT("\"--spill\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--spill\" requires an input value", EXIT_SUCCESS); }
+						flags::spillMemoryLimit = parseSize(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "spill-dir") == 0) {
+						if (flags::spillDirectory != nullptr) { REPORT_ERROR_AND_EXIT("\"--spill-dir\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--spill-dir\" requires an input value", EXIT_SUCCESS); }
+						flags::spillDirectory = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "tee") == 0) {
+						if (flags::teeFileCount == tee_output_max_files) { REPORT_ERROR_AND_EXIT("\"--tee\" cannot be specified more than 16 times", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--tee\" requires an input value", EXIT_SUCCESS); }
+						flags::teePaths[flags::teeFileCount++] = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "until") == 0) {
+						if (flags::untilPatternLength != 0) { REPORT_ERROR_AND_EXIT("\"--until\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--until\" requires an input value", EXIT_SUCCESS); }
+						parseUntilPattern(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "count") == 0) {
+						if (flags::receiveCount != 0) { REPORT_ERROR_AND_EXIT("\"--count\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--count\" requires an input value", EXIT_SUCCESS); }
+						flags::receiveCount = parseSize(argv[i]);
+						continue;
+					}
+					if (std::strcmp(flagContent, "filter") == 0) {
+						if (flags::filterCount == filter_plugins_max_filters) { REPORT_ERROR_AND_EXIT("\"--filter\" cannot be specified more than 8 times", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--filter\" requires an input value", EXIT_SUCCESS); }
+						flags::filterSpecs[flags::filterCount++] = argv[i];
+						continue;
+					}
+					if (std::strcmp(flagContent, "datagram-size") == 0) {
+						if (flags::datagramSize != 0) { REPORT_ERROR_AND_EXIT("\"--datagram-size\" cannot be specified more than once", EXIT_SUCCESS); }
+						i++;
+						if (i == argc) { REPORT_ERROR_AND_EXIT("\"--datagram-size\" requires an input value", EXIT_SUCCESS); }
+						uint64_t datagramSize = parseSize(argv[i]);
+						if (datagramSize > max_udp_datagram_size) { REPORT_ERROR_AND_EXIT("\"--datagram-size\" can't be bigger than 65507", EXIT_SUCCESS); }
+						flags::datagramSize = datagramSize;
+						continue;
+					}
 					if (std::strcmp(flagContent, "help") == 0) {
 						if (argc != 2) { REPORT_ERROR_AND_EXIT("use of \"--help\" flag with other args is illegal", EXIT_SUCCESS); }
 						static constexpr auto helpText = construct_help_text();
@@ -304,6 +1047,232 @@ void manageArgs(int argc, const char* const * argv) noexcept {
 
 // MAIN LOGIC START ------------------------------------------------------------
 
+// NOTE: These live for the whole process, so "-k" connections share them.
+// NOTE: Each one is only ever used by one thread at a time (the sending one or the receiving one).
+token_bucket_t sendRateLimiter;
+token_bucket_t receiveRateLimiter;
+
+// NOTE: Same as the rate limiters, each one is only ever used by one thread at a time. They're reseeded for every connection.
+payload_generator_t payloadGenerator;
+payload_generator_t payloadVerifier;
+
+// NOTE: The generated payload stands in for stdin and the verifier stands in for stdout, so they're counted as such in
+// the statistics (they're the producer and the consumer as far as "--why-slow" is concerned).
+void verify_payload(const void* buffer, size_t size) noexcept {
+	uint64_t verifyStart = transfer_stats_now();
+	uint64_t offset = payloadVerifier.position;
+	size_t matchingBytes = payload_generator_find_mismatch(payloadVerifier, buffer, size);
+	if (matchingBytes != size) {
+		signal_safe_text_t text;
+		text.append("ERROR: payload verification failed, first mismatch at byte offset ");
+		text.append_unsigned(offset + matchingBytes);
+		text.append("\n");
+		crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+		halt_program(EXIT_FAILURE);
+	}
+	transfer_stats_record(TransferOperation::STDOUT_WRITE, verifyStart, transfer_stats_now(), size);
+}
+
+void report_verified_payload() noexcept {
+	signal_safe_text_t text;
+	text.append("verify: ");
+	text.append_unsigned(payloadVerifier.position);
+	text.append(" bytes match the payload of seed ");
+	text.append_unsigned(flags::verifySeed);
+	text.append("\n");
+	crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+}
+
+sioret_t generate_payload(void* buffer, size_t size) noexcept {
+	if (flags::generateSize != 0 && flags::generateSize - payloadGenerator.position < size) { size = flags::generateSize - payloadGenerator.position; }
+	uint64_t generateStart = transfer_stats_now();
+	payload_generator_fill(payloadGenerator, buffer, size);
+	transfer_stats_record(TransferOperation::STDIN_READ, generateStart, transfer_stats_now(), size);
+	return size;
+}
+
+void write_to_output(const void* buffer, size_t size) noexcept {
+	if (flags::shouldVerifyPayload) { verify_payload(buffer, size); return; }
+	uint64_t writeStart = transfer_stats_now();
+	// NOTE: The output file stands in for stdout, the statistics only see the copy into the writer thread's buffer.
+	if (flags::outputPath) {
+		rotating_output_append(buffer, size);
+		if (flags::teeFileCount != 0) { tee_output_write(buffer, size); }
+	} else if (flags::teeFileCount != 0) {
+		// NOTE: Without "--output", stdout is one of the tee sinks, so that it gets in on the splicing.
+		tee_output_write(buffer, size);
+	} else if (!crossplatform_write_entire_buffer(STDOUT_FILENO, buffer, size)) {
+		REPORT_ERROR_AND_EXIT("failed to write to stdout", EXIT_FAILURE);
+	}
+	transfer_stats_record(TransferOperation::STDOUT_WRITE, writeStart, transfer_stats_now(), size);
+}
+
+// NOTE: With "--spill", the data takes a detour through the spill buffer, whose thread does the actual writing.
+void write_to_stdout(const void* buffer, size_t size) noexcept {
+	if (flags::spillMemoryLimit != 0) { spill_buffer_push(buffer, size); return; }
+	write_to_output(buffer, size);
+}
+
+// NOTE: Like the generated payload, the replayed chunks stand in for stdin. The waiting between them is part of the read.
+sioret_t replay_session_chunk(void* buffer, size_t size) noexcept {
+	uint64_t replayStart = transfer_stats_now();
+	size_t chunkSize = session_replay_read(buffer, size);
+	transfer_stats_record(TransferOperation::STDIN_READ, replayStart, transfer_stats_now(), chunkSize);
+	return chunkSize;
+}
+
+sioret_t read_from_stdin(void* buffer, size_t size) noexcept {
+	if (flags::shouldGeneratePayload) { return generate_payload(buffer, size); }
+	if (flags::replayFile) { return replay_session_chunk(buffer, size); }
+	uint64_t readStart = transfer_stats_now();
+	sioret_t bytesRead = crossplatform_read(STDIN_FILENO, buffer, size);
+	if (bytesRead == -1) { REPORT_ERROR_AND_EXIT("failed to read from stdin", EXIT_FAILURE); }
+	transfer_stats_record(TransferOperation::STDIN_READ, readStart, transfer_stats_now(), bytesRead);
+	return bytesRead;
+}
+
+// NOTE: Every byte that goes over the communicator socket goes through these two, which makes them the place for
+// things that need to see the traffic (like the hex dump).
+// NOTE: The encryption sits below everything else, so the rest of the program only ever sees plaintext.
+void send_to_network(const void* buffer, size_t size) noexcept {
+	token_bucket_consume(sendRateLimiter, size);
+	if (flags::shouldHexDump) { write_hex_dump(HexDumpDirection::SENT, buffer, size); }
+	if (flags::recordFile) { session_recording_append(SessionDirection::SENT, buffer, size); }
+	uint64_t sendStart = transfer_stats_now();
+	if (flags::preSharedKeyFile) { secure_channel_send(buffer, size); } else { NetworkShepherd::write(buffer, size); }
+	transfer_stats_record(TransferOperation::SOCKET_SEND, sendStart, transfer_stats_now(), size);
+}
+
+size_t receive_from_network(void* buffer, size_t size) noexcept {
+	size = token_bucket_chunk_size(receiveRateLimiter, size);
+	uint64_t receiveStart = transfer_stats_now();
+	size_t bytesRead = flags::preSharedKeyFile ? secure_channel_receive(buffer, size) : NetworkShepherd::read(buffer, size);
+	transfer_stats_record(TransferOperation::SOCKET_RECEIVE, receiveStart, transfer_stats_now(), bytesRead);
+	if (flags::shouldHexDump) { write_hex_dump(HexDumpDirection::RECEIVED, buffer, bytesRead); }
+	if (bytesRead != 0) {
+		if (flags::recordFile) { session_recording_append(SessionDirection::RECEIVED, buffer, bytesRead); }
+		if (flags::replayFile) { session_replay_observe_response(); }
+	}
+	// NOTE: Not reading for a while is what slows the remote down (through TCP flow control), so we pay after the read.
+	token_bucket_consume(receiveRateLimiter, bytesRead);
+	return bytesRead;
+}
+
+void finish_sending_to_network() noexcept {
+	if (flags::preSharedKeyFile) { secure_channel_send_end_of_stream(); }
+	NetworkShepherd::shutdownCommunicatorWrite();
+}
+
+// NOTE: The counters are always kept (they're cheap enough), this only decides when they get printed.
+void set_up_transfer_stats() noexcept {
+	transfer_stats::startTime = transfer_stats_now();
+	transfer_stats::printAsJSON = flags::shouldPrintStatsAsJSON;
+
+#ifndef PLATFORM_WINDOWS
+	if (!transfer_stats_install_signal_handler(SIGUSR1, transfer_stats_dump_signal_handler)) { REPORT_ERROR_AND_EXIT("failed to install SIGUSR1 handler", EXIT_FAILURE); }
+#endif
+
+	if (!flags::shouldPrintStats) { return; }
+
+	// NOTE: Error exits go through std::exit too, so the statistics also get printed when the transfer fails.
+	if (std::atexit(transfer_stats_print_at_exit) != 0) { REPORT_ERROR_AND_EXIT("failed to register statistics printer", EXIT_FAILURE); }
+
+#ifndef PLATFORM_WINDOWS
+	// NOTE: "-lu" and "-lk" only ever end through signals, so those have to print the statistics as well.
+	if (!transfer_stats_install_terminating_signal_handler(SIGINT) || !transfer_stats_install_terminating_signal_handler(SIGTERM)) {
+		REPORT_ERROR_AND_EXIT("failed to install termination signal handlers", EXIT_FAILURE);
+	}
+#endif
+}
+
+int latencyHistogramFD;
+
+void print_latency_histograms() noexcept {
+	transfer_stats_print_latency_histograms(latencyHistogramFD);
+	// NOTE: Nothing we could do about a failed close at this point, we're on our way out anyway.
+	if (latencyHistogramFD != STDERR_FILENO) { crossplatform_close(latencyHistogramFD); }
+}
+
+// NOTE: The file is opened up front, so that a bad path is reported before the transfer instead of after it.
+void start_latency_histograms() noexcept {
+	if (std::strcmp(flags::latencyHistogramFile, "-") == 0) {
+		latencyHistogramFD = STDERR_FILENO;
+	} else {
+		latencyHistogramFD = crossplatform_create_file(flags::latencyHistogramFile);
+		if (latencyHistogramFD == -1) { REPORT_ERROR_AND_EXIT("failed to open latency histogram file", EXIT_FAILURE); }
+	}
+
+	if (std::atexit(print_latency_histograms) != 0) { REPORT_ERROR_AND_EXIT("failed to register latency histogram printer", EXIT_FAILURE); }
+
+	transfer_stats::shouldRecordLatencies = true;
+}
+
+int traceFD;
+
+void write_trace() noexcept {
+	event_trace_write(traceFD);
+	// NOTE: Nothing we could do about a failed close at this point, we're on our way out anyway.
+	crossplatform_close(traceFD);
+}
+
+// NOTE: The connection phases happen inside NetworkShepherd, which doesn't know about "--trace" or "--timing", so it just reports them here.
+void observe_network_phase(NetworkPhase phase, uint64_t start, uint64_t end) noexcept {
+	if (event_trace::isEnabled) { event_trace_record(network_phase_names[(size_t)phase], start, end, 0); }
+	if (flags::shouldReportTiming) { connection_timing_record_phase(phase, start, end); }
+}
+
+void start_trace() noexcept {
+	traceFD = crossplatform_create_file(flags::traceFile);
+	if (traceFD == -1) { REPORT_ERROR_AND_EXIT("failed to open trace file", EXIT_FAILURE); }
+
+	if (std::atexit(write_trace) != 0) { REPORT_ERROR_AND_EXIT("failed to register trace writer", EXIT_FAILURE); }
+
+	event_trace::startTime = transfer_stats_now();
+	event_trace::isEnabled = true;
+	event_trace_name_thread("main (stdin -> network)");
+}
+
+void start_connection_timing() noexcept {
+	if (std::atexit(connection_timing_print) != 0) { REPORT_ERROR_AND_EXIT("failed to register connection timing report", EXIT_FAILURE); }
+	connection_timing::startTime = transfer_stats_now();
+}
+
+void start_progress_report() noexcept {
+	// NOTE: Registered after the statistics printer, so the final progress line comes out before the statistics.
+	if (std::atexit(progress_report_finish) != 0) { REPORT_ERROR_AND_EXIT("failed to register progress report finisher", EXIT_FAILURE); }
+	progress_report_start(crossplatform_get_file_size(STDIN_FILENO));
+}
+
+void open_hex_dump_output() noexcept {
+	if (!flags::hexDumpFile) { hex_dump::fd = STDERR_FILENO; return; }
+	hex_dump::fd = crossplatform_create_file(flags::hexDumpFile);
+	if (hex_dump::fd == -1) { REPORT_ERROR_AND_EXIT("failed to open hex dump file", EXIT_FAILURE); }
+}
+
+// NOTE: Only used by the receiving thread. Reset for every connection, like the payload generators.
+pattern_search_t untilSearch;
+uint64_t receivedByteCount;
+
+constexpr size_t wanted_data_continues = (size_t)-1;
+
+// NOTE: For "--until" and "--count". Returns how many bytes of the chunk belong to the data we want (the rest is dropped
+// and nc stops), or wanted_data_continues if we want all of it and more.
+size_t find_end_of_wanted_data(const void* data, size_t size) noexcept {
+	size_t end = wanted_data_continues;
+	if (flags::receiveCount != 0 && flags::receiveCount - receivedByteCount <= size) { end = flags::receiveCount - receivedByteCount; }
+	if (flags::untilPatternLength != 0) {
+		size_t patternEnd = pattern_search_feed(untilSearch, data, end == wanted_data_continues ? size : end);
+		if (patternEnd != pattern_search_not_found) { end = patternEnd; }
+	}
+	receivedByteCount += end == wanted_data_continues ? size : end;
+	return end;
+}
+
+void start_looking_for_end_of_wanted_data() noexcept {
+	if (flags::untilPatternLength != 0) { pattern_search_init(untilSearch, flags::untilPattern, flags::untilPatternLength); }
+	receivedByteCount = 0;
+}
+
 // NOTE: One never returns from this function, since UDP sockets can only get closed properly by the local user.
 // NOTE: When the local user sends SIGINT, the program abruptly terminates and we rely on the OS to clean up the UDP socket.
 // NOTE: That's why we don't do it here.
@@ -329,20 +1298,43 @@ void manageArgs(int argc, const char* const * argv) noexcept {
 				// In that case, a more streamed reading system would be possible, but I assume Linux doesn't work this way
 				// because it would be confusing and annoying to have the behaviour change around just like that.
 				// I'm not sure though, maybe you can research it a bit more. TODO.
+	if (flags::shouldCountPerfEvents) { perf_counters_begin(perf_counters::receiving); }
+	transfer_stats_set_buffer_capacity(TransferOperation::SOCKET_RECEIVE, sizeof(buffer));
+	start_looking_for_end_of_wanted_data();
+	udp_packet_info_t packetInfo;
 	while (true) {
-		size_t bytesRead = NetworkShepherd::readUDP(buffer, sizeof(buffer));
+		uint64_t receiveStart = transfer_stats_now();
+		size_t bytesRead = NetworkShepherd::readUDP(buffer, sizeof(buffer), flags::pcapPrefix ? &packetInfo : nullptr);
+		transfer_stats_record(TransferOperation::SOCKET_RECEIVE, receiveStart, transfer_stats_now(), bytesRead);
+		token_bucket_consume(receiveRateLimiter, bytesRead);
+		// NOTE: Empty packets are still packets, so they're captured before they get skipped.
+		if (flags::pcapPrefix) { pcap_ring_write(packetInfo, buffer, bytesRead); }
 		if (bytesRead == 0) { continue; }
-		char* buffer_ptr = buffer;
-		while (true) {
-			sioret_t bytesWritten = crossplatform_write(STDOUT_FILENO, buffer_ptr, bytesRead);
-			if (bytesWritten == bytesRead) { break; }
-			if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to write to stdout", EXIT_FAILURE); }
-			buffer_ptr += bytesWritten;
-			bytesRead -= bytesWritten;
+		if (flags::shouldHexDump) { write_hex_dump(HexDumpDirection::RECEIVED, buffer, bytesRead); }
+		if (flags::untilPatternLength != 0 || flags::receiveCount != 0) {
+			size_t wantedBytes = find_end_of_wanted_data(buffer, bytesRead);
+			if (wantedBytes != wanted_data_continues) {
+				write_to_stdout(buffer, wantedBytes);
+				if (flags::spillMemoryLimit != 0) { spill_buffer_drain(); }
+				if (flags::shouldCountPerfEvents) { perf_counters_end(perf_counters::receiving); }
+				halt_program(EXIT_SUCCESS);
+			}
 		}
+		write_to_stdout(buffer, bytesRead);
 	}
 }
 
+// NOTE: With "--datagram-size", a datagram only goes out once it's full (or stdin has ended), however the data trickles in.
+sioret_t read_datagram_from_stdin(char* buffer, size_t size) noexcept {
+	size_t filledSize = 0;
+	while (filledSize < size) {
+		sioret_t bytesRead = read_from_stdin(buffer + filledSize, size - filledSize);
+		if (bytesRead == 0) { break; }
+		filledSize += bytesRead;
+	}
+	return filledSize;
+}
+
 void do_UDP_send_and_close() noexcept {
 	NetworkShepherd::enableFindMSS();
 
@@ -350,12 +1342,25 @@ void do_UDP_send_and_close() noexcept {
 	char* buffer = new (std::nothrow) char[buffer_size];
 	if (!buffer) { REPORT_ERROR_AND_EXIT("failed to allocate buffer", EXIT_FAILURE); }
 
+	if (flags::shouldGeneratePayload) { payload_generator_seed(payloadGenerator, flags::generateSeed); }
+
+	if (flags::shouldCountPerfEvents) { perf_counters_begin(perf_counters::sending); }
+	transfer_stats_set_buffer_capacity(TransferOperation::STDIN_READ, buffer_size);
 	while (true) {
-		sioret_t bytesRead = crossplatform_read(STDIN_FILENO, buffer, buffer_size);
+		sioret_t bytesRead;
+		if (flags::datagramSize != 0) {
+			// NOTE: If the path can't take datagrams that big, they're as big as it can take.
+			bytesRead = read_datagram_from_stdin(buffer, flags::datagramSize < buffer_size ? flags::datagramSize : buffer_size);
+		} else {
+			bytesRead = read_from_stdin(buffer, buffer_size);
+		}
 		if (bytesRead == 0) { break; }
-		if (bytesRead == -1) { REPORT_ERROR_AND_EXIT("failed to read from stdin", EXIT_FAILURE); }
 
+		token_bucket_consume(sendRateLimiter, bytesRead);
+		if (flags::shouldHexDump) { write_hex_dump(HexDumpDirection::SENT, buffer, bytesRead); }
+		uint64_t sendStart = transfer_stats_now();
 		uint16_t newMSS = NetworkShepherd::writeUDPAndFindMSS(buffer, bytesRead);
+		transfer_stats_record(TransferOperation::SOCKET_SEND, sendStart, transfer_stats_now(), bytesRead);
 		if (newMSS == 0) { continue; }		// NOTE: newMSS == 0 means MSS stays the same.
 
 		// NOTE: Reallocation isn't strictly necessary since it should always shrink, but I'm trying to be respectful.
@@ -363,72 +1368,282 @@ void do_UDP_send_and_close() noexcept {
 		buffer = new (std::nothrow) char[newMSS];
 		if (!buffer) { REPORT_ERROR_AND_EXIT("failed to reallocate buffer", EXIT_FAILURE); }
 		buffer_size = newMSS;
+		transfer_stats_set_buffer_capacity(TransferOperation::STDIN_READ, buffer_size);
 	}
 
+	if (flags::shouldCountPerfEvents) { perf_counters_end(perf_counters::sending); }
+
 	NetworkShepherd::closeCommunicator();
 
 	delete[] buffer;
 }
 
+// NOTE: With "--checksum", the sender appends the CRC32C of everything it sent (big-endian) right before it shuts down its
+// write side. The receiver can't know where the data ends and the trailer begins until it sees EOF, so it always holds
+// back the last integrity_trailer_size bytes and only writes out what can't possibly be part of the trailer.
+constexpr size_t integrity_trailer_size = sizeof(uint32_t);
+
+void send_integrity_trailer(uint32_t crc) noexcept {
+	unsigned char trailer[integrity_trailer_size] = { (unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc };
+	send_to_network(trailer, sizeof(trailer));
+}
+
+void verify_integrity_trailer(uint32_t crc, const unsigned char* trailer, size_t trailer_size) noexcept {
+	if (trailer_size != integrity_trailer_size) { REPORT_ERROR_AND_EXIT("integrity check failed, stream ended before checksum was received", EXIT_FAILURE); }
+	uint32_t received_crc = ((uint32_t)trailer[0] << 24) | ((uint32_t)trailer[1] << 16) | ((uint32_t)trailer[2] << 8) | (uint32_t)trailer[3];
+	if (received_crc != crc) { REPORT_ERROR_AND_EXIT("integrity check failed, checksum mismatch (data was corrupted in transit)", EXIT_FAILURE); }
+}
+
+void write_filtered_data(crlf_to_lf_state_t& crlfState, const char* data, size_t size) noexcept {
+	if (flags::shouldStripCRLF) {
+		char translated[BUFSIZ + 1];
+		// NOTE: Filters can hand back more than a receive buffer's worth, so the translation goes piece by piece.
+		for (size_t offset = 0; offset < size; offset += BUFSIZ) {
+			size_t pieceSize = size - offset < BUFSIZ ? size - offset : BUFSIZ;
+			write_to_stdout(translated, translate_crlf_to_lf(crlfState, data + offset, pieceSize, translated));
+		}
+		return;
+	}
+	write_to_stdout(data, size);
+}
+
+// NOTE: Everything that arrives over a connection ends up here, once the integrity trailer (if any) has been peeled off.
+void deliver_received_data(crlf_to_lf_state_t& crlfState, char* data, size_t size) noexcept {
+	if (flags::filterCount != 0) {
+		nc_filter_view_t view = filter_plugins_process(NC_FILTER_INCOMING, data, size, size);
+		write_filtered_data(crlfState, (const char*)view.data, view.size);
+		return;
+	}
+	write_filtered_data(crlfState, data, size);
+}
+
+void finish_received_data(crlf_to_lf_state_t& crlfState) noexcept {
+	if (flags::filterCount != 0) {
+		uint8_t finishedFilters = 0;
+		nc_filter_view_t view;
+		while (filter_plugins_flush(NC_FILTER_INCOMING, finishedFilters, view)) { write_filtered_data(crlfState, (const char*)view.data, view.size); }
+	}
+	char remainder[1];
+	if (flags::shouldStripCRLF) { write_to_stdout(remainder, finish_crlf_to_lf(crlfState, remainder)); }
+	// NOTE: Everything has to be out before stdout gets closed (or the next "-k" connection starts).
+	if (flags::spillMemoryLimit != 0) { spill_buffer_drain(); }
+	if (flags::shouldVerifyPayload) { report_verified_payload(); }
+}
+
 #define NRST_CLOSE_STDOUT_ON_FINISH true
 #define NRST_LEAVE_STDOUT_OPEN false
 
 template <bool close_stdout_on_finish>
 void network_read_sub_transfer() noexcept {
-	char buffer[BUFSIZ];
+	event_trace_name_thread("receiver (network -> stdout)");
+	if (flags::shouldCountPerfEvents) { perf_counters_begin(perf_counters::receiving); }
+
+	char buffer[integrity_trailer_size + BUFSIZ];
+	size_t heldBytes = 0;
+	uint32_t crc = 0;
+	crlf_to_lf_state_t crlfState;
+	bool receivedFirstByte = false;
+	transfer_stats_set_buffer_capacity(TransferOperation::SOCKET_RECEIVE, BUFSIZ);
 	while (true) {
-		size_t bytesRead = NetworkShepherd::read(buffer, sizeof(buffer));
+		size_t bytesRead = receive_from_network(buffer + heldBytes, BUFSIZ);
+		if (flags::metricsAddress && !receivedFirstByte && bytesRead != 0) {
+			metrics_histogram_observe(metrics::firstByteLatency, transfer_stats_now() - metrics::connectionAcceptTime);
+			receivedFirstByte = true;
+		}
 		if (bytesRead == 0) {
+			if (flags::shouldChecksum) { verify_integrity_trailer(crc, (const unsigned char*)buffer, heldBytes); }
+			finish_received_data(crlfState);
 			if (close_stdout_on_finish) {
 				if (close(STDOUT_FILENO) == -1) { REPORT_ERROR_AND_EXIT("failed to close stdout fd", EXIT_FAILURE); }
 			}
+			if (flags::shouldCountPerfEvents) { perf_counters_end(perf_counters::receiving); }
 			return;
 		}
-		char* buffer_ptr = buffer;
-		while (true) {
-			sioret_t bytesWritten = crossplatform_write(STDOUT_FILENO, buffer_ptr, bytesRead);
-			if (bytesWritten == bytesRead) { break; }
-			if (bytesWritten == -1) { REPORT_ERROR_AND_EXIT("failed to write to stdout", EXIT_FAILURE); }
-			buffer_ptr += bytesWritten;
-			bytesRead -= bytesWritten;
+
+		if (flags::shouldChecksum) {
+			size_t availableBytes = heldBytes + bytesRead;
+			if (availableBytes <= integrity_trailer_size) { heldBytes = availableBytes; continue; }
+			size_t releasedBytes = availableBytes - integrity_trailer_size;
+			crc = crc32c_update(crc, buffer, releasedBytes);
+			deliver_received_data(crlfState, buffer, releasedBytes);
+			std::memmove(buffer, buffer + releasedBytes, integrity_trailer_size);
+			heldBytes = integrity_trailer_size;
+			continue;
+		}
+
+		if (flags::untilPatternLength != 0 || flags::receiveCount != 0) {
+			size_t wantedBytes = find_end_of_wanted_data(buffer, bytesRead);
+			if (wantedBytes != wanted_data_continues) {
+				deliver_received_data(crlfState, buffer, wantedBytes);
+				finish_received_data(crlfState);
+				if (flags::shouldCountPerfEvents) { perf_counters_end(perf_counters::receiving); }
+				// NOTE: The whole of nc is done at this point, whatever the sending side is still up to. The at-exit
+				// handlers take care of what's still buffered.
+				halt_program(EXIT_SUCCESS);
+			}
+		}
+
+		deliver_received_data(crlfState, buffer, bytesRead);
+	}
+}
+
+// NOTE: Everything that comes from stdin goes through here on its way to the network, once the filters are done with it.
+void send_filtered_data(uint32_t& crc, const char* data, size_t size) noexcept {
+	if (flags::shouldTranslateLFToCRLF) {
+		char translated[BUFSIZ * 2];
+		// NOTE: Same as on the receiving side, filters can hand back more than a buffer's worth.
+		for (size_t offset = 0; offset < size; offset += BUFSIZ) {
+			size_t pieceSize = size - offset < BUFSIZ ? size - offset : BUFSIZ;
+			size_t translatedSize = translate_lf_to_crlf(data + offset, pieceSize, translated);
+			if (flags::shouldChecksum) { crc = crc32c_update(crc, translated, translatedSize); }
+			send_to_network(translated, translatedSize);
 		}
+		return;
 	}
+	if (flags::shouldChecksum) { crc = crc32c_update(crc, data, size); }
+	send_to_network(data, size);
 }
 
 template <bool close_stdout_on_finish>
 void do_data_transfer_over_connection_and_close() noexcept {
+	if (flags::tcpInfoInterval != 0) { tcp_info_sampler_start(); }
+
+	if (flags::preSharedKeyFile) { secure_channel_handshake(flags::shouldListen ? SecureChannelRole::LISTENER : SecureChannelRole::CONNECTOR); }
+
+	if (flags::shouldGeneratePayload) { payload_generator_seed(payloadGenerator, flags::generateSeed); }
+	if (flags::shouldVerifyPayload) { payload_generator_seed(payloadVerifier, flags::verifySeed); }
+	if (flags::recordFile) { session_recording_begin_connection(); }
+	if (flags::replayFile) { session_replay_begin_connection(); }
+	start_looking_for_end_of_wanted_data();
+
 	// NOTE: Cast is necessary because (for whatever reason) thread only accepts non-noexcept function ptr types.
 	// NOTE: Luckily, casting from noexcept to non-noexcept works great and is well-defined.
 	// BEWARE: Casting from non-noexcept to noexcept is UB (for obvious exception handling reasons).
 	std::thread networkReadThread((void (*)())network_read_sub_transfer<close_stdout_on_finish>);
 
+	if (flags::shouldCountPerfEvents) { perf_counters_begin(perf_counters::sending); }
+
 	char buffer[BUFSIZ];
+	uint32_t crc = 0;
+	transfer_stats_set_buffer_capacity(TransferOperation::STDIN_READ, sizeof(buffer));
 	while (true) {
-		sioret_t bytesRead = crossplatform_read(STDIN_FILENO, buffer, sizeof(buffer));
-		if (bytesRead == 0) { NetworkShepherd::shutdownCommunicatorWrite(); break; }
-		if (bytesRead == -1) { REPORT_ERROR_AND_EXIT("failed to read from stdin", EXIT_FAILURE); }
-		NetworkShepherd::write(buffer, bytesRead);
+		sioret_t bytesRead = read_from_stdin(buffer, token_bucket_chunk_size(sendRateLimiter, sizeof(buffer)));
+		if (bytesRead == 0) {
+			if (flags::filterCount != 0) {
+				uint8_t finishedFilters = 0;
+				nc_filter_view_t view;
+				while (filter_plugins_flush(NC_FILTER_OUTGOING, finishedFilters, view)) { send_filtered_data(crc, (const char*)view.data, view.size); }
+			}
+			if (flags::shouldChecksum) { send_integrity_trailer(crc); }
+			finish_sending_to_network();
+			break;
+		}
+
+		if (flags::filterCount != 0) {
+			nc_filter_view_t view = filter_plugins_process(NC_FILTER_OUTGOING, buffer, bytesRead, sizeof(buffer));
+			send_filtered_data(crc, (const char*)view.data, view.size);
+			continue;
+		}
+		send_filtered_data(crc, buffer, bytesRead);
 	}
 
+	if (flags::shouldCountPerfEvents) { perf_counters_end(perf_counters::sending); }
+
 	networkReadThread.join();
 
+	if (flags::tcpInfoInterval != 0) { tcp_info_sampler_stop(); }
+
 	NetworkShepherd::closeCommunicator();
 }
 
 template <bool close_stdout_on_finish>
 void accept_and_handle_connection() noexcept {
 	NetworkShepherd::accept();
+
+	if (!flags::metricsAddress) {
+		do_data_transfer_over_connection_and_close<close_stdout_on_finish>();
+		return;
+	}
+
+	transfer_stats_add(metrics::acceptedConnections, 1);
+	metrics::connectionAcceptTime = transfer_stats_now();
 	do_data_transfer_over_connection_and_close<close_stdout_on_finish>();
+	metrics_histogram_observe(metrics::connectionDuration, transfer_stats_now() - metrics::connectionAcceptTime);
 }
 
 int main(int argc, const char* const * argv) noexcept {
 	manageArgs(argc, argv);
 
+	set_up_transfer_stats();
+
+	if (flags::shouldExplainSlowness) {
+		if (std::atexit(bottleneck_report_print) != 0) { REPORT_ERROR_AND_EXIT("failed to register bottleneck report", EXIT_FAILURE); }
+	}
+
+	if (flags::latencyHistogramFile) { start_latency_histograms(); }
+
+	if (flags::traceFile) { start_trace(); }
+
+	if (flags::shouldReportTiming) { start_connection_timing(); }
+
+	if (flags::shouldCountPerfEvents) {
+		if (std::atexit(perf_counters_print) != 0) { REPORT_ERROR_AND_EXIT("failed to register perf counter report", EXIT_FAILURE); }
+	}
+
+	if (flags::recordFile) {
+		session_recording_start(flags::recordFile, flags::shouldListen);
+		if (std::atexit(session_recording_stop) != 0) { REPORT_ERROR_AND_EXIT("failed to register recording cleanup", EXIT_FAILURE); }
+	}
+
+	if (flags::replayFile) {
+		session_replay_start(flags::replayFile, flags::replaySpeed);
+		if (std::atexit(session_replay_print) != 0) { REPORT_ERROR_AND_EXIT("failed to register replay report", EXIT_FAILURE); }
+	}
+
+	if (flags::outputPath) {
+		rotating_output_start(flags::outputPath, flags::rotateSize, (uint64_t)flags::rotateInterval * 1000000000);
+		if (std::atexit(rotating_output_stop) != 0) { REPORT_ERROR_AND_EXIT("failed to register output file cleanup", EXIT_FAILURE); }
+	}
+
+	for (uint8_t i = 0; i < flags::filterCount; i++) { filter_plugins_load(flags::filterSpecs[i]); }
+
+	if (flags::teeFileCount != 0) { tee_output_start(flags::teePaths, flags::teeFileCount, !flags::outputPath); }
+
+	if (flags::spillMemoryLimit != 0) {
+		spill_buffer_start(flags::spillMemoryLimit, flags::spillDirectory, write_to_output);
+		if (std::atexit(spill_buffer_print) != 0) { REPORT_ERROR_AND_EXIT("failed to register spill report", EXIT_FAILURE); }
+		if (std::atexit(spill_buffer_stop) != 0) { REPORT_ERROR_AND_EXIT("failed to register spill buffer cleanup", EXIT_FAILURE); }
+	}
+
+	// NOTE: Comes after the statistics are set up, so that its signal handlers can pass the signals on to theirs.
+	if (flags::pcapPrefix) { pcap_ring_start(flags::pcapPrefix, flags::pcapFileSize, flags::pcapFileCount); }
+
+	if (flags::traceFile || flags::shouldReportTiming) { NetworkShepherd::phaseObserver = observe_network_phase; }
+
+	if (flags::shouldReportProgress) { start_progress_report(); }
+
+	if (flags::tcpInfoInterval != 0) {
+		tcp_info_sampler::interval = std::chrono::milliseconds(flags::tcpInfoInterval);
+		if (std::atexit(tcp_info_sampler_stop_at_exit) != 0) { REPORT_ERROR_AND_EXIT("failed to register TCP_INFO sampler cleanup", EXIT_FAILURE); }
+	}
+
+	if (flags::shouldHexDump) { open_hex_dump_output(); }
+
+	if (flags::preSharedKeyFile) { load_pre_shared_key(flags::preSharedKeyFile); }
+
+	sendRateLimiter.bytesPerSecond = flags::sendRateLimit;
+	receiveRateLimiter.bytesPerSecond = flags::receiveRateLimit;
+
 	NetworkShepherd::init();
 
+	if (flags::metricsAddress) { metrics_start(flags::metricsAddress, flags::metricsPort); }
+
 	if (flags::shouldListen) {
 		if (flags::shouldUseUDP) {
 			NetworkShepherd::createListener(arguments::destinationIP, arguments::destinationPort, SOCK_DGRAM, flags::IPVersionConstraint);
+			if (flags::pcapPrefix) { NetworkShepherd::enableUDPPacketInfo(); }
+			// NOTE: The metrics are the only place the drop count shows up.
+			if (flags::metricsAddress) { NetworkShepherd::enableUDPDropCount(); }
 			do_UDP_receive();
 			// NOTE: The above function never returns.
 		}
@@ -444,6 +1659,8 @@ int main(int argc, const char* const * argv) noexcept {
 
 		NetworkShepherd::closeListener();
 
+		filter_plugins_destroy();
+
 		NetworkShepherd::release();
 
 		return EXIT_SUCCESS;
@@ -461,6 +1678,8 @@ int main(int argc, const char* const * argv) noexcept {
 	NetworkShepherd::createCommunicatorAndConnect(arguments::destinationIP, arguments::destinationPort, flags::sourceIP, flags::sourcePort, flags::IPVersionConstraint);
 	do_data_transfer_over_connection_and_close<NRST_CLOSE_STDOUT_ON_FINISH>();
 
+	filter_plugins_destroy();
+
 	NetworkShepherd::release();
 }
 
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::strlen and std::memcpy
+#include <atomic>		// for std::atomic
+#include <thread>		// for std::thread
+
+#include "NetworkShepherd.h"	// for the UDP drop counters
+
+#include "error_reporting.h"
+
+#include "transfer_stats.h"	// for the byte counters and the text formatting
+
+#ifndef PLATFORM_WINDOWS
+#include <sys/socket.h>		// for Linux sockets
+#include <sys/un.h>		// for sockaddr_un
+#include <sys/stat.h>		// for stat
+#include <sys/time.h>		// for timeval
+#include <netinet/in.h>		// for sockaddr_in
+#include <arpa/inet.h>		// for htons and htonl
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+/*
+NOTE: How "--metrics" works:
+	- a side thread listens on its own socket (a TCP port on 127.0.0.1 or a Unix socket) and answers every connection
+		with a Prometheus text format snapshot, no matter what was requested. One client at a time, that's plenty for a scraper.
+	- the thread only ever reads atomics (the transfer statistics and the counters below), it never takes a lock that the
+		transfer path takes and the transfer path never waits for it.
+	- errors in here never end the program. A broken scrape shouldn't take down a collector that has been running for weeks.
+*/
+
+constexpr size_t metrics_histogram_bucket_count = 10;
+
+// NOTE: Upper bounds in nanoseconds, plus the "le" labels that go with them. The +Inf bucket is implicit.
+constexpr uint64_t metrics_histogram_bounds[metrics_histogram_bucket_count] = {
+	100000, 1000000, 5000000, 10000000, 50000000, 100000000, 500000000, 1000000000, 5000000000, 30000000000
+};
+constexpr const char* metrics_histogram_bound_labels[metrics_histogram_bucket_count] = {
+	"0.0001", "0.001", "0.005", "0.01", "0.05", "0.1", "0.5", "1", "5", "30"
+};
+
+// NOTE: Like the transfer statistics, every histogram has a single writer.
+struct metrics_histogram_t {
+	std::atomic<uint64_t> buckets[metrics_histogram_bucket_count + 1] { };	// NOTE: Not cumulative, that happens when printing.
+	std::atomic<uint64_t> sumNanoseconds { 0 };
+};
+
+namespace metrics {
+	inline std::atomic<uint64_t> acceptedConnections { 0 };
+
+	// NOTE: Set before the receiving thread of a connection is started, so that thread can read it without synchronization.
+	inline uint64_t connectionAcceptTime = 0;
+
+	inline metrics_histogram_t firstByteLatency;		// NOTE: From accepting a connection to its first received byte.
+	inline metrics_histogram_t connectionDuration;
+
+	inline socket_t listenerSocket;
+}
+
+inline void metrics_histogram_observe(metrics_histogram_t& histogram, uint64_t nanoseconds) noexcept {
+	size_t bucket = 0;
+	while (bucket < metrics_histogram_bucket_count && nanoseconds > metrics_histogram_bounds[bucket]) { bucket++; }
+	transfer_stats_add(histogram.buckets[bucket], 1);
+	transfer_stats_add(histogram.sumNanoseconds, nanoseconds);
+}
+
+inline void metrics_send_text(socket_t client, const signal_safe_text_t& text) noexcept {
+	// NOTE: Errors are ignored on purpose, if the scraper went away there's nobody to tell.
+	const char* data = text.data;
+	size_t size = text.size;
+	while (size != 0) {
+#ifndef PLATFORM_WINDOWS
+		ssize_t bytes_sent = send(client, data, size, MSG_NOSIGNAL);
+#else
+		int bytes_sent = send(client, data, (int)size, 0);
+#endif
+		if (bytes_sent <= 0) { return; }
+		data += bytes_sent;
+		size -= bytes_sent;
+	}
+}
+
+template <size_t name_length, size_t help_length>
+inline void metrics_send_counter(socket_t client, const char (&name)[name_length], const char (&help)[help_length], uint64_t value) noexcept {
+	signal_safe_text_t text;
+	text.append("# HELP ");
+	text.append(name);
+	text.append(" ");
+	text.append(help);
+	text.append("\n# TYPE ");
+	text.append(name);
+	text.append(" counter\n");
+	text.append(name);
+	text.append(" ");
+	text.append_unsigned(value);
+	text.append("\n");
+	metrics_send_text(client, text);
+}
+
+inline void metrics_append_c_string(signal_safe_text_t& text, const char* string) noexcept {
+	for (size_t i = 0; string[i] != '\0' && text.size < sizeof(text.data); i++) { text.data[text.size++] = string[i]; }
+}
+
+// NOTE: Full nanosecond precision, since the sum of a histogram over short latencies would be useless with milliseconds.
+inline void metrics_append_seconds(signal_safe_text_t& text, uint64_t nanoseconds) noexcept {
+	text.append_unsigned(nanoseconds / 1000000000);
+	text.append(".");
+	uint64_t fraction = nanoseconds % 1000000000;
+	for (uint64_t digit = 100000000; digit != 0 && text.size < sizeof(text.data); digit /= 10) { text.data[text.size++] = (char)(fraction / digit % 10 + '0'); }
+}
+
+template <size_t name_length, size_t help_length>
+inline void metrics_send_histogram(socket_t client, const char (&name)[name_length], const char (&help)[help_length], const metrics_histogram_t& histogram) noexcept {
+	signal_safe_text_t text;
+	text.append("# HELP ");
+	text.append(name);
+	text.append(" ");
+	text.append(help);
+	text.append("\n# TYPE ");
+	text.append(name);
+	text.append(" histogram\n");
+
+	uint64_t cumulative_count = 0;
+	for (size_t i = 0; i < metrics_histogram_bucket_count; i++) {
+		cumulative_count += histogram.buckets[i].load(std::memory_order_relaxed);
+		text.append(name);
+		text.append("_bucket{le=\"");
+		metrics_append_c_string(text, metrics_histogram_bound_labels[i]);
+		text.append("\"} ");
+		text.append_unsigned(cumulative_count);
+		text.append("\n");
+	}
+	cumulative_count += histogram.buckets[metrics_histogram_bucket_count].load(std::memory_order_relaxed);
+	text.append(name);
+	text.append("_bucket{le=\"+Inf\"} ");
+	text.append_unsigned(cumulative_count);
+	text.append("\n");
+
+	text.append(name);
+	text.append("_sum ");
+	metrics_append_seconds(text, histogram.sumNanoseconds.load(std::memory_order_relaxed));
+	text.append("\n");
+	text.append(name);
+	text.append("_count ");
+	// NOTE: The buckets are read one by one while the writer keeps going, so use the bucket total to keep the output consistent.
+	text.append_unsigned(cumulative_count);
+	text.append("\n");
+
+	metrics_send_text(client, text);
+}
+
+inline void metrics_serve_client(socket_t client) noexcept {
+	// NOTE: We don't care what was requested, but the request has to be read, otherwise closing the connection with unread
+	// data in it would reset it and the scraper might not get the response.
+	char request[4096];
+	size_t request_size = 0;
+	while (request_size < sizeof(request)) {
+		int bytes_read = (int)recv(client, request + request_size, (int)(sizeof(request) - request_size), 0);
+		if (bytes_read <= 0) { break; }
+		request_size += bytes_read;
+		if (request_size >= 4 && std::memcmp(request + request_size - 4, "\r\n\r\n", 4) == 0) { break; }
+	}
+
+	signal_safe_text_t header;
+	header.append("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+	metrics_send_text(client, header);
+
+	metrics_send_counter(client, "nc_connections_accepted_total", "Connections accepted by the listener.", metrics::acceptedConnections.load(std::memory_order_relaxed));
+	metrics_send_counter(client, "nc_sent_bytes_total", "Bytes sent over the network.", transfer_stats::sent.bytes.load(std::memory_order_relaxed));
+	metrics_send_counter(client, "nc_received_bytes_total", "Bytes received over the network.", transfer_stats::received.bytes.load(std::memory_order_relaxed));
+	metrics_send_counter(client, "nc_receive_calls_total", "Socket receive calls (datagrams with -u).", transfer_stats::received.networkCalls.load(std::memory_order_relaxed));
+	metrics_send_counter(client, "nc_udp_truncated_datagrams_total", "UDP datagrams that didn't fit into the receive buffer.", NetworkShepherd::UDPTruncatedPacketCount.load(std::memory_order_relaxed));
+	metrics_send_counter(client, "nc_udp_dropped_datagrams_total", "UDP datagrams the kernel dropped because the receive queue was full.", NetworkShepherd::UDPDroppedPacketCount.load(std::memory_order_relaxed));
+	metrics_send_histogram(client, "nc_first_byte_latency_seconds", "Time from accepting a connection to its first received byte.", metrics::firstByteLatency);
+	metrics_send_histogram(client, "nc_connection_duration_seconds", "Time from accepting a connection to closing it.", metrics::connectionDuration);
+}
+
+inline void metrics_close_socket(socket_t socket) noexcept {
+#ifndef PLATFORM_WINDOWS
+	close(socket);
+#else
+	closesocket(socket);
+#endif
+}
+
+inline void metrics_thread() noexcept {
+	while (true) {
+		socket_t client = accept(metrics::listenerSocket, nullptr, nullptr);
+#ifndef PLATFORM_WINDOWS
+		if (client == -1) { continue; }
+#else
+		if (client == INVALID_SOCKET) { continue; }
+#endif
+
+		// NOTE: So that a client that never finishes its request can't block the endpoint forever.
+#ifndef PLATFORM_WINDOWS
+		struct timeval timeout = { 1, 0 };
+#else
+		DWORD timeout = 1000;
+#endif
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+
+		metrics_serve_client(client);
+		metrics_close_socket(client);
+	}
+}
+
+// NOTE: Only digits means a port on 127.0.0.1, anything else is the path of a Unix socket.
+inline bool metrics_address_is_port(const char* address) noexcept {
+	for (size_t i = 0; address[i] != '\0'; i++) {
+		if (address[i] < '0' || address[i] > '9') { return false; }
+	}
+	return true;
+}
+
+// NOTE: The port is validated while parsing the args.
+inline void metrics_create_listener(const char* address, uint16_t port) noexcept {
+	if (metrics_address_is_port(address)) {
+		metrics::listenerSocket = socket(AF_INET, SOCK_STREAM, 0);
+#ifndef PLATFORM_WINDOWS
+		if (metrics::listenerSocket == -1) { REPORT_ERROR_AND_EXIT("failed to create metrics listener socket", EXIT_FAILURE); }
+#else
+		if (metrics::listenerSocket == INVALID_SOCKET) { REPORT_ERROR_AND_EXIT("failed to create metrics listener socket", EXIT_FAILURE); }
+#endif
+
+		int enabler = true;
+		setsockopt(metrics::listenerSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&enabler, sizeof(enabler));
+
+		struct sockaddr_in listenerAddress = { };
+		listenerAddress.sin_family = AF_INET;
+		listenerAddress.sin_port = htons(port);
+		listenerAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (bind(metrics::listenerSocket, (const sockaddr*)&listenerAddress, sizeof(listenerAddress)) != 0) {
+			REPORT_ERROR_AND_EXIT("failed to bind metrics listener, port occupied or not permitted", EXIT_FAILURE);
+		}
+	} else {
+#ifndef PLATFORM_WINDOWS
+		struct sockaddr_un listenerAddress = { };
+		listenerAddress.sun_family = AF_UNIX;
+		if (std::strlen(address) >= sizeof(listenerAddress.sun_path)) { REPORT_ERROR_AND_EXIT("metrics socket path is too long", EXIT_SUCCESS); }
+		std::memcpy(listenerAddress.sun_path, address, std::strlen(address));
+
+		// NOTE: A socket left behind by an earlier run (which only ever ends through signals) would make bind fail.
+		// Only ever remove sockets though, never anything else that might be lying around at that path.
+		struct stat status;
+		if (stat(address, &status) == 0 && S_ISSOCK(status.st_mode)) { unlink(address); }
+
+		metrics::listenerSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (metrics::listenerSocket == -1) { REPORT_ERROR_AND_EXIT("failed to create metrics listener socket", EXIT_FAILURE); }
+		if (bind(metrics::listenerSocket, (const sockaddr*)&listenerAddress, sizeof(listenerAddress)) != 0) {
+			REPORT_ERROR_AND_EXIT("failed to bind metrics listener to Unix socket path", EXIT_FAILURE);
+		}
+#else
+		REPORT_ERROR_AND_EXIT("metrics on Unix sockets aren't supported on Windows, use a port", EXIT_SUCCESS);
+#endif
+	}
+
+	if (listen(metrics::listenerSocket, 16) != 0) { REPORT_ERROR_AND_EXIT("failed to listen with metrics listener socket", EXIT_FAILURE); }
+}
+
+// NOTE: Has to be called after NetworkShepherd::init(), since Windows needs WSAStartup before any socket is created.
+inline void metrics_start(const char* address, uint16_t port) noexcept {
+	metrics_create_listener(address, port);
+
+	// NOTE: Cast is necessary because (for whatever reason) thread only accepts non-noexcept function ptr types.
+	std::thread((void (*)())metrics_thread).detach();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+NOTE: The ABI between nc and the filter modules that are loaded with "--filter". This is the only file a module needs,
+and it's plain C, so modules can be written in anything that can export a C function.
+	- a module exports "nc_filter_entry", which returns a pointer to an nc_filter_t that stays valid until it's unloaded.
+		abi_version has to be NC_FILTER_ABI_VERSION, modules built against a different one are refused.
+	- create is called once, with the text after the "=" in "--filter <module>=<argument>" (or an empty string), and
+		whatever it returns is handed back to the other functions. Returning NULL makes nc exit with an error.
+	- process gets every chunk of a stream, in order, as a view into nc's own buffer: data, size, and capacity (how far
+		the data may grow in place). It can change the bytes and the size in place, or point data at a buffer it
+		got from acquire_buffer and put the output there (the view's capacity doesn't matter then). A size of 0
+		drops the chunk.
+	- finish is called at the end of every stream (with "-k", every connection is one), with an empty view, so that a
+		filter that holds data back (a partial line, say) can emit it, the same way process would.
+	- destroy is called once both directions are done, when nc exits normally. Exits because of errors skip it.
+	- filters are chained in the order they're given, every filter sees what the one before it emitted.
+	- OUTGOING is stdin -> socket, INCOMING is socket -> stdout. The two directions run on different threads at the
+		same time, so state that's shared between them needs its own locking. Within a direction, calls never overlap.
+	- acquire_buffer hands out buffers from a pool per direction. They stay valid until process or finish is called
+		for the next chunk of that direction, then they go back to the pool (no freeing). It returns NULL if it can't
+		provide one, and so far that's the only way it can fail.
+	- process and finish return 0 on success, anything else ends nc with an error.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NC_FILTER_ABI_VERSION 1
+
+typedef enum nc_filter_direction_t {
+	NC_FILTER_OUTGOING = 0,
+	NC_FILTER_INCOMING = 1
+} nc_filter_direction_t;
+
+typedef struct nc_filter_view_t {
+	unsigned char* data;
+	size_t size;
+	size_t capacity;
+} nc_filter_view_t;
+
+typedef struct nc_filter_host_t {
+	uint32_t abi_version;
+	unsigned char* (*acquire_buffer)(nc_filter_direction_t direction, size_t size);
+} nc_filter_host_t;
+
+typedef struct nc_filter_t {
+	uint32_t abi_version;
+	void* (*create)(const nc_filter_host_t* host, const char* argument);
+	int (*process)(void* state, nc_filter_direction_t direction, nc_filter_view_t* view);
+	int (*finish)(void* state, nc_filter_direction_t direction, nc_filter_view_t* view);
+	void (*destroy)(void* state);
+} nc_filter_t;
+
+typedef const nc_filter_t* (*nc_filter_entry_t)(void);
+
+#define NC_FILTER_ENTRY_SYMBOL "nc_filter_entry"
+
+#ifdef __cplusplus
+}
+#endif
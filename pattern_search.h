@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::memcmp, std::memcpy and std::memmove
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define PATTERN_SEARCH_SSE2
+#include <emmintrin.h>		// for SSE2 intrinsics
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>		// for _BitScanForward
+#endif
+
+/*
+NOTE: How "--until" finds its pattern in the received stream:
+	- inside a chunk, 16 positions are checked at a time: one compare against the pattern's first byte, one against its
+		last byte (shifted by the pattern length), and only positions where both match get a full memcmp. Two bytes
+		that far apart rule out almost every position of normal data, so the memcmps are rare.
+	- a match can start in one chunk and end in the next (or several chunks later, for long patterns and tiny
+		chunks). So the last pattern length - 1 bytes of the stream are kept around, and every chunk first checks the
+		matches that start in there, before it looks at its own bytes.
+	- the result is where the first match ends, so the caller knows exactly how many bytes of the chunk still belong
+		to the data it wants.
+*/
+
+constexpr size_t pattern_search_max_length = 256;
+constexpr size_t pattern_search_block_size = 16;
+constexpr size_t pattern_search_not_found = (size_t)-1;
+
+struct pattern_search_t {
+	unsigned char pattern[pattern_search_max_length];
+	size_t length = 0;
+	// NOTE: The last (up to) length - 1 bytes that were scanned, for the matches that span chunks.
+	unsigned char tail[pattern_search_max_length];
+	size_t tailSize = 0;
+};
+
+// NOTE: length has to be between 1 and pattern_search_max_length, the args parsing makes sure of that.
+inline void pattern_search_init(pattern_search_t& search, const void* pattern, size_t length) noexcept {
+	std::memcpy(search.pattern, pattern, length);
+	search.length = length;
+	search.tailSize = 0;
+}
+
+inline uint32_t pattern_search_lowest_bit(uint32_t value) noexcept {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, value);
+	return index;
+#else
+	return __builtin_ctz(value);
+#endif
+}
+
+// NOTE: Only looks for matches that are entirely inside data. Returns where the first one starts.
+inline size_t pattern_search_in_chunk(const pattern_search_t& search, const unsigned char* data, size_t size) noexcept {
+	if (size < search.length) { return pattern_search_not_found; }
+	const size_t last_start = size - search.length;
+	const size_t last_offset = search.length - 1;
+	size_t i = 0;
+
+#ifdef PATTERN_SEARCH_SSE2
+	const __m128i first_byte = _mm_set1_epi8((char)search.pattern[0]);
+	const __m128i last_byte = _mm_set1_epi8((char)search.pattern[last_offset]);
+	for (; i + pattern_search_block_size <= last_start + 1; i += pattern_search_block_size) {
+		__m128i block_first = _mm_loadu_si128((const __m128i*)(data + i));
+		__m128i block_last = _mm_loadu_si128((const __m128i*)(data + i + last_offset));
+		uint32_t candidates = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first_byte), _mm_cmpeq_epi8(block_last, last_byte)));
+		while (candidates != 0) {
+			size_t start = i + pattern_search_lowest_bit(candidates);
+			if (std::memcmp(data + start, search.pattern, search.length) == 0) { return start; }
+			candidates &= candidates - 1;
+		}
+	}
+#endif
+
+	for (; i <= last_start; i++) {
+		if (data[i] == search.pattern[0] && data[i + last_offset] == search.pattern[last_offset] && std::memcmp(data + i, search.pattern, search.length) == 0) { return i; }
+	}
+	return pattern_search_not_found;
+}
+
+// NOTE: Returns how many bytes of data there are up to and including the end of the first match (which can have started
+// in an earlier chunk), or pattern_search_not_found.
+inline size_t pattern_search_feed(pattern_search_t& search, const void* chunk, size_t size) noexcept {
+	const unsigned char* data = (const unsigned char*)chunk;
+
+	// NOTE: Matches that start in the tail, earliest first. The one starting at tail[start] needs
+	// search.length - (tailSize - start) bytes of data.
+	for (size_t start = 0; start < search.tailSize; start++) {
+		size_t fromTail = search.tailSize - start;
+		size_t fromData = search.length - fromTail;
+		if (fromData > size) { continue; }
+		if (std::memcmp(search.tail + start, search.pattern, fromTail) == 0 && std::memcmp(data, search.pattern + fromTail, fromData) == 0) { return fromData; }
+	}
+
+	size_t matchStart = pattern_search_in_chunk(search, data, size);
+	if (matchStart != pattern_search_not_found) { return matchStart + search.length; }
+
+	// NOTE: Keeps the last length - 1 bytes of the tail and the chunk combined.
+	size_t keep = search.length - 1;
+	if (size >= keep) {
+		std::memcpy(search.tail, data + size - keep, keep);
+		search.tailSize = keep;
+		return pattern_search_not_found;
+	}
+	size_t keepFromTail = keep - size < search.tailSize ? keep - size : search.tailSize;
+	std::memmove(search.tail, search.tail + search.tailSize - keepFromTail, keepFromTail);
+	std::memcpy(search.tail + keepFromTail, data, size);
+	search.tailSize = keepFromTail + size;
+	return pattern_search_not_found;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::memcpy and std::memcmp
+
+/*
+NOTE: How "--generate" and "--verify" work:
+	- the payload is xoshiro256** output, written out as little-endian 64-bit words. The seed goes through splitmix64 to
+		fill the state, which is what the xoshiro authors recommend (it can't end up all zeros that way).
+	- there are four independent xoshiro256** generators (lanes) that take turns, one word each. Each step does the same
+		thing to all four, and the state is laid out lane by lane, so the compiler turns a step into a handful of vector
+		instructions (the multiplications are by 5 and 9, which are shifts and adds, so even plain SSE2 is enough).
+	- the stream only depends on the seed, not on how it's cut up into reads and writes, so the sender and the receiver
+		can use whatever chunk sizes they want. Bytes of the last step that haven't been handed out yet are kept for the
+		next call.
+	- the verifier doesn't store anything, it regenerates the stream in small chunks as the data comes in and compares.
+*/
+
+constexpr size_t payload_generator_lane_count = 4;
+constexpr size_t payload_generator_step_size = payload_generator_lane_count * sizeof(uint64_t);
+
+struct payload_generator_t {
+	uint64_t state[4][payload_generator_lane_count];	// NOTE: state[word][lane], so every word is contiguous across the lanes.
+	unsigned char step[payload_generator_step_size];
+	size_t stepOffset = payload_generator_step_size;	// NOTE: How much of "step" has been handed out already.
+	uint64_t position = 0;					// NOTE: How many bytes have been handed out in total.
+};
+
+inline uint64_t payload_generator_rotate_left(uint64_t value, int bits) noexcept { return (value << bits) | (value >> (64 - bits)); }
+
+inline void payload_generator_seed(payload_generator_t& generator, uint64_t seed) noexcept {
+	for (size_t word = 0; word < 4; word++) {
+		for (size_t lane = 0; lane < payload_generator_lane_count; lane++) {
+			// NOTE: splitmix64.
+			uint64_t value = (seed += 0x9E3779B97F4A7C15);
+			value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+			value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+			generator.state[word][lane] = value ^ (value >> 31);
+		}
+	}
+	generator.stepOffset = payload_generator_step_size;
+	generator.position = 0;
+}
+
+// NOTE: Writes the next payload_generator_step_size bytes of the stream to output.
+inline void payload_generator_step(payload_generator_t& generator, unsigned char* output) noexcept {
+	uint64_t (&s)[4][payload_generator_lane_count] = generator.state;
+	uint64_t words[payload_generator_lane_count];
+	for (size_t lane = 0; lane < payload_generator_lane_count; lane++) {
+		words[lane] = payload_generator_rotate_left(s[1][lane] * 5, 7) * 9;
+		uint64_t t = s[1][lane] << 17;
+		s[2][lane] ^= s[0][lane];
+		s[3][lane] ^= s[1][lane];
+		s[1][lane] ^= s[2][lane];
+		s[0][lane] ^= s[3][lane];
+		s[2][lane] ^= t;
+		s[3][lane] = payload_generator_rotate_left(s[3][lane], 45);
+	}
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	for (size_t lane = 0; lane < payload_generator_lane_count; lane++) { words[lane] = __builtin_bswap64(words[lane]); }
+#endif
+	std::memcpy(output, words, sizeof(words));
+}
+
+inline void payload_generator_fill(payload_generator_t& generator, void* buffer, size_t size) noexcept {
+	unsigned char* output = (unsigned char*)buffer;
+	generator.position += size;
+
+	size_t leftover = payload_generator_step_size - generator.stepOffset;
+	if (leftover > size) { leftover = size; }
+	std::memcpy(output, generator.step + generator.stepOffset, leftover);
+	generator.stepOffset += leftover;
+	output += leftover;
+	size -= leftover;
+
+	for (; size >= payload_generator_step_size; size -= payload_generator_step_size) {
+		payload_generator_step(generator, output);
+		output += payload_generator_step_size;
+	}
+
+	if (size == 0) { return; }
+	payload_generator_step(generator, generator.step);
+	std::memcpy(output, generator.step, size);
+	generator.stepOffset = size;
+}
+
+// NOTE: Compares data against the next size bytes of the stream. Returns size if everything matches, otherwise the index
+// of the first byte that doesn't (the generator is left somewhere past it, the stream is broken at that point anyway).
+inline size_t payload_generator_find_mismatch(payload_generator_t& generator, const void* data, size_t size) noexcept {
+	const unsigned char* input = (const unsigned char*)data;
+	unsigned char expected[4096];
+	for (size_t checked = 0; checked < size; ) {
+		size_t chunk_size = size - checked < sizeof(expected) ? size - checked : sizeof(expected);
+		payload_generator_fill(generator, expected, chunk_size);
+		if (std::memcmp(expected, input + checked, chunk_size) != 0) {
+			size_t i = 0;
+			while (expected[i] == input[checked + i]) { i++; }
+			return checked + i;
+		}
+		checked += chunk_size;
+	}
+	return size;
+}
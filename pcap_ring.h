@@ -0,0 +1,292 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::memcpy, std::memset, std::memcmp and std::strlen
+#include <cstdlib>		// for std::malloc
+#include <csignal>		// for std::raise
+#include <atomic>		// for std::atomic_signal_fence
+
+#include "NetworkShepherd.h"	// for udp_packet_info_t
+
+#include "crossplatform_io.h"
+
+#include "error_reporting.h"
+
+#ifndef PLATFORM_WINDOWS
+#include <sys/mman.h>		// for mmap and munmap
+#include <fcntl.h>		// for open
+#include <unistd.h>		// for ftruncate
+#include <signal.h>		// for sigaction
+#include <netinet/in.h>		// for sockaddr_in and sockaddr_in6
+#endif
+
+/*
+NOTE: How "--pcap" works:
+	- every received packet is written as a pcap record (nanosecond timestamps, link type "raw IP") with a synthesized
+		IPv4 or IPv6 header and UDP header in front of the data, using the source address and port that recvmsg reports,
+		the destination address from IP_PKTINFO/IPV6_PKTINFO and the kernel's receive timestamp (SO_TIMESTAMPNS).
+		IPv4-mapped IPv6 addresses (IPv4 packets on a dual-stack listener) get an IPv4 header.
+	- the capture is a ring of files named <prefix>.<n>.pcap, each of them created at its full size and mapped into memory,
+		so writing a record is a memcpy. When the next record doesn't fit, the file is cut down to what's actually in it
+		and the next one in the ring is started, which overwrites the oldest capture once the ring has gone around. The
+		disk usage is bounded by file size times file count, no matter how long the capture runs.
+	- "-lu" only ends through signals, so SIGINT and SIGTERM cut the current file down before the signal does whatever
+		it would have done otherwise (print statistics, kill the process). A file that was still being written when nc got
+		killed some other way ends in zeros, which pcap readers report as a truncated capture.
+	- the UDP checksum is left at 0 ("not computed"), the IPv4 header checksum is filled in.
+*/
+
+constexpr uint32_t pcap_magic_nanoseconds = 0xA1B23C4D;
+constexpr uint32_t pcap_link_type_raw = 101;
+constexpr uint32_t pcap_snap_length = 65535;
+constexpr size_t pcap_file_header_size = 24;
+constexpr size_t pcap_record_header_size = 16;
+constexpr size_t pcap_max_ip_header_size = 40;
+constexpr size_t pcap_udp_header_size = 8;
+constexpr size_t pcap_max_record_size = pcap_record_header_size + pcap_max_ip_header_size + pcap_udp_header_size + 65535;
+constexpr uint64_t pcap_min_file_size = pcap_file_header_size + pcap_max_record_size;
+
+namespace pcap_ring {
+	inline char* path;
+	inline size_t prefixLength;
+	inline uint64_t fileSize;
+	inline uint32_t fileCount;
+	inline uint64_t sequence = 0;
+
+	// NOTE: Read by the signal handlers, which is why usedSize only ever grows after the record is completely in place.
+	inline int fd = -1;
+	inline unsigned char* file = nullptr;
+	inline uint64_t usedSize = 0;
+
+#ifndef PLATFORM_WINDOWS
+	inline struct sigaction previousInterruptAction;
+	inline struct sigaction previousTerminateAction;
+#endif
+}
+
+#ifndef PLATFORM_WINDOWS
+
+inline void pcap_ring_store_16(unsigned char* output, uint16_t value) noexcept { std::memcpy(output, &value, sizeof(value)); }
+inline void pcap_ring_store_32(unsigned char* output, uint32_t value) noexcept { std::memcpy(output, &value, sizeof(value)); }
+
+inline void pcap_ring_store_16_big_endian(unsigned char* output, uint16_t value) noexcept {
+	output[0] = value >> 8;
+	output[1] = value;
+}
+
+// NOTE: The path buffer has room for the prefix plus the biggest possible suffix.
+inline void pcap_ring_format_path(uint32_t index) noexcept {
+	char* suffix = pcap_ring::path + pcap_ring::prefixLength;
+	*(suffix++) = '.';
+	char digits[10];
+	uint8_t digit_count = 0;
+	do {
+		digits[digit_count++] = index % 10 + '0';
+		index /= 10;
+	} while (index != 0);
+	while (digit_count != 0) { *(suffix++) = digits[--digit_count]; }
+	std::memcpy(suffix, ".pcap", sizeof(".pcap"));
+}
+
+// NOTE: Only uses async-signal-safe calls, the signal handlers rely on that.
+inline void pcap_ring_finish_file() noexcept {
+	if (pcap_ring::fd == -1) { return; }
+	ftruncate(pcap_ring::fd, pcap_ring::usedSize);
+	munmap(pcap_ring::file, pcap_ring::fileSize);
+	close(pcap_ring::fd);
+	pcap_ring::fd = -1;
+}
+
+inline void pcap_ring_open_next_file() noexcept {
+	pcap_ring_finish_file();
+
+	pcap_ring_format_path(pcap_ring::sequence % pcap_ring::fileCount);
+	pcap_ring::sequence++;
+
+	int fd = ::open(pcap_ring::path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) { REPORT_ERROR_AND_EXIT("failed to open pcap file", EXIT_FAILURE); }
+	if (ftruncate(fd, pcap_ring::fileSize) == -1) { REPORT_ERROR_AND_EXIT("failed to size pcap file", EXIT_FAILURE); }
+	void* file = mmap(nullptr, pcap_ring::fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (file == MAP_FAILED) { REPORT_ERROR_AND_EXIT("failed to map pcap file into memory", EXIT_FAILURE); }
+
+	unsigned char* header = (unsigned char*)file;
+	pcap_ring_store_32(header, pcap_magic_nanoseconds);
+	pcap_ring_store_16(header + 4, 2);		// NOTE: Version 2.4, the only one there is.
+	pcap_ring_store_16(header + 6, 4);
+	pcap_ring_store_32(header + 8, 0);		// NOTE: Timestamps are UTC.
+	pcap_ring_store_32(header + 12, 0);
+	pcap_ring_store_32(header + 16, pcap_snap_length);
+	pcap_ring_store_32(header + 20, pcap_link_type_raw);
+
+	pcap_ring::file = header;
+	pcap_ring::usedSize = pcap_file_header_size;
+	pcap_ring::fd = fd;
+}
+
+inline uint16_t pcap_ring_ipv4_header_checksum(const unsigned char* header) noexcept {
+	uint32_t sum = 0;
+	for (size_t i = 0; i < 20; i += 2) { sum += (uint32_t)header[i] << 8 | header[i + 1]; }
+	while (sum >> 16) { sum = (sum & 0xFFFF) + (sum >> 16); }
+	return ~sum;
+}
+
+inline bool pcap_ring_is_ipv4_mapped(const in6_addr& address) noexcept {
+	static constexpr unsigned char prefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+	return std::memcmp(address.s6_addr, prefix, sizeof(prefix)) == 0;
+}
+
+// NOTE: Copies the IPv4 address and the port out of either kind of socket address. Returns false if there's no IPv4
+// address in it (a real IPv6 address or none at all).
+inline bool pcap_ring_get_ipv4(const sockaddr_storage& address, unsigned char (&ip)[4], uint16_t& port) noexcept {
+	if (address.ss_family == AF_INET) {
+		const sockaddr_in& address4 = (const sockaddr_in&)address;
+		std::memcpy(ip, &address4.sin_addr, sizeof(ip));
+		port = ntohs(address4.sin_port);
+		return true;
+	}
+	if (address.ss_family == AF_INET6 && pcap_ring_is_ipv4_mapped(((const sockaddr_in6&)address).sin6_addr)) {
+		const sockaddr_in6& address6 = (const sockaddr_in6&)address;
+		std::memcpy(ip, address6.sin6_addr.s6_addr + 12, sizeof(ip));
+		port = ntohs(address6.sin6_port);
+		return true;
+	}
+	return false;
+}
+
+inline void pcap_ring_get_ipv6(const sockaddr_storage& address, unsigned char (&ip)[16], uint16_t& port) noexcept {
+	if (address.ss_family != AF_INET6) {
+		std::memset(ip, 0, sizeof(ip));
+		port = 0;
+		return;
+	}
+	const sockaddr_in6& address6 = (const sockaddr_in6&)address;
+	std::memcpy(ip, address6.sin6_addr.s6_addr, sizeof(ip));
+	port = ntohs(address6.sin6_port);
+}
+
+inline size_t pcap_ring_write_ip_and_udp_headers(unsigned char* output, const udp_packet_info_t& packetInfo, size_t data_size) noexcept {
+	uint16_t source_port;
+	uint16_t destination_port;
+	size_t ip_header_size;
+
+	unsigned char source4[4];
+	if (pcap_ring_get_ipv4(packetInfo.source, source4, source_port)) {
+		unsigned char destination4[4] = { };
+		destination_port = 0;
+		pcap_ring_get_ipv4(packetInfo.destination, destination4, destination_port);
+
+		ip_header_size = 20;
+		size_t total_length = ip_header_size + pcap_udp_header_size + data_size;
+		output[0] = 0x45;		// NOTE: Version 4, 5 32-bit words of header.
+		output[1] = 0;
+		pcap_ring_store_16_big_endian(output + 2, total_length > 0xFFFF ? 0xFFFF : total_length);
+		pcap_ring_store_16_big_endian(output + 4, 0);
+		pcap_ring_store_16_big_endian(output + 6, 0x4000);		// NOTE: Don't fragment.
+		output[8] = 64;
+		output[9] = IPPROTO_UDP;
+		pcap_ring_store_16_big_endian(output + 10, 0);
+		std::memcpy(output + 12, source4, sizeof(source4));
+		std::memcpy(output + 16, destination4, sizeof(destination4));
+		pcap_ring_store_16_big_endian(output + 10, pcap_ring_ipv4_header_checksum(output));
+	} else {
+		unsigned char source6[16];
+		unsigned char destination6[16];
+		pcap_ring_get_ipv6(packetInfo.source, source6, source_port);
+		pcap_ring_get_ipv6(packetInfo.destination, destination6, destination_port);
+
+		ip_header_size = 40;
+		size_t payload_length = pcap_udp_header_size + data_size;
+		output[0] = 0x60;		// NOTE: Version 6, no traffic class, no flow label.
+		output[1] = 0;
+		output[2] = 0;
+		output[3] = 0;
+		pcap_ring_store_16_big_endian(output + 4, payload_length > 0xFFFF ? 0xFFFF : payload_length);
+		output[6] = IPPROTO_UDP;
+		output[7] = 64;
+		std::memcpy(output + 8, source6, sizeof(source6));
+		std::memcpy(output + 24, destination6, sizeof(destination6));
+	}
+
+	unsigned char* udp_header = output + ip_header_size;
+	size_t udp_length = pcap_udp_header_size + data_size;
+	pcap_ring_store_16_big_endian(udp_header, source_port);
+	pcap_ring_store_16_big_endian(udp_header + 2, destination_port);
+	pcap_ring_store_16_big_endian(udp_header + 4, udp_length > 0xFFFF ? 0xFFFF : udp_length);
+	pcap_ring_store_16_big_endian(udp_header + 6, 0);
+
+	return ip_header_size + pcap_udp_header_size;
+}
+
+inline void pcap_ring_write(const udp_packet_info_t& packetInfo, const void* data, size_t size) noexcept {
+	size_t record_size_bound = pcap_record_header_size + pcap_max_ip_header_size + pcap_udp_header_size + size;
+	if (pcap_ring::usedSize + record_size_bound > pcap_ring::fileSize) { pcap_ring_open_next_file(); }
+
+	unsigned char* record = pcap_ring::file + pcap_ring::usedSize;
+	size_t headers_size = pcap_ring_write_ip_and_udp_headers(record + pcap_record_header_size, packetInfo, size);
+	size_t captured_size = headers_size + size;
+	if (captured_size > pcap_snap_length) { captured_size = pcap_snap_length; }
+	std::memcpy(record + pcap_record_header_size + headers_size, data, captured_size - headers_size);
+
+	pcap_ring_store_32(record, packetInfo.timestamp / 1000000000);
+	pcap_ring_store_32(record + 4, packetInfo.timestamp % 1000000000);
+	pcap_ring_store_32(record + 8, captured_size);
+	pcap_ring_store_32(record + 12, headers_size + size);
+
+	// NOTE: The record has to be complete before the signal handlers can see it.
+	std::atomic_signal_fence(std::memory_order_release);
+	pcap_ring::usedSize += pcap_record_header_size + captured_size;
+}
+
+inline void pcap_ring_finish_at_exit() noexcept { pcap_ring_finish_file(); }
+
+inline void pcap_ring_signal_handler(int signal_number) noexcept {
+	pcap_ring_finish_file();
+
+	const struct sigaction& previous_action = signal_number == SIGINT ? pcap_ring::previousInterruptAction : pcap_ring::previousTerminateAction;
+	if (previous_action.sa_handler != SIG_DFL) {
+		previous_action.sa_handler(signal_number);
+		return;
+	}
+	std::signal(signal_number, SIG_DFL);
+	std::raise(signal_number);
+}
+
+// NOTE: A signal that was ignored before (SIGINT for a background job of a script, say) stays ignored, the capture
+// shouldn't be what makes it deadly.
+inline bool pcap_ring_install_signal_handler(int signal_number, struct sigaction& previous_action) noexcept {
+	if (sigaction(signal_number, nullptr, &previous_action) == -1) { return false; }
+	if (previous_action.sa_handler == SIG_IGN) { return true; }
+
+	struct sigaction action = { };
+	action.sa_handler = pcap_ring_signal_handler;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	return sigaction(signal_number, &action, nullptr) != -1;
+}
+
+// NOTE: Has to come after the other signal handlers are installed, since it passes the signals on to them.
+inline void pcap_ring_start(const char* prefix, uint64_t file_size, uint32_t file_count) noexcept {
+	pcap_ring::prefixLength = std::strlen(prefix);
+	pcap_ring::path = (char*)std::malloc(pcap_ring::prefixLength + sizeof(".4294967295.pcap"));
+	if (!pcap_ring::path) { REPORT_ERROR_AND_EXIT("failed to allocate pcap file path", EXIT_FAILURE); }
+	std::memcpy(pcap_ring::path, prefix, pcap_ring::prefixLength);
+	pcap_ring::fileSize = file_size;
+	pcap_ring::fileCount = file_count;
+
+	pcap_ring_open_next_file();
+
+	if (std::atexit(pcap_ring_finish_at_exit) != 0) { REPORT_ERROR_AND_EXIT("failed to register pcap cleanup", EXIT_FAILURE); }
+
+	if (!pcap_ring_install_signal_handler(SIGINT, pcap_ring::previousInterruptAction) || !pcap_ring_install_signal_handler(SIGTERM, pcap_ring::previousTerminateAction)) {
+		REPORT_ERROR_AND_EXIT("failed to install pcap signal handlers", EXIT_FAILURE);
+	}
+}
+
+#else
+
+// NOTE: mmap and the packet info are Linux-specific, "--pcap" is rejected on Windows while parsing the args.
+inline void pcap_ring_start(const char* prefix, uint64_t file_size, uint32_t file_count) noexcept { }
+inline void pcap_ring_write(const udp_packet_info_t& packetInfo, const void* data, size_t size) noexcept { }
+
+#endif
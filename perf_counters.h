@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cerrno>		// for errno and its values
+
+#include "crossplatform_io.h"
+
+#include "transfer_stats.h"	// for the byte and syscall counts and the text formatting
+
+#include "progress_report.h"	// for progress_report_append_size
+
+#ifndef PLATFORM_WINDOWS
+#include <linux/perf_event.h>	// for perf_event_attr and the event constants
+#include <sys/syscall.h>	// for SYS_perf_event_open
+#include <unistd.h>		// for syscall
+#endif
+
+/*
+NOTE: How "--perf" works:
+	- hardware counters are per thread (pid 0, any CPU), and each direction of a transfer has its own thread, so every
+		transfer thread opens its own set of counters when it starts and folds them into its direction's totals when
+		it's done. That also works with "-k", where every connection gets a new receiving thread.
+	- every counter is opened on its own instead of as a group, so one that the CPU (or VM) doesn't support doesn't
+		take the others down with it.
+	- if counting the kernel side isn't allowed (perf_event_paranoid >= 2), the counters are reopened for user space
+		only and the report says so. If perf events aren't allowed at all, the report says that instead of failing.
+	- if there are more counters than the PMU has room for, the kernel multiplexes them, so the values are scaled by
+		how long each counter was actually running.
+	- the syscalls per byte are the blocking calls that the transfer statistics count anyway (reads, writes, sends,
+		receives), so they're exact and don't need a counter.
+*/
+
+enum class PerfCounter : uint8_t {
+	CYCLES,
+	INSTRUCTIONS,
+	CACHE_MISSES,
+	CONTEXT_SWITCHES
+};
+
+constexpr size_t perf_counter_count = 4;
+
+struct perf_direction_counters_t {
+	int fds[perf_counter_count] = { -1, -1, -1, -1 };
+	uint64_t totals[perf_counter_count] = { };
+	bool wasCounted[perf_counter_count] = { };
+};
+
+namespace perf_counters {
+	inline perf_direction_counters_t sending;
+	inline perf_direction_counters_t receiving;
+
+	inline bool isUserSpaceOnly = false;
+	inline int openError = 0;		// NOTE: The errno of the first counter that couldn't be opened at all.
+}
+
+#ifndef PLATFORM_WINDOWS
+
+inline int perf_counters_open(PerfCounter counter, bool exclude_kernel) noexcept {
+	struct perf_event_attr attributes = { };
+	attributes.size = sizeof(attributes);
+	switch (counter) {
+	case PerfCounter::CYCLES: attributes.type = PERF_TYPE_HARDWARE; attributes.config = PERF_COUNT_HW_CPU_CYCLES; break;
+	case PerfCounter::INSTRUCTIONS: attributes.type = PERF_TYPE_HARDWARE; attributes.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+	case PerfCounter::CACHE_MISSES: attributes.type = PERF_TYPE_HARDWARE; attributes.config = PERF_COUNT_HW_CACHE_MISSES; break;
+	case PerfCounter::CONTEXT_SWITCHES: attributes.type = PERF_TYPE_SOFTWARE; attributes.config = PERF_COUNT_SW_CONTEXT_SWITCHES; break;
+	}
+	attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attributes.exclude_kernel = exclude_kernel;
+	attributes.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// NOTE: Has to be called from the thread that does the transfer in that direction.
+inline void perf_counters_begin(perf_direction_counters_t& counters) noexcept {
+	for (size_t i = 0; i < perf_counter_count; i++) {
+		int fd = perf_counters_open((PerfCounter)i, perf_counters::isUserSpaceOnly);
+		if (fd == -1 && (errno == EACCES || errno == EPERM) && !perf_counters::isUserSpaceOnly) {
+			fd = perf_counters_open((PerfCounter)i, true);
+			if (fd != -1) { perf_counters::isUserSpaceOnly = true; }
+		}
+		if (fd == -1 && perf_counters::openError == 0) { perf_counters::openError = errno; }
+		counters.fds[i] = fd;
+	}
+}
+
+inline void perf_counters_read(perf_direction_counters_t& counters) noexcept {
+	for (size_t i = 0; i < perf_counter_count; i++) {
+		if (counters.fds[i] == -1) { continue; }
+		uint64_t values[3];		// NOTE: The value, the time the counter was enabled and the time it was actually running.
+		if (::read(counters.fds[i], values, sizeof(values)) != sizeof(values) || values[2] == 0) { continue; }
+		counters.totals[i] += (unsigned __int128)values[0] * values[1] / values[2];
+		counters.wasCounted[i] = true;
+	}
+}
+
+inline void perf_counters_end(perf_direction_counters_t& counters) noexcept {
+	perf_counters_read(counters);
+	for (size_t i = 0; i < perf_counter_count; i++) {
+		if (counters.fds[i] == -1) { continue; }
+		::close(counters.fds[i]);
+		counters.fds[i] = -1;
+	}
+}
+
+#else
+
+// NOTE: perf_event_open is Linux-specific, "--perf" is rejected on Windows while parsing the args.
+inline void perf_counters_begin(perf_direction_counters_t& counters) noexcept { }
+inline void perf_counters_read(perf_direction_counters_t& counters) noexcept { }
+inline void perf_counters_end(perf_direction_counters_t& counters) noexcept { }
+
+#endif
+
+// NOTE: numerator / denominator with the given number of decimal places. Only the remainder gets scaled up, so nothing
+// overflows as long as the denominator times 10^decimals fits.
+inline void perf_counters_append_ratio(signal_safe_text_t& text, uint64_t numerator, uint64_t denominator, uint8_t decimals) noexcept {
+	uint64_t scale = 1;
+	for (uint8_t i = 0; i < decimals; i++) { scale *= 10; }
+	uint64_t fraction = numerator % denominator * scale / denominator;
+	text.append_unsigned(numerator / denominator);
+	text.append(".");
+	for (uint64_t divisor = scale / 10; divisor != 0; divisor /= 10) { text.append_unsigned(fraction / divisor % 10); }
+}
+
+template <size_t direction_name_length>
+inline void perf_counters_print_direction(const perf_direction_counters_t& counters, const transfer_direction_stats_t& stats,
+					  const char (&direction_name)[direction_name_length]) noexcept {
+	uint64_t bytes = stats.bytes.load(std::memory_order_relaxed);
+	if (bytes == 0) { return; }
+
+	signal_safe_text_t text;
+	text.append("perf: ");
+	text.append(direction_name);
+	text.append(" ");
+	progress_report_append_size(text, bytes);
+	text.append(": ");
+	perf_counters_append_ratio(text, stats.localCalls.load(std::memory_order_relaxed) + stats.networkCalls.load(std::memory_order_relaxed), bytes, 6);
+	text.append(" syscalls/byte");
+
+	if (counters.wasCounted[(size_t)PerfCounter::CYCLES]) {
+		text.append(", ");
+		perf_counters_append_ratio(text, counters.totals[(size_t)PerfCounter::CYCLES], bytes, 3);
+		text.append(" cycles/byte");
+	}
+	if (counters.wasCounted[(size_t)PerfCounter::INSTRUCTIONS]) {
+		text.append(", ");
+		perf_counters_append_ratio(text, counters.totals[(size_t)PerfCounter::INSTRUCTIONS], bytes, 3);
+		text.append(" instructions/byte");
+		if (counters.wasCounted[(size_t)PerfCounter::CYCLES] && counters.totals[(size_t)PerfCounter::CYCLES] != 0) {
+			text.append(" (IPC ");
+			perf_counters_append_ratio(text, counters.totals[(size_t)PerfCounter::INSTRUCTIONS], counters.totals[(size_t)PerfCounter::CYCLES], 2);
+			text.append(")");
+		}
+	}
+	if (counters.wasCounted[(size_t)PerfCounter::CACHE_MISSES]) {
+		text.append(", ");
+		text.append_unsigned(counters.totals[(size_t)PerfCounter::CACHE_MISSES]);
+		text.append(" cache misses");
+	}
+	if (counters.wasCounted[(size_t)PerfCounter::CONTEXT_SWITCHES]) {
+		text.append(", ");
+		text.append_unsigned(counters.totals[(size_t)PerfCounter::CONTEXT_SWITCHES]);
+		text.append(" context switches");
+	}
+	text.append("\n");
+
+	crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+}
+
+// NOTE: Threads that are still counting at exit (the UDP receiver never stops, error exits don't wait for anyone) are
+// read, but not closed, since their threads might still be using them.
+inline void perf_counters_print() noexcept {
+	perf_counters_read(perf_counters::sending);
+	perf_counters_read(perf_counters::receiving);
+
+	if (perf_counters::openError != 0) {
+		signal_safe_text_t text;
+		text.append("perf: ");
+		if (perf_counters::openError == EACCES || perf_counters::openError == EPERM) {
+			text.append("some counters aren't allowed (see /proc/sys/kernel/perf_event_paranoid), they're left out\n");
+		} else {
+			text.append("some counters aren't supported on this machine, they're left out\n");
+		}
+		crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+	}
+	if (perf_counters::isUserSpaceOnly) {
+		signal_safe_text_t text;
+		text.append("perf: kernel side isn't allowed to be counted, counts are for user space only\n");
+		crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+	}
+
+	perf_counters_print_direction(perf_counters::sending, transfer_stats::sent, "sent    ");
+	perf_counters_print_direction(perf_counters::receiving, transfer_stats::received, "received");
+}
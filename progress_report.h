@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <atomic>		// for std::atomic
+#include <chrono>		// for std::chrono::steady_clock
+#include <thread>		// for std::thread
+#include <mutex>		// for std::mutex
+#include <condition_variable>	// for std::condition_variable
+
+#include "crossplatform_io.h"
+
+#include "transfer_stats.h"	// NOTE: The progress line is just a periodic look at the transfer statistics.
+
+#ifndef PLATFORM_WINDOWS
+#include <pthread.h>		// for pthread_setschedparam
+#include <sched.h>		// for SCHED_IDLE
+#else
+#include <Windows.h>
+#endif
+
+/*
+NOTE: How the "--progress" line works:
+	- a separate thread wakes up every progress_report_interval and reads the transfer statistics counters. The transfer
+		loops don't know it exists, they don't do a single thing more than they already do for the statistics.
+	- the thread runs with the lowest scheduling priority there is, so it only gets the CPU when nothing else wants it.
+	- the line is redrawn in place with a carriage return, like pv does.
+	- if stdin is a regular file, its size is known up front and we can show how far along the sending side is and
+		estimate how long it'll take to finish (based on the average rate, since the instantaneous one jumps around).
+*/
+
+constexpr std::chrono::milliseconds progress_report_interval = std::chrono::milliseconds(1000);
+
+namespace progress_report {
+	inline long long totalSendSize = -1;	// NOTE: -1 means unknown.
+
+	inline std::thread thread;
+	inline std::mutex mutex;
+	inline std::condition_variable stopCondition;
+	inline bool shouldStop = false;
+
+	inline uint64_t lastBytes = 0;
+	inline uint64_t lastTime = 0;
+	inline size_t lastLineLength = 0;
+}
+
+// NOTE: Prints with two decimal places and binary units, which is what pv does too.
+inline void progress_report_append_size(signal_safe_text_t& text, uint64_t bytes) noexcept {
+	if (bytes < 1024) {
+		text.append_unsigned(bytes);
+		text.append(" B");
+		return;
+	}
+
+	static constexpr const char units[] = "KMGTPE";
+	uint8_t unit_index = 0;
+	uint64_t unit = 1024;
+	while (bytes / unit >= 1024 && unit_index < sizeof(units) - 2) {
+		unit *= 1024;
+		unit_index++;
+	}
+
+	text.append_unsigned(bytes / unit);
+	uint64_t hundredths = bytes % unit * 100 / unit;
+	char fraction[7] = { '.', (char)(hundredths / 10 + '0'), (char)(hundredths % 10 + '0'), ' ', units[unit_index], 'i', 'B' };
+	for (size_t i = 0; i < sizeof(fraction) && text.size < sizeof(text.data); i++) { text.data[text.size++] = fraction[i]; }
+}
+
+inline void progress_report_append_two_digits(signal_safe_text_t& text, uint64_t value) noexcept {
+	if (value < 10) { text.append("0"); }
+	text.append_unsigned(value);
+}
+
+inline void progress_report_append_duration(signal_safe_text_t& text, uint64_t seconds) noexcept {
+	text.append_unsigned(seconds / 3600);
+	text.append(":");
+	progress_report_append_two_digits(text, seconds / 60 % 60);
+	text.append(":");
+	progress_report_append_two_digits(text, seconds % 60);
+}
+
+inline void progress_report_print(bool is_final) noexcept {
+	uint64_t now = transfer_stats_now();
+	uint64_t sent_bytes = transfer_stats::sent.bytes.load(std::memory_order_relaxed);
+	uint64_t bytes = sent_bytes + transfer_stats::received.bytes.load(std::memory_order_relaxed);
+
+	uint64_t elapsed = now - transfer_stats::startTime;
+	uint64_t average_rate = transfer_stats_per_second(bytes, elapsed);
+	uint64_t current_rate = transfer_stats_per_second(bytes - progress_report::lastBytes, now - progress_report::lastTime);
+	progress_report::lastBytes = bytes;
+	progress_report::lastTime = now;
+
+	signal_safe_text_t text;
+	text.append("\r");
+	progress_report_append_size(text, bytes);
+	text.append(" ");
+	progress_report_append_duration(text, elapsed / 1000000000);
+	if (!is_final) {
+		text.append(" [");
+		progress_report_append_size(text, current_rate);
+		text.append("/s]");
+	}
+	text.append(" (avg ");
+	progress_report_append_size(text, average_rate);
+	text.append("/s)");
+
+	if (progress_report::totalSendSize > 0) {
+		uint64_t total = progress_report::totalSendSize;
+		uint64_t done = sent_bytes < total ? sent_bytes : total;
+		text.append(" ");
+		text.append_unsigned(done * 100 / total);
+		text.append("%");
+
+		uint64_t average_send_rate = transfer_stats_per_second(sent_bytes, elapsed);
+		if (!is_final && average_send_rate != 0) {
+			text.append(" ETA ");
+			progress_report_append_duration(text, (total - done) / average_send_rate);
+		}
+	}
+
+	// NOTE: Pad with spaces so that nothing of a previous, longer line is left over.
+	size_t line_length = text.size;
+	while (text.size < progress_report::lastLineLength && text.size < sizeof(text.data)) { text.data[text.size++] = ' '; }
+	progress_report::lastLineLength = line_length;
+
+	if (is_final) { text.append("\n"); }
+
+	crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+}
+
+inline void progress_report_lower_thread_priority() noexcept {
+	// NOTE: Failing to do this isn't a reason to stop the transfer, the reporting just competes a bit more for the CPU then.
+#ifndef PLATFORM_WINDOWS
+	struct sched_param parameters = { };
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &parameters);
+#else
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#endif
+}
+
+inline void progress_report_thread() noexcept {
+	progress_report_lower_thread_priority();
+
+	std::unique_lock<std::mutex> lock(progress_report::mutex);
+	while (!progress_report::stopCondition.wait_for(lock, progress_report_interval, []() noexcept { return progress_report::shouldStop; })) {
+		progress_report_print(false);
+	}
+}
+
+// NOTE: Runs at exit, stops the thread and leaves the final numbers on their own line.
+inline void progress_report_finish() noexcept {
+	{
+		std::lock_guard<std::mutex> lock(progress_report::mutex);
+		progress_report::shouldStop = true;
+	}
+	progress_report::stopCondition.notify_one();
+	if (progress_report::thread.joinable()) { progress_report::thread.join(); }
+
+	progress_report_print(true);
+}
+
+// NOTE: Has to be called after the transfer statistics have been set up, since it relies on their start time.
+inline void progress_report_start(long long total_send_size) noexcept {
+	progress_report::totalSendSize = total_send_size;
+	progress_report::lastTime = transfer_stats::startTime;
+
+	// NOTE: Cast is necessary because (for whatever reason) thread only accepts non-noexcept function ptr types.
+	progress_report::thread = std::thread((void (*)())progress_report_thread);
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::memcpy and std::strlen
+#include <cstdlib>		// for std::malloc
+
+#include "crossplatform_io.h"
+
+#include "error_reporting.h"
+
+#include "transfer_stats.h"	// for the clock
+
+#include "async_file_writer.h"	// for writing the file off the receiving thread
+
+#ifndef PLATFORM_WINDOWS
+#include <fcntl.h>		// for open
+#include <unistd.h>		// for fsync
+#include <sys/stat.h>		// for fstat
+#include <cstdio>		// for std::rename
+#include <ctime>		// for time and gmtime_r
+#endif
+
+/*
+NOTE: How "--output" works:
+	- received data goes to <path> instead of stdout, through an async_file_writer_t. The rotations happen on its writer
+		thread, so the receive loops never wait for them.
+	- with "--rotate-size", every file gets exactly that many bytes (like "split -b"), with "--rotate-interval" a file is
+		closed once it has been open for that long (if anything was written to it). Both can be used together.
+	- rotating means fsync, close and an atomic rename of <path> to <path>.<UTC start time>.<n>, then a new, empty <path>.
+		Whatever picks up the rotated files never sees one that's still being written. The files are named after when
+		they were started, and <n> counts the ones that started in the same second, zero-padded to a fixed width, so a
+		plain sort puts them in order.
+	- an existing <path> is appended to, so restarting nc carries on where it left off.
+	- on a normal exit, the rest of the buffer is written out and <path> is synced, but not rotated. "-lu" and "-lk" end
+		through signals, which only lose what the writer thread hadn't picked up yet (it picks up data as soon as there
+		is any).
+*/
+
+// NOTE: Every rotation takes an fsync and a rename, a million of those in one second isn't going to happen.
+constexpr uint8_t rotating_output_sequence_digits = 6;
+
+namespace rotating_output {
+	inline const char* path;
+	inline size_t pathLength;
+	inline char* rotatedPath;
+
+	inline uint64_t rotateSize = 0;		// NOTE: 0 means no size limit.
+	inline uint64_t rotateInterval = 0;	// NOTE: Nanoseconds, 0 means no time limit.
+
+	// NOTE: Only touched by the writer thread once it's running.
+	inline int fd = -1;
+	inline uint64_t fileSize;
+	inline uint64_t fileStartTime;
+	inline int64_t fileStartWallTime;
+	inline int64_t sequenceWallTime = -1;
+	inline uint64_t sequence;
+
+	inline async_file_writer_t writer;
+}
+
+#ifndef PLATFORM_WINDOWS
+
+inline bool rotating_output_open() noexcept {
+	rotating_output::fd = ::open(rotating_output::path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (rotating_output::fd == -1) { return false; }
+	struct stat status;
+	if (fstat(rotating_output::fd, &status) == -1) { return false; }
+	rotating_output::fileSize = status.st_size;
+	rotating_output::fileStartTime = transfer_stats_now();
+	rotating_output::fileStartWallTime = time(nullptr);
+	return true;
+}
+
+inline void rotating_output_append_number(char*& output, uint64_t value, uint8_t minimum_digits) noexcept {
+	char digits[20];
+	uint8_t digit_count = 0;
+	do {
+		digits[digit_count++] = value % 10 + '0';
+		value /= 10;
+	} while (value != 0 || digit_count < minimum_digits);
+	while (digit_count != 0) { *(output++) = digits[--digit_count]; }
+}
+
+// NOTE: <path>.YYYYmmddTHHMMSSZ.<n>
+inline void rotating_output_format_rotated_path() noexcept {
+	std::memcpy(rotating_output::rotatedPath, rotating_output::path, rotating_output::pathLength);
+	char* output = rotating_output::rotatedPath + rotating_output::pathLength;
+
+	time_t start_time = rotating_output::fileStartWallTime;
+	struct tm start;
+	gmtime_r(&start_time, &start);
+	*(output++) = '.';
+	rotating_output_append_number(output, start.tm_year + 1900, 4);
+	rotating_output_append_number(output, start.tm_mon + 1, 2);
+	rotating_output_append_number(output, start.tm_mday, 2);
+	*(output++) = 'T';
+	rotating_output_append_number(output, start.tm_hour, 2);
+	rotating_output_append_number(output, start.tm_min, 2);
+	rotating_output_append_number(output, start.tm_sec, 2);
+	*(output++) = 'Z';
+	*(output++) = '.';
+	if (rotating_output::fileStartWallTime != rotating_output::sequenceWallTime) {
+		rotating_output::sequenceWallTime = rotating_output::fileStartWallTime;
+		rotating_output::sequence = 0;
+	}
+	rotating_output_append_number(output, rotating_output::sequence++, rotating_output_sequence_digits);
+	*output = '\0';
+}
+
+inline bool rotating_output_rotate() noexcept {
+	if (fsync(rotating_output::fd) == -1) { return false; }
+	if (close(rotating_output::fd) == -1) { return false; }
+	rotating_output::fd = -1;
+	rotating_output_format_rotated_path();
+	if (std::rename(rotating_output::path, rotating_output::rotatedPath) == -1) { return false; }
+	return rotating_output_open();
+}
+
+inline bool rotating_output_is_due_by_time() noexcept {
+	return rotating_output::rotateInterval != 0 && transfer_stats_now() - rotating_output::fileStartTime >= rotating_output::rotateInterval;
+}
+
+// NOTE: Splits the data where the size limit says so.
+inline bool rotating_output_write(const unsigned char* data, size_t size) noexcept {
+	while (size != 0) {
+		if (rotating_output_is_due_by_time() && rotating_output::fileSize != 0 && !rotating_output_rotate()) { return false; }
+
+		size_t chunk_size = size;
+		if (rotating_output::rotateSize != 0 && rotating_output::rotateSize - rotating_output::fileSize < chunk_size) {
+			chunk_size = rotating_output::rotateSize - rotating_output::fileSize;
+		}
+		if (!crossplatform_write_entire_buffer(rotating_output::fd, data, chunk_size)) { return false; }
+		rotating_output::fileSize += chunk_size;
+		data += chunk_size;
+		size -= chunk_size;
+
+		if (rotating_output::rotateSize != 0 && rotating_output::fileSize >= rotating_output::rotateSize && !rotating_output_rotate()) { return false; }
+	}
+	return true;
+}
+
+inline bool rotating_output_flush(const unsigned char* data, size_t size) noexcept {
+	if (!rotating_output_write(data, size)) { return false; }
+	if (size != 0 || !rotating_output_is_due_by_time()) { return true; }
+
+	// NOTE: Nothing written for a whole interval, an empty file isn't worth keeping around, just start the clock over.
+	if (rotating_output::fileSize == 0) {
+		rotating_output::fileStartTime = transfer_stats_now();
+		rotating_output::fileStartWallTime = time(nullptr);
+		return true;
+	}
+	return rotating_output_rotate();
+}
+
+// NOTE: Wakes the writer thread up when the file is due, so that quiet periods still end up in their own file.
+inline uint64_t rotating_output_time_left() noexcept {
+	uint64_t file_age = transfer_stats_now() - rotating_output::fileStartTime;
+	return file_age < rotating_output::rotateInterval ? rotating_output::rotateInterval - file_age : 0;
+}
+
+// NOTE: The first file is opened up front, so that a bad path is reported before the transfer.
+inline void rotating_output_start(const char* path, uint64_t rotate_size, uint64_t rotate_interval) noexcept {
+	rotating_output::path = path;
+	rotating_output::pathLength = std::strlen(path);
+	rotating_output::rotatedPath = (char*)std::malloc(rotating_output::pathLength + sizeof(".YYYYmmddTHHMMSSZ.18446744073709551615"));
+	rotating_output::rotateSize = rotate_size;
+	rotating_output::rotateInterval = rotate_interval;
+
+	if (!rotating_output::rotatedPath) { REPORT_ERROR_AND_EXIT("failed to allocate output buffers", EXIT_FAILURE); }
+
+	if (!rotating_output_open()) { REPORT_ERROR_AND_EXIT("failed to open output file", EXIT_FAILURE); }
+
+	if (!async_file_writer_start(rotating_output::writer, rotating_output_flush, rotate_interval != 0 ? rotating_output_time_left : nullptr)) {
+		REPORT_ERROR_AND_EXIT("failed to allocate output buffers", EXIT_FAILURE);
+	}
+}
+
+inline void rotating_output_append(const void* data, size_t size) noexcept {
+	if (!async_file_writer_append(rotating_output::writer, data, size)) { REPORT_ERROR_AND_EXIT("failed to write or rotate output file", EXIT_FAILURE); }
+}
+
+// NOTE: Writes out whatever is still buffered. Runs at exit, which covers error exits too.
+inline void rotating_output_stop() noexcept {
+	if (!rotating_output::writer.thread.joinable()) { return; }
+	async_file_writer_stop(rotating_output::writer);
+	if (rotating_output::fd == -1) { return; }
+	fsync(rotating_output::fd);
+	close(rotating_output::fd);
+}
+
+#else
+
+// NOTE: "--output" is rejected on Windows while parsing the args.
+inline void rotating_output_start(const char* path, uint64_t rotate_size, uint64_t rotate_interval) noexcept { }
+inline void rotating_output_append(const void* data, size_t size) noexcept { }
+inline void rotating_output_stop() noexcept { }
+
+#endif
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::memcpy and std::memcmp
+
+#include "NetworkShepherd.h"
+
+#include "crossplatform_io.h"
+
+#include "error_reporting.h"
+
+#include "chacha20_poly1305.h"
+
+#ifndef PLATFORM_WINDOWS
+#include <sys/random.h>		// for getrandom
+#include <cerrno>		// for errno
+#else
+#include <Windows.h>
+#include <bcrypt.h>		// for BCryptGenRandom
+#pragma comment(lib, "bcrypt.lib")
+#endif
+
+/*
+NOTE: How the "--psk" encryption works:
+	- handshake: Both sides send a hello (magic + 16 random salt bytes) and then read the hello of the other side.
+	- key derivation: Each direction gets its own key, derived from the pre-shared key and both salts with HChaCha20:
+		key(A -> B) = HChaCha20(HChaCha20(psk, salt(A)), salt(B))
+		Both salts are fresh for every connection, so keys (and with them nonces) never repeat across connections.
+	- records: [4-byte big-endian plaintext length][ciphertext][16-byte Poly1305 tag]
+		The length is authenticated as additional data. The nonce is the sender's role (connecting side or listening side)
+		followed by a per-direction record counter. The role is in there so that a reflected stream doesn't authenticate.
+	- end of stream: The sender sends an empty record before it shuts down its write side. If the connection ends
+		without one, somebody cut the stream short and we report that instead of pretending everything arrived.
+	- nothing gets to stdout before its tag has been checked.
+*/
+
+constexpr size_t secure_channel_key_size = chacha20_key_size;
+constexpr size_t secure_channel_salt_size = hchacha20_input_size;
+constexpr unsigned char secure_channel_magic[8] = { 'n', 'c', '-', 'p', 's', 'k', 0, 1 };	// NOTE: The last byte is the version.
+constexpr size_t secure_channel_hello_size = sizeof(secure_channel_magic) + secure_channel_salt_size;
+constexpr size_t secure_channel_record_header_size = 4;
+constexpr size_t secure_channel_max_record_payload = 16384;
+
+enum class SecureChannelRole : uint32_t {
+	CONNECTOR = 0,
+	LISTENER = 1
+};
+
+namespace secure_channel {
+	inline unsigned char preSharedKey[secure_channel_key_size];
+
+	inline SecureChannelRole role;
+
+	// NOTE: Only touched by the thread that sends.
+	inline unsigned char sendKey[secure_channel_key_size];
+	inline uint64_t sendCounter;
+	inline unsigned char sendBuffer[secure_channel_record_header_size + secure_channel_max_record_payload + poly1305_tag_size];
+
+	// NOTE: Only touched by the thread that receives.
+	inline unsigned char receiveKey[secure_channel_key_size];
+	inline uint64_t receiveCounter;
+	inline unsigned char receiveBuffer[secure_channel_max_record_payload + poly1305_tag_size];
+	inline size_t receivePosition;
+	inline size_t receiveSize;
+	inline bool receivedEndOfStream;
+}
+
+inline void fill_with_random_bytes(void* buffer, size_t size) noexcept {
+#ifndef PLATFORM_WINDOWS
+	unsigned char* byte_buffer = (unsigned char*)buffer;
+	while (size != 0) {
+		ssize_t bytes_generated = getrandom(byte_buffer, size, 0);
+		if (bytes_generated == -1) {
+			if (errno == EINTR) { continue; }
+			REPORT_ERROR_AND_EXIT("failed to generate random bytes", EXIT_FAILURE);
+		}
+		byte_buffer += bytes_generated;
+		size -= bytes_generated;
+	}
+#else
+	if (BCryptGenRandom(nullptr, (PUCHAR)buffer, (ULONG)size, BCRYPT_USE_SYSTEM_PREFERRED_RNG) != 0) {
+		REPORT_ERROR_AND_EXIT("failed to generate random bytes", EXIT_FAILURE);
+	}
+#endif
+}
+
+inline void load_pre_shared_key(const char* path) noexcept {
+	int fd = crossplatform_open_file(path);
+	if (fd == -1) { REPORT_ERROR_AND_EXIT("failed to open pre-shared key file", EXIT_FAILURE); }
+
+	// NOTE: Read one byte more than we need, so that we notice files that are too long.
+	unsigned char key[secure_channel_key_size + 1];
+	sioret_t key_size = crossplatform_read_entire_buffer(fd, key, sizeof(key));
+	if (key_size == -1) { REPORT_ERROR_AND_EXIT("failed to read pre-shared key file", EXIT_FAILURE); }
+	if (key_size != secure_channel_key_size) { REPORT_ERROR_AND_EXIT("pre-shared key file must contain exactly 32 bytes", EXIT_FAILURE); }
+
+	if (crossplatform_close(fd) == -1) { REPORT_ERROR_AND_EXIT("failed to close pre-shared key file", EXIT_FAILURE); }
+
+	std::memcpy(secure_channel::preSharedKey, key, secure_channel_key_size);
+}
+
+inline void secure_channel_read_entire_buffer(void* buffer, size_t size) noexcept {
+	unsigned char* byte_buffer = (unsigned char*)buffer;
+	while (size != 0) {
+		size_t bytes_read = NetworkShepherd::read(byte_buffer, size);
+		if (bytes_read == 0) { REPORT_ERROR_AND_EXIT("encrypted stream ended abruptly, data may have been truncated", EXIT_FAILURE); }
+		byte_buffer += bytes_read;
+		size -= bytes_read;
+	}
+}
+
+inline void secure_channel_derive_key(const unsigned char* first_salt, const unsigned char* second_salt, unsigned char* key) noexcept {
+	unsigned char intermediate_key[secure_channel_key_size];
+	hchacha20(secure_channel::preSharedKey, first_salt, intermediate_key);
+	hchacha20(intermediate_key, second_salt, key);
+}
+
+// NOTE: Has to happen before the receiving thread is started, since it sets up state for both threads.
+inline void secure_channel_handshake(SecureChannelRole role) noexcept {
+	unsigned char hello[secure_channel_hello_size];
+	std::memcpy(hello, secure_channel_magic, sizeof(secure_channel_magic));
+	unsigned char* salt = hello + sizeof(secure_channel_magic);
+	fill_with_random_bytes(salt, secure_channel_salt_size);
+	NetworkShepherd::write(hello, sizeof(hello));
+
+	// NOTE: The magic is checked before waiting for the salt, so that a remote without "--psk" gets a proper error message
+	// even if it sends less than a whole hello.
+	unsigned char peer_hello[secure_channel_hello_size];
+	unsigned char* peer_salt = peer_hello + sizeof(secure_channel_magic);
+	secure_channel_read_entire_buffer(peer_hello, sizeof(secure_channel_magic));
+	if (std::memcmp(peer_hello, secure_channel_magic, sizeof(secure_channel_magic)) != 0) {
+		REPORT_ERROR_AND_EXIT("encryption handshake failed, remote didn't start an encrypted session (\"--psk\" has to be specified on both ends)", EXIT_FAILURE);
+	}
+	secure_channel_read_entire_buffer(peer_salt, secure_channel_salt_size);
+	if (std::memcmp(salt, peer_salt, secure_channel_salt_size) == 0) {
+		REPORT_ERROR_AND_EXIT("encryption handshake failed, remote reflected our hello", EXIT_FAILURE);
+	}
+
+	secure_channel::role = role;
+
+	secure_channel_derive_key(salt, peer_salt, secure_channel::sendKey);
+	secure_channel::sendCounter = 0;
+
+	secure_channel_derive_key(peer_salt, salt, secure_channel::receiveKey);
+	secure_channel::receiveCounter = 0;
+	secure_channel::receivePosition = 0;
+	secure_channel::receiveSize = 0;
+	secure_channel::receivedEndOfStream = false;
+}
+
+inline void secure_channel_construct_nonce(unsigned char* nonce, SecureChannelRole role, uint64_t counter) noexcept {
+	chacha20_store32(nonce, (uint32_t)role);
+	chacha20_store32(nonce + 4, (uint32_t)counter);
+	chacha20_store32(nonce + 8, (uint32_t)(counter >> 32));
+}
+
+inline void secure_channel_send_record(const unsigned char* data, size_t size) noexcept {
+	unsigned char* header = secure_channel::sendBuffer;
+	header[0] = (unsigned char)(size >> 24);
+	header[1] = (unsigned char)(size >> 16);
+	header[2] = (unsigned char)(size >> 8);
+	header[3] = (unsigned char)size;
+
+	unsigned char nonce[chacha20_nonce_size];
+	secure_channel_construct_nonce(nonce, secure_channel::role, secure_channel::sendCounter++);
+
+	unsigned char* ciphertext = header + secure_channel_record_header_size;
+	chacha20_poly1305_encrypt(secure_channel::sendKey, nonce, header, secure_channel_record_header_size, data, size, ciphertext, ciphertext + size);
+
+	NetworkShepherd::write(secure_channel::sendBuffer, secure_channel_record_header_size + size + poly1305_tag_size);
+}
+
+inline void secure_channel_send(const void* buffer, size_t size) noexcept {
+	const unsigned char* byte_buffer = (const unsigned char*)buffer;
+	while (size != 0) {
+		size_t record_size = size < secure_channel_max_record_payload ? size : secure_channel_max_record_payload;
+		secure_channel_send_record(byte_buffer, record_size);
+		byte_buffer += record_size;
+		size -= record_size;
+	}
+}
+
+inline void secure_channel_send_end_of_stream() noexcept { secure_channel_send_record(nullptr, 0); }
+
+// NOTE: Works like NetworkShepherd::read: Returns 0 on end of stream and never returns errors (those terminate the program).
+inline size_t secure_channel_receive(void* buffer, size_t size) noexcept {
+	if (secure_channel::receivePosition == secure_channel::receiveSize) {
+		if (secure_channel::receivedEndOfStream) { return 0; }
+
+		unsigned char header[secure_channel_record_header_size];
+		secure_channel_read_entire_buffer(header, sizeof(header));
+		size_t record_size = ((size_t)header[0] << 24) | ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | (size_t)header[3];
+		if (record_size > secure_channel_max_record_payload) { REPORT_ERROR_AND_EXIT("decryption failed, record too big (wrong key or tampered data)", EXIT_FAILURE); }
+
+		secure_channel_read_entire_buffer(secure_channel::receiveBuffer, record_size + poly1305_tag_size);
+
+		unsigned char nonce[chacha20_nonce_size];
+		SecureChannelRole peer_role = secure_channel::role == SecureChannelRole::CONNECTOR ? SecureChannelRole::LISTENER : SecureChannelRole::CONNECTOR;
+		secure_channel_construct_nonce(nonce, peer_role, secure_channel::receiveCounter++);
+
+		if (!chacha20_poly1305_decrypt(secure_channel::receiveKey, nonce, header, sizeof(header), secure_channel::receiveBuffer, record_size,
+					       secure_channel::receiveBuffer + record_size, secure_channel::receiveBuffer)) {
+			REPORT_ERROR_AND_EXIT("decryption failed, message authentication failed (wrong key or tampered data)", EXIT_FAILURE);
+		}
+
+		if (record_size == 0) { secure_channel::receivedEndOfStream = true; return 0; }
+
+		secure_channel::receivePosition = 0;
+		secure_channel::receiveSize = record_size;
+	}
+
+	size_t available = secure_channel::receiveSize - secure_channel::receivePosition;
+	size_t result = size < available ? size : available;
+	std::memcpy(buffer, secure_channel::receiveBuffer + secure_channel::receivePosition, result);
+	secure_channel::receivePosition += result;
+	return result;
+}
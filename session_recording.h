@@ -0,0 +1,279 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::memcpy and std::memcmp
+#include <atomic>		// for std::atomic
+#include <chrono>		// for std::chrono::nanoseconds
+#include <thread>		// for std::this_thread::sleep_for
+#include <mutex>		// for std::mutex
+
+#include "crossplatform_io.h"
+
+#include "error_reporting.h"
+
+#include "transfer_stats.h"	// for the clock and the text formatting
+
+#include "latency_histogram.h"	// for the response latencies
+
+#include "async_file_writer.h"	// for writing the file off the transfer threads
+
+/*
+NOTE: How "--record" and "--replay" work:
+	- a recording is a header (magic, version, whether the recorder was the listening side) followed by one record per
+		chunk that went over the connection, in the order in which they happened. A record is the time since the previous
+		record in nanoseconds, the chunk size shifted left by one with the direction in the lowest bit (0 = sent by the
+		recorder, 1 = received by it), both as LEB128 varints, and then the chunk itself. A small chunk costs 3-4 bytes of
+		overhead that way.
+	- both transfer threads append their records under a mutex (which also makes the timestamps come out in order), the
+		file itself is written by an async_file_writer_t.
+	- replaying sends the chunks that the client (the connecting side) sent, with the same sizes and (at 1x) the same
+		timing, measured from the start of the connection. Nx divides all the times by N, max doesn't wait at all.
+	- the response latency is the time from the last chunk the client sent to the first chunk that came back after it.
+		The recorded latencies come from the timestamps in the file, the replayed ones are measured live, so the two can be
+		compared directly.
+*/
+
+enum class SessionDirection : uint8_t {
+	SENT,
+	RECEIVED
+};
+
+constexpr unsigned char session_recording_magic[8] = { 'n', 'c', 'r', 'e', 'c', 0, 0, 1 };
+constexpr size_t session_recording_header_size = sizeof(session_recording_magic) + 1;
+constexpr size_t session_recording_max_varint_size = 10;
+
+namespace session_recording {
+	inline int fd = -1;
+	inline async_file_writer_t writer;
+
+	// NOTE: Held for a whole record, so that the two transfer threads' records don't get mixed up.
+	inline std::mutex mutex;
+	inline uint64_t lastTime = 0;
+}
+
+inline size_t session_recording_encode_varint(unsigned char* output, uint64_t value) noexcept {
+	size_t size = 0;
+	while (value >= 0x80) {
+		output[size++] = (unsigned char)value | 0x80;
+		value >>= 7;
+	}
+	output[size++] = (unsigned char)value;
+	return size;
+}
+
+inline bool session_recording_write(const unsigned char* data, size_t size) noexcept {
+	return crossplatform_write_entire_buffer(session_recording::fd, data, size);
+}
+
+// NOTE: The file is opened and the header is written up front, so that a bad path is reported before the transfer.
+inline void session_recording_start(const char* path, bool is_listener) noexcept {
+	session_recording::fd = crossplatform_create_file(path);
+	if (session_recording::fd == -1) { REPORT_ERROR_AND_EXIT("failed to open recording file", EXIT_FAILURE); }
+
+	unsigned char header[session_recording_header_size];
+	std::memcpy(header, session_recording_magic, sizeof(session_recording_magic));
+	header[sizeof(session_recording_magic)] = is_listener;
+	if (!crossplatform_write_entire_buffer(session_recording::fd, header, sizeof(header))) { REPORT_ERROR_AND_EXIT("failed to write to recording file", EXIT_FAILURE); }
+
+	session_recording::lastTime = transfer_stats_now();
+
+	if (!async_file_writer_start(session_recording::writer, session_recording_write, nullptr)) { REPORT_ERROR_AND_EXIT("failed to allocate recording buffers", EXIT_FAILURE); }
+}
+
+// NOTE: Times in the recording are relative to the start of the connection, not to when nc started.
+inline void session_recording_begin_connection() noexcept {
+	std::lock_guard<std::mutex> lock(session_recording::mutex);
+	session_recording::lastTime = transfer_stats_now();
+}
+
+inline void session_recording_append(SessionDirection direction, const void* data, size_t size) noexcept {
+	std::unique_lock<std::mutex> lock(session_recording::mutex);
+	uint64_t now = transfer_stats_now();
+	unsigned char header[2 * session_recording_max_varint_size];
+	size_t header_size = session_recording_encode_varint(header, now - session_recording::lastTime);
+	header_size += session_recording_encode_varint(header + header_size, (uint64_t)size << 1 | (uint64_t)direction);
+	session_recording::lastTime = now;
+
+	if (!async_file_writer_append(session_recording::writer, header, header_size) || !async_file_writer_append(session_recording::writer, data, size)) {
+		lock.unlock();
+		REPORT_ERROR_AND_EXIT("failed to write to recording file", EXIT_FAILURE);
+	}
+}
+
+// NOTE: Writes out whatever is still buffered. Runs at exit, which covers error exits too.
+inline void session_recording_stop() noexcept {
+	if (!session_recording::writer.thread.joinable()) { return; }
+	async_file_writer_stop(session_recording::writer);
+
+	// NOTE: Nothing we could do about a failed close at this point, we're on our way out anyway.
+	crossplatform_close(session_recording::fd);
+}
+
+namespace session_replay {
+	inline int fd = -1;
+
+	inline unsigned char buffer[64 * 1024];
+	inline size_t bufferStart = 0;
+	inline size_t bufferEnd = 0;
+
+	inline SessionDirection clientDirection;
+	inline uint64_t speed = 1;		// NOTE: 0 means as fast as possible.
+
+	inline uint64_t startTime;
+	inline uint64_t recordedTime = 0;
+	inline uint64_t remainingChunkBytes = 0;
+	inline uint64_t replayedChunks = 0;
+
+	inline bool hasPendingRecordedRequest = false;
+	inline uint64_t pendingRecordedRequestTime;
+	inline std::atomic<uint64_t> pendingRequestTime { 0 };		// NOTE: 0 means no request is waiting for a response.
+
+	inline latency_histogram_t recordedLatencies;
+	inline latency_histogram_t replayedLatencies;
+}
+
+// NOTE: Returns false if the file is at its end.
+inline bool session_replay_fill() noexcept {
+	if (session_replay::bufferStart != session_replay::bufferEnd) { return true; }
+	sioret_t bytes_read = crossplatform_read(session_replay::fd, session_replay::buffer, sizeof(session_replay::buffer));
+	if (bytes_read == -1) { REPORT_ERROR_AND_EXIT("failed to read from recording file", EXIT_FAILURE); }
+	session_replay::bufferStart = 0;
+	session_replay::bufferEnd = bytes_read;
+	return bytes_read != 0;
+}
+
+// NOTE: Returns false if the file ends cleanly before the varint starts.
+inline bool session_replay_read_varint(uint64_t& value) noexcept {
+	value = 0;
+	for (uint8_t shift = 0; ; shift += 7) {
+		if (shift >= 64) { REPORT_ERROR_AND_EXIT("recording file is corrupted", EXIT_FAILURE); }
+		if (!session_replay_fill()) {
+			if (shift == 0) { return false; }
+			REPORT_ERROR_AND_EXIT("recording file is truncated", EXIT_FAILURE);
+		}
+		unsigned char byte = session_replay::buffer[session_replay::bufferStart++];
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) { return true; }
+	}
+}
+
+// NOTE: output can be nullptr, which skips the data.
+inline void session_replay_read_data(void* output, size_t size) noexcept {
+	while (size != 0) {
+		if (!session_replay_fill()) { REPORT_ERROR_AND_EXIT("recording file is truncated", EXIT_FAILURE); }
+		size_t available = session_replay::bufferEnd - session_replay::bufferStart;
+		size_t chunk_size = available < size ? available : size;
+		if (output) {
+			std::memcpy(output, session_replay::buffer + session_replay::bufferStart, chunk_size);
+			output = (unsigned char*)output + chunk_size;
+		}
+		session_replay::bufferStart += chunk_size;
+		size -= chunk_size;
+	}
+}
+
+inline void session_replay_start(const char* path, uint64_t speed) noexcept {
+	session_replay::fd = crossplatform_open_file(path);
+	if (session_replay::fd == -1) { REPORT_ERROR_AND_EXIT("failed to open recording file", EXIT_FAILURE); }
+
+	unsigned char header[session_recording_header_size];
+	if (crossplatform_read_entire_buffer(session_replay::fd, header, sizeof(header)) != sizeof(header) ||
+	    std::memcmp(header, session_recording_magic, sizeof(session_recording_magic)) != 0) {
+		REPORT_ERROR_AND_EXIT("recording file is invalid or from an incompatible version", EXIT_FAILURE);
+	}
+	// NOTE: If the recorder was listening, what it received is what the client sent.
+	session_replay::clientDirection = header[sizeof(session_recording_magic)] ? SessionDirection::RECEIVED : SessionDirection::SENT;
+	session_replay::speed = speed;
+}
+
+inline void session_replay_begin_connection() noexcept { session_replay::startTime = transfer_stats_now(); }
+
+// NOTE: Hands out the client's chunks in place of stdin, waiting until each one is due. A chunk that doesn't fit into
+// size is handed out over several calls, only the first one waits. Returns 0 at the end of the recording.
+inline size_t session_replay_read(void* output, size_t size) noexcept {
+	while (session_replay::remainingChunkBytes == 0) {
+		uint64_t delta;
+		if (!session_replay_read_varint(delta)) { return 0; }
+		uint64_t size_and_direction;
+		if (!session_replay_read_varint(size_and_direction)) { REPORT_ERROR_AND_EXIT("recording file is truncated", EXIT_FAILURE); }
+		session_replay::recordedTime += delta;
+		uint64_t chunk_size = size_and_direction >> 1;
+
+		if ((SessionDirection)(size_and_direction & 1) != session_replay::clientDirection) {
+			if (session_replay::hasPendingRecordedRequest) {
+				latency_histogram_record(session_replay::recordedLatencies, session_replay::recordedTime - session_replay::pendingRecordedRequestTime);
+				session_replay::hasPendingRecordedRequest = false;
+			}
+			session_replay_read_data(nullptr, chunk_size);
+			continue;
+		}
+
+		session_replay::hasPendingRecordedRequest = true;
+		session_replay::pendingRecordedRequestTime = session_replay::recordedTime;
+		session_replay::remainingChunkBytes = chunk_size;
+		session_replay::replayedChunks++;
+
+		if (session_replay::speed != 0) {
+			uint64_t due = session_replay::startTime + session_replay::recordedTime / session_replay::speed;
+			uint64_t now = transfer_stats_now();
+			if (due > now) { std::this_thread::sleep_for(std::chrono::nanoseconds(due - now)); }
+		}
+		session_replay::pendingRequestTime.store(transfer_stats_now(), std::memory_order_relaxed);
+	}
+
+	if (size > session_replay::remainingChunkBytes) { size = session_replay::remainingChunkBytes; }
+	session_replay_read_data(output, size);
+	session_replay::remainingChunkBytes -= size;
+	return size;
+}
+
+// NOTE: Called by the receiving thread for every chunk that comes back.
+inline void session_replay_observe_response() noexcept {
+	uint64_t request_time = session_replay::pendingRequestTime.exchange(0, std::memory_order_relaxed);
+	if (request_time == 0) { return; }
+	latency_histogram_record(session_replay::replayedLatencies, transfer_stats_now() - request_time);
+}
+
+template <size_t label_length>
+inline void session_replay_print_latencies(const latency_histogram_t& histogram, const char (&label)[label_length]) noexcept {
+	signal_safe_text_t text;
+	text.append("replay: ");
+	text.append(label);
+	text.append(" response latency: ");
+	uint64_t count = latency_histogram_count(histogram);
+	if (count == 0) {
+		text.append("no responses\n");
+		crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+		return;
+	}
+	text.append("count ");
+	text.append_unsigned(count);
+	text.append(", min ");
+	transfer_stats_append_microseconds(text, histogram.minimum.load(std::memory_order_relaxed));
+	text.append(", p50 ");
+	transfer_stats_append_microseconds(text, latency_histogram_percentile(histogram, count, 500000));
+	text.append(", p99 ");
+	transfer_stats_append_microseconds(text, latency_histogram_percentile(histogram, count, 990000));
+	text.append(", max ");
+	transfer_stats_append_microseconds(text, histogram.maximum.load(std::memory_order_relaxed));
+	text.append("\n");
+	crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+}
+
+inline void session_replay_print() noexcept {
+	signal_safe_text_t text;
+	text.append("replay: ");
+	text.append_unsigned(session_replay::replayedChunks);
+	text.append(" chunks replayed at ");
+	if (session_replay::speed == 0) {
+		text.append("max speed\n");
+	} else {
+		text.append_unsigned(session_replay::speed);
+		text.append("x\n");
+	}
+	crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+
+	session_replay_print_latencies(session_replay::recordedLatencies, "recorded");
+	session_replay_print_latencies(session_replay::replayedLatencies, "replayed");
+}
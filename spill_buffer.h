@@ -0,0 +1,284 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <cstring>		// for std::memcpy and std::strlen
+#include <cstdlib>		// for std::aligned_alloc, std::malloc, std::getenv and mkstemp
+#include <thread>		// for std::thread
+#include <mutex>		// for std::mutex
+#include <condition_variable>	// for std::condition_variable
+
+#include "crossplatform_io.h"
+
+#include "error_reporting.h"
+
+#include "transfer_stats.h"	// for the text formatting
+
+#include "progress_report.h"	// for progress_report_append_size
+
+#include "event_trace.h"	// for naming the thread in "--trace"
+
+#ifndef PLATFORM_WINDOWS
+#include <fcntl.h>		// for fcntl and O_DIRECT
+#include <unistd.h>		// for pread, pwrite, ftruncate and unlink
+#endif
+
+/*
+NOTE: How "--spill" works:
+	- received data goes into fixed-size blocks instead of straight to stdout, and a separate thread writes the blocks to
+		stdout in order. As long as there are free blocks (the memory limit divided by the block size), a stalled
+		consumer only makes the blocks pile up, the receive loop keeps going.
+	- once the blocks run out, every full block is written to the end of an unlinked temp file instead (one large
+		sequential write, with O_DIRECT where the file system supports it, so it doesn't push everything else out of the
+		page cache). The writer thread reads the file back front to back when it gets there.
+	- the order stays intact because blocks only go back into memory once the file has been read back completely, so
+		the queue is always: blocks in memory (oldest), then the file, then the block that is being filled (newest).
+		At that point, the file is emptied again, so it only ever grows as big as the longest backlog.
+	- the block that is being filled is handed to the writer thread as soon as it has nothing else to do, so small
+		transfers aren't held back until a block is full.
+	- the disk writes happen on the receiving thread, while holding the lock. They're sequential and block-sized, so
+		that's a few milliseconds at worst, nothing like a stalled consumer.
+*/
+
+constexpr size_t spill_block_size = 1024 * 1024;
+constexpr size_t spill_block_alignment = 4096;		// NOTE: What O_DIRECT wants for buffers, offsets and sizes.
+constexpr uint64_t spill_min_memory_limit = 2 * spill_block_size;
+
+using spill_consumer_t = void (*)(const void* buffer, size_t size) noexcept;
+
+namespace spill_buffer {
+	inline spill_consumer_t consumer;
+
+	// NOTE: Never destroyed on purpose. The writer thread can still be stuck in the consumer when nc exits (a stalled
+	// stdout is what "--spill" is for), and destroying a thread that's running, or a condition it might wait on, would
+	// hang or abort the exit.
+	inline std::thread& writerThread = *new std::thread;
+	inline std::mutex& mutex = *new std::mutex;
+	inline std::condition_variable& dataCondition = *new std::condition_variable;
+	inline std::condition_variable& drainedCondition = *new std::condition_variable;
+	inline bool shouldStop = false;
+	inline bool isConsuming = false;
+
+	inline unsigned char** freeBlocks;
+	inline size_t freeBlockCount = 0;
+
+	// NOTE: Full blocks in memory, oldest first. A ring, with room for every block there is.
+	inline unsigned char** queuedBlocks;
+	inline size_t blockCount;
+	inline size_t queueStart = 0;
+	inline size_t queuedBlockCount = 0;
+
+	inline unsigned char* fillingBlock;
+	inline size_t fillingSize = 0;
+
+	inline int fd = -1;
+	inline uint64_t fileReadOffset = 0;
+	inline uint64_t fileWriteOffset = 0;
+	inline unsigned char* readBackBlock;
+
+	// NOTE: Everything that came in but hasn't been written out yet, no matter where it is.
+	inline uint64_t pendingBytes = 0;
+
+	inline uint64_t spilledBytes = 0;
+	inline uint64_t peakFileSize = 0;
+}
+
+#ifndef PLATFORM_WINDOWS
+
+inline unsigned char* spill_buffer_allocate_block() noexcept {
+	unsigned char* block = (unsigned char*)std::aligned_alloc(spill_block_alignment, spill_block_size);
+	if (!block) { REPORT_ERROR_AND_EXIT("failed to allocate spill buffer blocks", EXIT_FAILURE); }
+	return block;
+}
+
+inline bool spill_buffer_write_block(const unsigned char* block, uint64_t offset) noexcept {
+	for (size_t written = 0; written < spill_block_size; ) {
+		ssize_t result = pwrite(spill_buffer::fd, block + written, spill_block_size - written, offset + written);
+		if (result <= 0) { return false; }
+		written += result;
+	}
+	return true;
+}
+
+inline bool spill_buffer_read_block(unsigned char* block, uint64_t offset) noexcept {
+	for (size_t bytes_read = 0; bytes_read < spill_block_size; ) {
+		ssize_t result = pread(spill_buffer::fd, block + bytes_read, spill_block_size - bytes_read, offset + bytes_read);
+		if (result <= 0) { return false; }
+		bytes_read += result;
+	}
+	return true;
+}
+
+inline void spill_buffer_writer_thread() noexcept {
+	event_trace_name_thread("spill (buffer -> stdout)");
+
+	std::unique_lock<std::mutex> lock(spill_buffer::mutex);
+	while (true) {
+		spill_buffer::dataCondition.wait(lock, []() noexcept {
+			return spill_buffer::queuedBlockCount != 0 || spill_buffer::fileReadOffset != spill_buffer::fileWriteOffset || spill_buffer::fillingSize != 0 || spill_buffer::shouldStop;
+		});
+		if (spill_buffer::shouldStop) { return; }
+
+		unsigned char* block;
+		size_t size = spill_block_size;
+		if (spill_buffer::queuedBlockCount != 0) {
+			block = spill_buffer::queuedBlocks[spill_buffer::queueStart];
+			spill_buffer::queueStart = (spill_buffer::queueStart + 1) % spill_buffer::blockCount;
+			spill_buffer::queuedBlockCount--;
+		} else if (spill_buffer::fileReadOffset != spill_buffer::fileWriteOffset) {
+			block = spill_buffer::readBackBlock;
+			uint64_t offset = spill_buffer::fileReadOffset;
+			// NOTE: The receiving thread only ever writes past fileWriteOffset, so this part of the file can be read unlocked.
+			lock.unlock();
+			if (!spill_buffer_read_block(block, offset)) { REPORT_ERROR_AND_EXIT("failed to read back spill file", EXIT_FAILURE); }
+			lock.lock();
+		} else {
+			// NOTE: There's always a free block here, the only blocks that aren't free are the filling one and queued ones.
+			block = spill_buffer::fillingBlock;
+			size = spill_buffer::fillingSize;
+			spill_buffer::fillingBlock = spill_buffer::freeBlocks[--spill_buffer::freeBlockCount];
+			spill_buffer::fillingSize = 0;
+		}
+
+		spill_buffer::isConsuming = true;
+		lock.unlock();
+		spill_buffer::consumer(block, size);
+		lock.lock();
+		spill_buffer::isConsuming = false;
+
+		if (block == spill_buffer::readBackBlock) {
+			spill_buffer::fileReadOffset += spill_block_size;
+			if (spill_buffer::fileReadOffset == spill_buffer::fileWriteOffset) {
+				// NOTE: All caught up, the space on disk can go back. Nothing we could do about a failed truncate anyway,
+				// the file just stays bigger than it needs to be.
+				ftruncate(spill_buffer::fd, 0);
+				spill_buffer::fileReadOffset = 0;
+				spill_buffer::fileWriteOffset = 0;
+			}
+		} else {
+			spill_buffer::freeBlocks[spill_buffer::freeBlockCount++] = block;
+		}
+
+		spill_buffer::pendingBytes -= size;
+		if (spill_buffer::pendingBytes == 0) { spill_buffer::drainedCondition.notify_all(); }
+	}
+}
+
+// NOTE: The spill file is created (and unlinked right away) up front, so that a bad directory is reported before the transfer.
+inline void spill_buffer_start(uint64_t memory_limit, const char* directory, spill_consumer_t consumer) noexcept {
+	spill_buffer::consumer = consumer;
+
+	if (!directory) { directory = std::getenv("TMPDIR"); }
+	if (!directory || directory[0] == '\0') { directory = "/tmp"; }
+	size_t directory_length = std::strlen(directory);
+	char* path = (char*)std::malloc(directory_length + sizeof("/nc-spill-XXXXXX"));
+	if (!path) { REPORT_ERROR_AND_EXIT("failed to allocate spill file path", EXIT_FAILURE); }
+	std::memcpy(path, directory, directory_length);
+	std::memcpy(path + directory_length, "/nc-spill-XXXXXX", sizeof("/nc-spill-XXXXXX"));
+	spill_buffer::fd = mkstemp(path);
+	if (spill_buffer::fd == -1) { REPORT_ERROR_AND_EXIT("failed to create spill file", EXIT_FAILURE); }
+	unlink(path);
+	std::free(path);
+
+	// NOTE: Not every file system can do O_DIRECT (tmpfs can't, for example), block-sized writes are fine without it too.
+	int file_flags = fcntl(spill_buffer::fd, F_GETFL);
+	if (file_flags != -1) { fcntl(spill_buffer::fd, F_SETFL, file_flags | O_DIRECT); }
+
+	spill_buffer::blockCount = memory_limit / spill_block_size;
+	spill_buffer::freeBlocks = (unsigned char**)std::malloc(spill_buffer::blockCount * sizeof(unsigned char*));
+	spill_buffer::queuedBlocks = (unsigned char**)std::malloc(spill_buffer::blockCount * sizeof(unsigned char*));
+	if (!spill_buffer::freeBlocks || !spill_buffer::queuedBlocks) { REPORT_ERROR_AND_EXIT("failed to allocate spill buffer blocks", EXIT_FAILURE); }
+
+	// NOTE: One of the blocks is always the one that's being filled.
+	spill_buffer::fillingBlock = spill_buffer_allocate_block();
+	for (size_t i = 1; i < spill_buffer::blockCount; i++) { spill_buffer::freeBlocks[spill_buffer::freeBlockCount++] = spill_buffer_allocate_block(); }
+	spill_buffer::readBackBlock = spill_buffer_allocate_block();
+
+	// NOTE: Cast is necessary because (for whatever reason) thread only accepts non-noexcept function ptr types.
+	spill_buffer::writerThread = std::thread((void (*)())spill_buffer_writer_thread);
+}
+
+// NOTE: Has to be called with the lock held, the filling block is full at this point.
+inline void spill_buffer_queue_filling_block() noexcept {
+	// NOTE: Memory is only used again once the file has been read back completely, that's what keeps the order intact.
+	if (spill_buffer::fileReadOffset == spill_buffer::fileWriteOffset && spill_buffer::freeBlockCount != 0) {
+		spill_buffer::queuedBlocks[(spill_buffer::queueStart + spill_buffer::queuedBlockCount) % spill_buffer::blockCount] = spill_buffer::fillingBlock;
+		spill_buffer::queuedBlockCount++;
+		spill_buffer::fillingBlock = spill_buffer::freeBlocks[--spill_buffer::freeBlockCount];
+	} else {
+		if (!spill_buffer_write_block(spill_buffer::fillingBlock, spill_buffer::fileWriteOffset)) { REPORT_ERROR_AND_EXIT("failed to write to spill file", EXIT_FAILURE); }
+		spill_buffer::fileWriteOffset += spill_block_size;
+		spill_buffer::spilledBytes += spill_block_size;
+		if (spill_buffer::fileWriteOffset > spill_buffer::peakFileSize) { spill_buffer::peakFileSize = spill_buffer::fileWriteOffset; }
+	}
+	spill_buffer::fillingSize = 0;
+}
+
+inline void spill_buffer_push(const void* data, size_t size) noexcept {
+	const unsigned char* input = (const unsigned char*)data;
+	std::lock_guard<std::mutex> lock(spill_buffer::mutex);
+	spill_buffer::pendingBytes += size;
+	while (size != 0) {
+		size_t chunk_size = spill_block_size - spill_buffer::fillingSize;
+		if (chunk_size > size) { chunk_size = size; }
+		std::memcpy(spill_buffer::fillingBlock + spill_buffer::fillingSize, input, chunk_size);
+		spill_buffer::fillingSize += chunk_size;
+		input += chunk_size;
+		size -= chunk_size;
+		if (spill_buffer::fillingSize == spill_block_size) { spill_buffer_queue_filling_block(); }
+	}
+	spill_buffer::dataCondition.notify_one();
+}
+
+// NOTE: Waits until everything that came in has been written out.
+inline void spill_buffer_drain() noexcept {
+	std::unique_lock<std::mutex> lock(spill_buffer::mutex);
+	spill_buffer::drainedCondition.wait(lock, []() noexcept { return spill_buffer::pendingBytes == 0 || spill_buffer::shouldStop; });
+	if (spill_buffer::pendingBytes != 0) {
+		// NOTE: Another thread is exiting because of an error (the writer thread, most likely), this one just goes along.
+		lock.unlock();
+		halt_program(EXIT_FAILURE);
+	}
+}
+
+// NOTE: Runs at exit. Normal exits have drained the buffer by then, on error exits whatever is left is dropped, because
+// the consumer might be the reason for the exit.
+inline void spill_buffer_stop() noexcept {
+	if (!spill_buffer::writerThread.joinable()) { return; }
+
+	bool is_consuming;
+	{
+		std::lock_guard<std::mutex> lock(spill_buffer::mutex);
+		spill_buffer::shouldStop = true;
+		is_consuming = spill_buffer::isConsuming;
+	}
+	spill_buffer::dataCondition.notify_one();
+	spill_buffer::drainedCondition.notify_all();
+
+	// NOTE: A consumer that's stuck would keep us here forever, and if it failed, the writer thread is the one that's
+	// exiting and can't join itself. Either way, the exit takes the thread down with it.
+	if (is_consuming || spill_buffer::writerThread.get_id() == std::this_thread::get_id()) { return; }
+	spill_buffer::writerThread.join();
+}
+
+inline void spill_buffer_print() noexcept {
+	if (spill_buffer::spilledBytes == 0) { return; }
+	signal_safe_text_t text;
+	text.append("spill: ");
+	progress_report_append_size(text, spill_buffer::spilledBytes);
+	text.append(" went through the spill file, it got as big as ");
+	progress_report_append_size(text, spill_buffer::peakFileSize);
+	text.append("\n");
+	crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+}
+
+#else
+
+// NOTE: "--spill" is rejected on Windows while parsing the args.
+inline void spill_buffer_start(uint64_t memory_limit, const char* directory, spill_consumer_t consumer) noexcept { }
+inline void spill_buffer_push(const void* data, size_t size) noexcept { }
+inline void spill_buffer_drain() noexcept { }
+inline void spill_buffer_stop() noexcept { }
+inline void spill_buffer_print() noexcept { }
+
+#endif
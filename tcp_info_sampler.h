@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <chrono>		// for std::chrono::milliseconds
+#include <thread>		// for std::thread
+#include <mutex>		// for std::mutex
+#include <condition_variable>	// for std::condition_variable
+
+#include "NetworkShepherd.h"	// for the communicator socket
+
+#include "crossplatform_io.h"
+
+#include "transfer_stats.h"	// for the clock and the text formatting
+
+#ifndef PLATFORM_WINDOWS
+#include <linux/tcp.h>		// for TCP_INFO and the full struct tcp_info (the glibc one lags behind)
+#include <linux/sockios.h>	// for SIOCINQ and SIOCOUTQ
+#include <sys/ioctl.h>		// for ioctl
+#endif
+
+/*
+NOTE: How "--tcp-info" works:
+	- while a connection is open, a separate thread reads TCP_INFO and the receive/send queue depths (SIOCINQ/SIOCOUTQ)
+		of the communicator socket every interval and prints them as one line on stderr.
+	- when the connection is done, a last sample is taken and a summary is printed. The interesting part of the summary is
+		how much of the time the connection was busy sending was spent limited by the receiver's window (the peer is slow)
+		or by our send buffer (we are the problem, or rather our buffer size), the rest is the network (cwnd).
+	- the sampler never ends the program. If the socket can't be queried anymore, it just stops sampling.
+	- the sampler has to be stopped before the communicator socket is closed, otherwise it might query a socket that has
+		already been replaced by another one (with "-k").
+*/
+
+struct tcp_info_sample_t {
+	uint64_t time;			// NOTE: Nanoseconds since the connection started.
+	uint32_t rtt;			// NOTE: All times in here are in microseconds, like the kernel reports them.
+	uint32_t rttVariance;
+	uint32_t congestionWindow;	// NOTE: In segments.
+	uint32_t slowStartThreshold;
+	uint32_t unackedRetransmits;
+	uint32_t totalRetransmits;
+	uint64_t deliveryRate;		// NOTE: In bytes per second.
+	uint64_t busyTime;
+	uint64_t receiveWindowLimitedTime;
+	uint64_t sendBufferLimitedTime;
+	int receiveQueue;		// NOTE: In bytes.
+	int sendQueue;
+};
+
+struct tcp_info_summary_t {
+	uint64_t sampleCount;
+	uint64_t rttSum;
+	uint32_t minimumRTT;
+	uint32_t maximumRTT;
+	int maximumReceiveQueue;
+	int maximumSendQueue;
+};
+
+namespace tcp_info_sampler {
+	inline std::chrono::milliseconds interval;
+
+	inline std::thread thread;
+	inline std::mutex mutex;
+	inline std::condition_variable stopCondition;
+	inline bool shouldStop;
+
+	inline uint64_t connectionStartTime;
+	inline tcp_info_summary_t summary;
+}
+
+#ifndef PLATFORM_WINDOWS
+
+inline bool tcp_info_take_sample(tcp_info_sample_t& sample) noexcept {
+	struct tcp_info info = { };
+	socklen_t info_size = sizeof(info);
+	if (getsockopt(NetworkShepherd::communicatorSocket, IPPROTO_TCP, TCP_INFO, &info, &info_size) == -1) { return false; }
+
+	sample.time = transfer_stats_now() - tcp_info_sampler::connectionStartTime;
+	sample.rtt = info.tcpi_rtt;
+	sample.rttVariance = info.tcpi_rttvar;
+	sample.congestionWindow = info.tcpi_snd_cwnd;
+	sample.slowStartThreshold = info.tcpi_snd_ssthresh;
+	sample.unackedRetransmits = info.tcpi_retransmits;
+	sample.totalRetransmits = info.tcpi_total_retrans;
+	// NOTE: Fields that the running kernel doesn't know about yet are left at zero, which is why info starts out zeroed.
+	sample.deliveryRate = info.tcpi_delivery_rate;
+	sample.busyTime = info.tcpi_busy_time;
+	sample.receiveWindowLimitedTime = info.tcpi_rwnd_limited;
+	sample.sendBufferLimitedTime = info.tcpi_sndbuf_limited;
+
+	if (ioctl(NetworkShepherd::communicatorSocket, SIOCINQ, &sample.receiveQueue) == -1) { return false; }
+	if (ioctl(NetworkShepherd::communicatorSocket, SIOCOUTQ, &sample.sendQueue) == -1) { return false; }
+
+	return true;
+}
+
+// NOTE: Prints microseconds as milliseconds with three decimal places (which is exactly what append_seconds does for nanoseconds).
+inline void tcp_info_append_milliseconds(signal_safe_text_t& text, uint64_t microseconds) noexcept { text.append_seconds(microseconds * 1000000); }
+
+inline void tcp_info_print_sample(const tcp_info_sample_t& sample) noexcept {
+	signal_safe_text_t text;
+	text.append("tcp_info: t=");
+	text.append_seconds(sample.time);
+	text.append("s rtt=");
+	tcp_info_append_milliseconds(text, sample.rtt);
+	text.append("ms rttvar=");
+	tcp_info_append_milliseconds(text, sample.rttVariance);
+	text.append("ms cwnd=");
+	text.append_unsigned(sample.congestionWindow);
+	text.append(" ssthresh=");
+	text.append_unsigned(sample.slowStartThreshold);
+	text.append(" retrans=");
+	text.append_unsigned(sample.unackedRetransmits);
+	text.append("/");
+	text.append_unsigned(sample.totalRetransmits);
+	text.append(" delivery_rate=");
+	text.append_unsigned(sample.deliveryRate);
+	text.append("B/s busy=");
+	tcp_info_append_milliseconds(text, sample.busyTime);
+	text.append("ms rwnd_limited=");
+	tcp_info_append_milliseconds(text, sample.receiveWindowLimitedTime);
+	text.append("ms sndbuf_limited=");
+	tcp_info_append_milliseconds(text, sample.sendBufferLimitedTime);
+	text.append("ms inq=");
+	text.append_unsigned(sample.receiveQueue);
+	text.append(" outq=");
+	text.append_unsigned(sample.sendQueue);
+	text.append("\n");
+	crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+}
+
+inline void tcp_info_add_to_summary(const tcp_info_sample_t& sample) noexcept {
+	tcp_info_summary_t& summary = tcp_info_sampler::summary;
+	summary.sampleCount++;
+	summary.rttSum += sample.rtt;
+	if (sample.rtt < summary.minimumRTT) { summary.minimumRTT = sample.rtt; }
+	if (sample.rtt > summary.maximumRTT) { summary.maximumRTT = sample.rtt; }
+	if (sample.receiveQueue > summary.maximumReceiveQueue) { summary.maximumReceiveQueue = sample.receiveQueue; }
+	if (sample.sendQueue > summary.maximumSendQueue) { summary.maximumSendQueue = sample.sendQueue; }
+}
+
+inline uint64_t tcp_info_percentage(uint64_t part, uint64_t whole) noexcept { return whole == 0 ? 0 : part * 100 / whole; }
+
+// NOTE: The last sample carries the totals, the summary carries what only shows up across samples.
+inline void tcp_info_print_summary(const tcp_info_sample_t& last_sample) noexcept {
+	const tcp_info_summary_t& summary = tcp_info_sampler::summary;
+	if (summary.sampleCount == 0) { return; }
+
+	uint64_t busy_time = last_sample.busyTime;
+	uint64_t receive_window_limited_time = last_sample.receiveWindowLimitedTime;
+	uint64_t send_buffer_limited_time = last_sample.sendBufferLimitedTime;
+	uint64_t limited_time = receive_window_limited_time + send_buffer_limited_time;
+	uint64_t network_limited_time = busy_time > limited_time ? busy_time - limited_time : 0;
+
+	signal_safe_text_t text;
+	text.append("tcp_info summary: ");
+	text.append_unsigned(summary.sampleCount);
+	text.append(" samples over ");
+	text.append_seconds(last_sample.time);
+	text.append("s, rtt min/avg/max ");
+	tcp_info_append_milliseconds(text, summary.minimumRTT);
+	text.append("/");
+	tcp_info_append_milliseconds(text, summary.rttSum / summary.sampleCount);
+	text.append("/");
+	tcp_info_append_milliseconds(text, summary.maximumRTT);
+	text.append("ms, ");
+	text.append_unsigned(last_sample.totalRetransmits);
+	text.append(" retransmits, max inq ");
+	text.append_unsigned(summary.maximumReceiveQueue);
+	text.append(" outq ");
+	text.append_unsigned(summary.maximumSendQueue);
+	text.append("\ntcp_info summary: sending was busy for ");
+	tcp_info_append_milliseconds(text, busy_time);
+	text.append("ms: ");
+	text.append_unsigned(tcp_info_percentage(receive_window_limited_time, busy_time));
+	text.append("% limited by peer receive window, ");
+	text.append_unsigned(tcp_info_percentage(send_buffer_limited_time, busy_time));
+	text.append("% by local send buffer, ");
+	text.append_unsigned(tcp_info_percentage(network_limited_time, busy_time));
+	text.append("% by network (congestion window)\n");
+	crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+}
+
+inline void tcp_info_sampler_thread() noexcept {
+	std::unique_lock<std::mutex> lock(tcp_info_sampler::mutex);
+	while (!tcp_info_sampler::stopCondition.wait_for(lock, tcp_info_sampler::interval, []() noexcept { return tcp_info_sampler::shouldStop; })) {
+		tcp_info_sample_t sample;
+		if (!tcp_info_take_sample(sample)) { return; }
+		tcp_info_add_to_summary(sample);
+		tcp_info_print_sample(sample);
+	}
+}
+
+inline void tcp_info_sampler_start() noexcept {
+	tcp_info_sampler::connectionStartTime = transfer_stats_now();
+	tcp_info_sampler::summary = { 0, 0, (uint32_t)-1, 0, 0, 0 };
+	tcp_info_sampler::shouldStop = false;
+
+	// NOTE: Cast is necessary because (for whatever reason) thread only accepts non-noexcept function ptr types.
+	tcp_info_sampler::thread = std::thread((void (*)())tcp_info_sampler_thread);
+}
+
+// NOTE: Safe to call when the sampler isn't running, which is what the at-exit cleanup relies on.
+inline void tcp_info_sampler_stop() noexcept {
+	if (!tcp_info_sampler::thread.joinable()) { return; }
+
+	{
+		std::lock_guard<std::mutex> lock(tcp_info_sampler::mutex);
+		tcp_info_sampler::shouldStop = true;
+	}
+	tcp_info_sampler::stopCondition.notify_one();
+	tcp_info_sampler::thread.join();
+
+	tcp_info_sample_t sample;
+	if (!tcp_info_take_sample(sample)) { return; }
+	tcp_info_add_to_summary(sample);
+	tcp_info_print_sample(sample);
+	tcp_info_print_summary(sample);
+}
+
+#else
+
+// NOTE: TCP_INFO is Linux-specific, "--tcp-info" is rejected on Windows while parsing the args.
+inline void tcp_info_sampler_start() noexcept { }
+inline void tcp_info_sampler_stop() noexcept { }
+
+#endif
+
+// NOTE: A std::thread that is still joinable when it's destroyed terminates the program, so error exits have to stop the
+// sampler first. The summary doesn't hurt there either.
+inline void tcp_info_sampler_stop_at_exit() noexcept { tcp_info_sampler_stop(); }
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+
+#include "crossplatform_io.h"
+
+#include "error_reporting.h"
+
+#ifndef PLATFORM_WINDOWS
+#include <fcntl.h>		// for splice, tee and the pipe size fcntls
+#include <unistd.h>		// for pipe
+#include <sys/stat.h>		// for fstat
+#include <cerrno>		// for errno
+#endif
+
+/*
+NOTE: How "--tee" works:
+	- every file given with "--tee" gets a copy of the received data, and (unless "--output" takes its place) stdout is
+		one more sink, so "nc ... --tee archive" does what "nc ... | tee archive" does, without the extra process.
+	- where the kernel lets us (Linux, sinks that are pipes or regular files), the data is written once into a private
+		pipe and the sinks get it from there: pipes through tee(), which only adds references to the pipe's pages, and
+		files through tee() into a scratch pipe and splice() from that into the file. The last of these sinks gets the
+		private pipe itself spliced into it, which empties it for the next chunk. So however many sinks there are,
+		the data only gets copied out of our buffer once.
+	- sinks that can't take part (ttys, sockets, files opened with O_APPEND, which splice refuses) get a plain write
+		from our buffer. So do the bytes a tee() or splice() didn't manage to move, because tee() always starts at the
+		front of the pipe and can't be resumed where it left off.
+	- the sinks are written to one after the other, so the slowest one sets the pace, same as with tee(1).
+*/
+
+constexpr uint8_t tee_output_max_files = 16;
+constexpr int tee_output_pipe_size = 1024 * 1024;	// NOTE: Asked for, the kernel may give us less.
+
+enum class TeeSinkKind : uint8_t {
+	PIPE,
+	FILE,
+	OTHER
+};
+
+struct tee_sink_t {
+	int fd;
+	TeeSinkKind kind;
+};
+
+namespace tee_output {
+	inline tee_sink_t sinks[tee_output_max_files + 1];
+	inline uint8_t sinkCount = 0;
+	inline uint8_t lastSplicedSink;		// NOTE: The one that gets the private pipe spliced into it (if there's a pipe at all).
+
+	inline int privatePipe[2] = { -1, -1 };
+	inline int scratchPipe[2] = { -1, -1 };
+	inline size_t pipeCapacity;
+}
+
+#if !defined(PLATFORM_WINDOWS) && defined(__linux__)
+
+inline TeeSinkKind tee_output_classify(int fd) noexcept {
+	struct stat status;
+	if (fstat(fd, &status) == -1) { return TeeSinkKind::OTHER; }
+	if (S_ISFIFO(status.st_mode)) { return TeeSinkKind::PIPE; }
+	if (S_ISREG(status.st_mode) && !(fcntl(fd, F_GETFL) & O_APPEND)) { return TeeSinkKind::FILE; }
+	return TeeSinkKind::OTHER;
+}
+
+// NOTE: Returns how big the pipe ended up being.
+inline size_t tee_output_open_pipe(int (&fds)[2]) noexcept {
+	if (pipe2(fds, O_CLOEXEC) == -1) { REPORT_ERROR_AND_EXIT("failed to create tee pipe", EXIT_FAILURE); }
+	fcntl(fds[1], F_SETPIPE_SZ, tee_output_pipe_size);
+	int size = fcntl(fds[1], F_GETPIPE_SZ);
+	if (size == -1) { REPORT_ERROR_AND_EXIT("failed to get tee pipe size", EXIT_FAILURE); }
+	return size;
+}
+
+inline void tee_output_start(const char* const * paths, uint8_t path_count, bool include_stdout) noexcept {
+	if (include_stdout) { tee_output::sinks[tee_output::sinkCount++] = { STDOUT_FILENO, tee_output_classify(STDOUT_FILENO) }; }
+	for (uint8_t i = 0; i < path_count; i++) {
+		int fd = crossplatform_create_file(paths[i]);
+		if (fd == -1) { REPORT_ERROR_AND_EXIT("failed to open tee file", EXIT_FAILURE); }
+		tee_output::sinks[tee_output::sinkCount++] = { fd, tee_output_classify(fd) };
+	}
+
+	bool needsPipe = false;
+	bool needsScratchPipe = false;
+	for (uint8_t i = 0; i < tee_output::sinkCount; i++) {
+		if (tee_output::sinks[i].kind == TeeSinkKind::OTHER) { continue; }
+		if (needsPipe && tee_output::sinks[tee_output::lastSplicedSink].kind == TeeSinkKind::FILE) { needsScratchPipe = true; }
+		needsPipe = true;
+		tee_output::lastSplicedSink = i;
+	}
+	if (!needsPipe) { return; }
+
+	tee_output::pipeCapacity = tee_output_open_pipe(tee_output::privatePipe);
+	if (needsScratchPipe) {
+		size_t scratchCapacity = tee_output_open_pipe(tee_output::scratchPipe);
+		if (scratchCapacity < tee_output::pipeCapacity) { tee_output::pipeCapacity = scratchCapacity; }
+	}
+}
+
+// NOTE: Moves everything that's in the pipe into fd. Only fails if the sink does.
+inline bool tee_output_splice_all(int pipe_fd, int fd, size_t size) noexcept {
+	while (size != 0) {
+		ssize_t bytesMoved = splice(pipe_fd, nullptr, fd, nullptr, size, SPLICE_F_MOVE);
+		if (bytesMoved == -1) {
+			if (errno == EINTR) { continue; }
+			return false;
+		}
+		size -= bytesMoved;
+	}
+	return true;
+}
+
+// NOTE: Hands the chunk (which is in the private pipe) to a sink without taking it out of the private pipe, returns how
+// much of it made it, the rest is up to the caller.
+inline size_t tee_output_duplicate(const tee_sink_t& sink, size_t size) noexcept {
+	int target = sink.kind == TeeSinkKind::PIPE ? sink.fd : tee_output::scratchPipe[1];
+	ssize_t bytesDuplicated = tee(tee_output::privatePipe[0], target, size, 0);
+	if (bytesDuplicated <= 0) { return 0; }
+	if (sink.kind == TeeSinkKind::FILE && !tee_output_splice_all(tee_output::scratchPipe[0], sink.fd, bytesDuplicated)) {
+		REPORT_ERROR_AND_EXIT("failed to write to tee sink", EXIT_FAILURE);
+	}
+	return bytesDuplicated;
+}
+
+inline void tee_output_write_chunk(const unsigned char* data, size_t size) noexcept {
+	bool usesPipe = tee_output::privatePipe[1] != -1;
+	if (usesPipe && !crossplatform_write_entire_buffer(tee_output::privatePipe[1], data, size)) { REPORT_ERROR_AND_EXIT("failed to write to tee pipe", EXIT_FAILURE); }
+
+	for (uint8_t i = 0; i < tee_output::sinkCount; i++) {
+		const tee_sink_t& sink = tee_output::sinks[i];
+		size_t bytesDone = 0;
+		if (sink.kind != TeeSinkKind::OTHER) {
+			if (i == tee_output::lastSplicedSink) {
+				if (!tee_output_splice_all(tee_output::privatePipe[0], sink.fd, size)) { REPORT_ERROR_AND_EXIT("failed to write to tee sink", EXIT_FAILURE); }
+				continue;
+			}
+			bytesDone = tee_output_duplicate(sink, size);
+		}
+		if (!crossplatform_write_entire_buffer(sink.fd, data + bytesDone, size - bytesDone)) { REPORT_ERROR_AND_EXIT("failed to write to tee sink", EXIT_FAILURE); }
+	}
+}
+
+// NOTE: The chunks have to fit into the pipes, the spill buffer hands over blocks that are bigger than that.
+inline void tee_output_write(const void* buffer, size_t size) noexcept {
+	const unsigned char* data = (const unsigned char*)buffer;
+	size_t chunkLimit = tee_output::privatePipe[1] != -1 ? tee_output::pipeCapacity : size;
+	while (size != 0) {
+		size_t chunkSize = size < chunkLimit ? size : chunkLimit;
+		tee_output_write_chunk(data, chunkSize);
+		data += chunkSize;
+		size -= chunkSize;
+	}
+}
+
+#else
+
+// NOTE: Without tee() and splice(), every sink just gets its own write.
+inline void tee_output_start(const char* const * paths, uint8_t path_count, bool include_stdout) noexcept {
+	if (include_stdout) { tee_output::sinks[tee_output::sinkCount++] = { STDOUT_FILENO, TeeSinkKind::OTHER }; }
+	for (uint8_t i = 0; i < path_count; i++) {
+		int fd = crossplatform_create_file(paths[i]);
+		if (fd == -1) { REPORT_ERROR_AND_EXIT("failed to open tee file", EXIT_FAILURE); }
+		tee_output::sinks[tee_output::sinkCount++] = { fd, TeeSinkKind::OTHER };
+	}
+}
+
+inline void tee_output_write(const void* buffer, size_t size) noexcept {
+	for (uint8_t i = 0; i < tee_output::sinkCount; i++) {
+		if (!crossplatform_write_entire_buffer(tee_output::sinks[i].fd, buffer, size)) { REPORT_ERROR_AND_EXIT("failed to write to tee sink", EXIT_FAILURE); }
+	}
+}
+
+#endif
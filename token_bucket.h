@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <chrono>		// for std::chrono::steady_clock
+#include <thread>		// for std::this_thread::sleep_until
+
+/*
+NOTE: This is a token bucket in its "virtual scheduling" form (GCRA):
+	- instead of counting tokens, we keep track of the point in time at which the bytes we've let through so far are
+		paid for (theoreticalArrivalTime). Every byte pushes that point rate-many nanoseconds into the future.
+	- if that point is in the future, the caller is ahead of the rate and sleeps until it catches up.
+	- if the caller was idle, the point falls behind the present. It's allowed to fall behind by at most burstDuration,
+		which is how much credit an idle transfer can build up (that's the bucket size).
+	- there's no background refill and no floating point, it's one clock read and some integer math per chunk.
+
+NOTE: To keep pacing smooth instead of stop/go, the transfer loops ask for chunks of at most token_bucket_chunk_size()
+bytes, which is about how much the rate allows in token_bucket_chunk_duration. That way even very low rates produce a
+steady trickle of small chunks instead of one big chunk and a long pause.
+*/
+
+constexpr std::chrono::nanoseconds token_bucket_burst_duration = std::chrono::milliseconds(50);
+constexpr std::chrono::nanoseconds token_bucket_chunk_duration = std::chrono::milliseconds(10);
+
+struct token_bucket_t {
+	uint64_t bytesPerSecond = 0;		// NOTE: 0 means unlimited.
+	std::chrono::steady_clock::time_point theoreticalArrivalTime { };
+};
+
+inline bool token_bucket_is_limited(const token_bucket_t& bucket) noexcept { return bucket.bytesPerSecond != 0; }
+
+inline size_t token_bucket_chunk_size(const token_bucket_t& bucket, size_t buffer_size) noexcept {
+	if (!token_bucket_is_limited(bucket)) { return buffer_size; }
+	uint64_t chunk_size = bucket.bytesPerSecond * token_bucket_chunk_duration.count() / std::chrono::nanoseconds(std::chrono::seconds(1)).count();
+	if (chunk_size == 0) { return 1; }
+	return chunk_size < buffer_size ? chunk_size : buffer_size;
+}
+
+// NOTE: Blocks until the bytes are paid for.
+inline void token_bucket_consume(token_bucket_t& bucket, size_t bytes) noexcept {
+	if (!token_bucket_is_limited(bucket)) { return; }
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (bucket.theoreticalArrivalTime < now - token_bucket_burst_duration) { bucket.theoreticalArrivalTime = now - token_bucket_burst_duration; }
+
+	// NOTE: bytes is at most a couple hundred KiB, so this can't overflow.
+	bucket.theoreticalArrivalTime += std::chrono::nanoseconds(bytes * std::chrono::nanoseconds(std::chrono::seconds(1)).count() / bucket.bytesPerSecond);
+
+	if (bucket.theoreticalArrivalTime > now) { std::this_thread::sleep_until(bucket.theoreticalArrivalTime); }
+}
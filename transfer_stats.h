@@ -0,0 +1,322 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+#include <cstddef>		// for size_t
+#include <atomic>		// for std::atomic
+#include <chrono>		// for std::chrono::steady_clock
+
+#include "crossplatform_io.h"
+
+#include "latency_histogram.h"	// for "--histograms"
+
+#include "event_trace.h"	// for "--trace"
+
+#ifndef PLATFORM_WINDOWS
+#include <csignal>		// for sigaction and friends
+#include <cerrno>		// for errno
+#endif
+
+/*
+NOTE: How the transfer statistics are kept:
+	- there's one set of counters per direction. The sending direction is only ever updated by the thread that reads stdin
+		and the receiving direction is only ever updated by the thread that writes stdout (that's true for TCP and UDP).
+	- because of that, updates are a relaxed load plus a relaxed store instead of a read-modify-write. On x86 that's
+		two plain movs, no lock prefix, so it costs next to nothing on the hot path.
+	- they're still atomics so that other threads (and the SIGUSR1 handler) can read them at any time.
+	- each direction is aligned to its own cache line, so the two transfer threads never fight over the same line.
+*/
+
+constexpr size_t transfer_stats_cache_line_size = 64;
+
+// NOTE: Every blocking call in the transfer loops is one of these.
+enum class TransferOperation : uint8_t {
+	STDIN_READ,
+	SOCKET_SEND,
+	SOCKET_RECEIVE,
+	STDOUT_WRITE
+};
+
+constexpr size_t transfer_operation_count = 4;
+
+// NOTE: Indexed by TransferOperation, these are the event names in "--trace".
+constexpr const char* transfer_operation_names[transfer_operation_count] = { "stdin read", "socket send", "socket receive", "stdout write" };
+
+struct alignas(transfer_stats_cache_line_size) transfer_direction_stats_t {
+	std::atomic<uint64_t> bytes { 0 };		// NOTE: Bytes that went over the network in this direction.
+	std::atomic<uint64_t> localCalls { 0 };		// NOTE: stdin reads or stdout writes.
+	std::atomic<uint64_t> networkCalls { 0 };	// NOTE: socket sends or socket receives.
+	std::atomic<uint64_t> localNanoseconds { 0 };
+	std::atomic<uint64_t> networkNanoseconds { 0 };
+	std::atomic<uint64_t> peakBufferOccupancy { 0 };
+	std::atomic<uint64_t> bufferCapacity { 0 };
+	std::atomic<uint64_t> firstCallStart { 0 };	// NOTE: Together with lastCallEnd, this is the window in which the direction was active.
+	std::atomic<uint64_t> lastCallEnd { 0 };
+	std::atomic<uint64_t> firstByteTime { 0 };	// NOTE: When the first network call that moved any data returned.
+};
+
+namespace transfer_stats {
+	inline transfer_direction_stats_t sent;
+	inline transfer_direction_stats_t received;
+
+	inline uint64_t startTime = 0;
+
+	inline bool printAsJSON = false;
+
+	// NOTE: Off by default, since unlike the counters these are a couple KiB of memory per operation to dirty.
+	inline bool shouldRecordLatencies = false;
+	inline latency_histogram_t latencies[transfer_operation_count];
+}
+
+inline uint64_t transfer_stats_now() noexcept {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// NOTE: Only valid for counters with a single writer (see above).
+inline void transfer_stats_add(std::atomic<uint64_t>& counter, uint64_t value) noexcept {
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+inline void transfer_stats_raise_to(std::atomic<uint64_t>& counter, uint64_t value) noexcept {
+	if (value > counter.load(std::memory_order_relaxed)) { counter.store(value, std::memory_order_relaxed); }
+}
+
+inline bool transfer_operation_is_sending(TransferOperation operation) noexcept {
+	return operation == TransferOperation::STDIN_READ || operation == TransferOperation::SOCKET_SEND;
+}
+
+inline bool transfer_operation_is_local(TransferOperation operation) noexcept {
+	return operation == TransferOperation::STDIN_READ || operation == TransferOperation::STDOUT_WRITE;
+}
+
+inline void transfer_stats_set_buffer_capacity(TransferOperation operation, size_t capacity) noexcept {
+	transfer_direction_stats_t& stats = transfer_operation_is_sending(operation) ? transfer_stats::sent : transfer_stats::received;
+	stats.bufferCapacity.store(capacity, std::memory_order_relaxed);
+}
+
+// NOTE: start and end come from transfer_stats_now(), bytes is whatever the call moved.
+inline void transfer_stats_record(TransferOperation operation, uint64_t start, uint64_t end, size_t bytes) noexcept {
+	transfer_direction_stats_t& stats = transfer_operation_is_sending(operation) ? transfer_stats::sent : transfer_stats::received;
+
+	if (stats.firstCallStart.load(std::memory_order_relaxed) == 0) { stats.firstCallStart.store(start, std::memory_order_relaxed); }
+	stats.lastCallEnd.store(end, std::memory_order_relaxed);
+
+	if (transfer_operation_is_local(operation)) {
+		transfer_stats_add(stats.localCalls, 1);
+		transfer_stats_add(stats.localNanoseconds, end - start);
+	} else {
+		transfer_stats_add(stats.networkCalls, 1);
+		transfer_stats_add(stats.networkNanoseconds, end - start);
+		transfer_stats_add(stats.bytes, bytes);
+		if (bytes != 0 && stats.firstByteTime.load(std::memory_order_relaxed) == 0) { stats.firstByteTime.store(end, std::memory_order_relaxed); }
+	}
+
+	// NOTE: Reads are what fill the buffers, so they're what the occupancy is measured on.
+	if (operation == TransferOperation::STDIN_READ || operation == TransferOperation::SOCKET_RECEIVE) { transfer_stats_raise_to(stats.peakBufferOccupancy, bytes); }
+
+	if (transfer_stats::shouldRecordLatencies) { latency_histogram_record(transfer_stats::latencies[(size_t)operation], end - start); }
+
+	if (event_trace::isEnabled) { event_trace_record(transfer_operation_names[(size_t)operation], start, end, bytes); }
+}
+
+// NOTE: Formatting has to be async-signal-safe (it runs in the SIGUSR1 handler), so no snprintf, no allocations.
+struct signal_safe_text_t {
+	char data[2048];
+	size_t size = 0;
+
+	template <size_t literal_length>
+	void append(const char (&literal)[literal_length]) noexcept {
+		for (size_t i = 0; i < literal_length - 1 && size < sizeof(data); i++) { data[size++] = literal[i]; }
+	}
+
+	void append_unsigned(uint64_t value) noexcept {
+		char digits[20];
+		uint8_t digit_count = 0;
+		do {
+			digits[digit_count++] = value % 10 + '0';
+			value /= 10;
+		} while (value != 0);
+		while (digit_count != 0 && size < sizeof(data)) { data[size++] = digits[--digit_count]; }
+	}
+
+	// NOTE: Prints nanoseconds as seconds with three decimal places.
+	void append_seconds(uint64_t nanoseconds) noexcept {
+		uint64_t milliseconds = nanoseconds / 1000000;
+		append_unsigned(milliseconds / 1000);
+		char fraction[4] = { '.', (char)(milliseconds / 100 % 10 + '0'), (char)(milliseconds / 10 % 10 + '0'), (char)(milliseconds % 10 + '0') };
+		for (size_t i = 0; i < sizeof(fraction) && size < sizeof(data); i++) { data[size++] = fraction[i]; }
+	}
+};
+
+inline uint64_t transfer_stats_per_second(uint64_t value, uint64_t nanoseconds) noexcept {
+	if (nanoseconds == 0) { return 0; }
+	// NOTE: Split up so that the multiplication doesn't overflow for big values.
+	return value / nanoseconds * 1000000000 + value % nanoseconds * 1000000000 / nanoseconds;
+}
+
+inline void transfer_stats_append_direction_text(signal_safe_text_t& text, const transfer_direction_stats_t& stats, bool sending, uint64_t elapsed) noexcept {
+	uint64_t bytes = stats.bytes.load(std::memory_order_relaxed);
+	uint64_t network_calls = stats.networkCalls.load(std::memory_order_relaxed);
+
+	text.append_unsigned(bytes);
+	text.append(" bytes (");
+	text.append_unsigned(transfer_stats_per_second(bytes, elapsed));
+	text.append(" B/s) in ");
+	text.append_unsigned(network_calls);
+	if (sending) { text.append(" socket sends ("); } else { text.append(" socket receives ("); }
+	text.append_unsigned(network_calls == 0 ? 0 : bytes / network_calls);
+	text.append(" B/call) and ");
+	text.append_unsigned(stats.localCalls.load(std::memory_order_relaxed));
+	if (sending) { text.append(" stdin reads\n"); } else { text.append(" stdout writes\n"); }
+
+	text.append("          blocked ");
+	text.append_seconds(stats.localNanoseconds.load(std::memory_order_relaxed));
+	if (sending) { text.append(" s on stdin, "); } else { text.append(" s on stdout, "); }
+	text.append_seconds(stats.networkNanoseconds.load(std::memory_order_relaxed));
+	text.append(" s on socket, peak buffer occupancy ");
+	text.append_unsigned(stats.peakBufferOccupancy.load(std::memory_order_relaxed));
+	text.append("/");
+	text.append_unsigned(stats.bufferCapacity.load(std::memory_order_relaxed));
+	text.append(" bytes\n");
+}
+
+inline void transfer_stats_append_direction_json(signal_safe_text_t& text, const transfer_direction_stats_t& stats, uint64_t elapsed) noexcept {
+	uint64_t bytes = stats.bytes.load(std::memory_order_relaxed);
+	uint64_t network_calls = stats.networkCalls.load(std::memory_order_relaxed);
+
+	text.append("{\"bytes\":");
+	text.append_unsigned(bytes);
+	text.append(",\"bytes_per_second\":");
+	text.append_unsigned(transfer_stats_per_second(bytes, elapsed));
+	text.append(",\"network_calls\":");
+	text.append_unsigned(network_calls);
+	text.append(",\"bytes_per_network_call\":");
+	text.append_unsigned(network_calls == 0 ? 0 : bytes / network_calls);
+	text.append(",\"local_calls\":");
+	text.append_unsigned(stats.localCalls.load(std::memory_order_relaxed));
+	text.append(",\"local_blocked_seconds\":");
+	text.append_seconds(stats.localNanoseconds.load(std::memory_order_relaxed));
+	text.append(",\"network_blocked_seconds\":");
+	text.append_seconds(stats.networkNanoseconds.load(std::memory_order_relaxed));
+	text.append(",\"peak_buffer_occupancy\":");
+	text.append_unsigned(stats.peakBufferOccupancy.load(std::memory_order_relaxed));
+	text.append(",\"buffer_capacity\":");
+	text.append_unsigned(stats.bufferCapacity.load(std::memory_order_relaxed));
+	text.append("}");
+}
+
+inline void transfer_stats_print() noexcept {
+	uint64_t elapsed = transfer_stats_now() - transfer_stats::startTime;
+
+	signal_safe_text_t text;
+	if (transfer_stats::printAsJSON) {
+		text.append("{\"elapsed_seconds\":");
+		text.append_seconds(elapsed);
+		text.append(",\"sent\":");
+		transfer_stats_append_direction_json(text, transfer_stats::sent, elapsed);
+		text.append(",\"received\":");
+		transfer_stats_append_direction_json(text, transfer_stats::received, elapsed);
+		text.append("}\n");
+	} else {
+		text.append("transfer statistics after ");
+		text.append_seconds(elapsed);
+		text.append(" s:\nsent:     ");
+		transfer_stats_append_direction_text(text, transfer_stats::sent, true, elapsed);
+		text.append("received: ");
+		transfer_stats_append_direction_text(text, transfer_stats::received, false, elapsed);
+	}
+
+	// NOTE: Nothing sensible to do if this fails, we might be in a signal handler or already on our way out.
+	crossplatform_write_entire_buffer(STDERR_FILENO, text.data, text.size);
+}
+
+inline void transfer_stats_print_at_exit() noexcept { transfer_stats_print(); }
+
+inline void transfer_stats_append_microseconds(signal_safe_text_t& text, uint64_t nanoseconds) noexcept {
+	text.append_unsigned(nanoseconds / 1000);
+	char fraction[4] = { '.', (char)(nanoseconds / 100 % 10 + '0'), (char)(nanoseconds / 10 % 10 + '0'), (char)(nanoseconds % 10 + '0') };
+	for (size_t i = 0; i < sizeof(fraction) && text.size < sizeof(text.data); i++) { text.data[text.size++] = fraction[i]; }
+	text.append(" us");
+}
+
+inline void transfer_stats_print_latency_histogram(int fd, TransferOperation operation) noexcept {
+	const latency_histogram_t& histogram = transfer_stats::latencies[(size_t)operation];
+	uint64_t count = latency_histogram_count(histogram);
+	if (count == 0) { return; }
+
+	signal_safe_text_t text;
+	switch (operation) {
+	case TransferOperation::STDIN_READ: text.append("stdin read"); break;
+	case TransferOperation::SOCKET_SEND: text.append("socket send"); break;
+	case TransferOperation::SOCKET_RECEIVE: text.append("socket receive"); break;
+	case TransferOperation::STDOUT_WRITE: text.append("stdout write"); break;
+	}
+	text.append(": count ");
+	text.append_unsigned(count);
+	text.append(", min ");
+	transfer_stats_append_microseconds(text, histogram.minimum.load(std::memory_order_relaxed));
+	text.append(", p50 ");
+	transfer_stats_append_microseconds(text, latency_histogram_percentile(histogram, count, 500000));
+	text.append(", p90 ");
+	transfer_stats_append_microseconds(text, latency_histogram_percentile(histogram, count, 900000));
+	text.append(", p99 ");
+	transfer_stats_append_microseconds(text, latency_histogram_percentile(histogram, count, 990000));
+	text.append(", p99.9 ");
+	transfer_stats_append_microseconds(text, latency_histogram_percentile(histogram, count, 999000));
+	text.append(", max ");
+	transfer_stats_append_microseconds(text, histogram.maximum.load(std::memory_order_relaxed));
+	text.append("\n");
+	crossplatform_write_entire_buffer(fd, text.data, text.size);
+
+	// NOTE: The raw buckets, so that tails can be looked at (or plotted) in as much detail as the histogram has.
+	for (size_t i = 0; i < latency_histogram_bucket_count; i++) {
+		uint64_t bucket_count = histogram.buckets[i].load(std::memory_order_relaxed);
+		if (bucket_count == 0) { continue; }
+		text.size = 0;
+		text.append("\t<= ");
+		transfer_stats_append_microseconds(text, latency_histogram_bucket_upper_bound(i));
+		text.append(": ");
+		text.append_unsigned(bucket_count);
+		text.append("\n");
+		crossplatform_write_entire_buffer(fd, text.data, text.size);
+	}
+}
+
+inline void transfer_stats_print_latency_histograms(int fd) noexcept {
+	for (size_t i = 0; i < transfer_operation_count; i++) { transfer_stats_print_latency_histogram(fd, (TransferOperation)i); }
+}
+
+#ifndef PLATFORM_WINDOWS
+
+inline void transfer_stats_dump_signal_handler(int) noexcept {
+	int saved_errno = errno;
+	transfer_stats_print();
+	errno = saved_errno;
+}
+
+// NOTE: Prints the statistics one last time and then lets the signal do what it would have done anyway.
+inline void transfer_stats_terminating_signal_handler(int signal_number) noexcept {
+	transfer_stats_print();
+	std::signal(signal_number, SIG_DFL);
+	std::raise(signal_number);
+}
+
+// NOTE: SA_RESTART is important, otherwise the blocking calls in the transfer loops would fail with EINTR whenever
+// somebody asks for statistics.
+inline bool transfer_stats_install_signal_handler(int signal_number, void (*handler)(int)) noexcept {
+	struct sigaction action = { };
+	action.sa_handler = handler;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	return sigaction(signal_number, &action, nullptr) != -1;
+}
+
+// NOTE: A signal that was ignored when we started (nohup, background jobs, ...) stays ignored, it isn't ours to turn
+// into one that ends nc.
+inline bool transfer_stats_install_terminating_signal_handler(int signal_number) noexcept {
+	struct sigaction previous_action;
+	if (sigaction(signal_number, nullptr, &previous_action) == -1) { return false; }
+	if (previous_action.sa_handler == SIG_IGN) { return true; }
+	return transfer_stats_install_signal_handler(signal_number, transfer_stats_terminating_signal_handler);
+}
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>		// for fixed-width integer types
+
+/*
+NOTE: How the USDT probes work (the same format as systemtap's sys/sdt.h, just without needing it installed):
+	- every probe site is a single nop instruction in the code. Nothing else happens there, the arguments are only
+		described, not computed into anywhere special (they stay in whatever register or stack slot they're in already).
+	- next to the nop, an ELF note goes into the .note.stapsdt section. It records where the nop is, the provider ("nc"),
+		the probe name and where each argument lives (like "8@%rax"). bpftrace, perf, systemtap and friends read those
+		notes and put a breakpoint on the nop when somebody attaches to the probe.
+	- .stapsdt.base is a marker that tracers use to fix up the addresses when the binary is loaded somewhere else (PIE).
+	- every argument is passed as a 64-bit unsigned integer to keep the argument descriptions simple.
+	- there's no semaphore, so the arguments are always available, which is fine since they're all values that the
+		surrounding code already has on hand.
+	- only x86-64 and AArch64 Linux get probes (that's where the operand syntax is known to line up with what tracers
+		parse), everywhere else the probes compile to nothing.
+
+	list them:	bpftrace -l 'usdt:./bin/nc:*'
+	use them:	bpftrace -e 'usdt:./bin/nc:nc:udp_receive { @sizes = hist(arg0); }'
+*/
+
+#if !defined(PLATFORM_WINDOWS) && defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+
+#define USDT_NOTE(name, argument_format) \
+	"990:\tnop\n" \
+	"\t.pushsection .note.stapsdt,\"?\",\"note\"\n" \
+	"\t.balign 4\n" \
+	"\t.4byte 992f-991f, 994f-993f, 3\n" \
+	"991:\t.asciz \"stapsdt\"\n" \
+	"992:\t.balign 4\n" \
+	"993:\t.8byte 990b\n" \
+	"\t.8byte _.stapsdt.base\n" \
+	"\t.8byte 0\n" \
+	"\t.asciz \"nc\"\n" \
+	"\t.asciz \"" #name "\"\n" \
+	"\t.asciz \"" argument_format "\"\n" \
+	"994:\t.balign 4\n" \
+	"\t.popsection\n" \
+	"\t.ifndef _.stapsdt.base\n" \
+	"\t.pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+	"\t.weak _.stapsdt.base\n" \
+	"\t.hidden _.stapsdt.base\n" \
+	"_.stapsdt.base:\t.space 1\n" \
+	"\t.size _.stapsdt.base, 1\n" \
+	"\t.popsection\n" \
+	"\t.endif\n"
+
+#define USDT_PROBE0(name) __asm__ __volatile__ (USDT_NOTE(name, ""))
+#define USDT_PROBE1(name, argument_1) __asm__ __volatile__ (USDT_NOTE(name, "8@%0") : : "nor"((uint64_t)(argument_1)))
+#define USDT_PROBE2(name, argument_1, argument_2) \
+	__asm__ __volatile__ (USDT_NOTE(name, "8@%0 8@%1") : : "nor"((uint64_t)(argument_1)), "nor"((uint64_t)(argument_2)))
+#define USDT_PROBE3(name, argument_1, argument_2, argument_3) \
+	__asm__ __volatile__ (USDT_NOTE(name, "8@%0 8@%1 8@%2") : : "nor"((uint64_t)(argument_1)), "nor"((uint64_t)(argument_2)), "nor"((uint64_t)(argument_3)))
+
+#else
+
+#define USDT_PROBE0(name) do { } while (false)
+#define USDT_PROBE1(name, argument_1) do { (void)(argument_1); } while (false)
+#define USDT_PROBE2(name, argument_1, argument_2) do { (void)(argument_1); (void)(argument_2); } while (false)
+#define USDT_PROBE3(name, argument_1, argument_2, argument_3) do { (void)(argument_1); (void)(argument_2); (void)(argument_3); } while (false)
+
+#endif